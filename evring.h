@@ -0,0 +1,111 @@
+/*
+ * tab:4
+ *
+ * evring.h - single-producer, single-consumer rings of input events
+ *
+ * Filename:      evring.h
+ */
+
+#ifndef EVRING_H
+#define EVRING_H
+
+#include <time.h>
+
+/*
+ * NOTES
+ *
+ * Each input source (keyboard, Tux controller) has its own ring, filled
+ * by the source's thread and drained by the game loop once per tick.
+ * With one writer and one reader per ring, no locks are needed: the
+ * producer owns head and the consumer owns tail, and each publishes its
+ * index with a release store that the other side reads with an acquire
+ * load.  The two indices are on separate cache lines, and each side
+ * keeps a cached copy of the other's index, so the line holding the
+ * other index is read only when the ring looks full (producer) or empty
+ * (consumer).
+ *
+ * Events carry the monotonic time at which they were produced so that
+ * the consumer can measure how long they waited.  A full ring drops new
+ * events and counts them.
+ */
+
+#define EVRING_SIZE     64  /* events per ring; must be a power of two */
+#define EVRING_LINE     64  /* cache line size in bytes                */
+
+/* kinds of input events */
+typedef enum {
+    EV_DIR,                 /* player asked to move in direction arg  */
+    EV_QUIT,                /* player asked to quit                   */
+    EV_SAVE                 /* player asked for a snapshot            */
+} input_ev_type_t;
+
+/* an input event */
+typedef struct {
+    unsigned long long t_ns;    /* monotonic time when produced         */
+    input_ev_type_t type;
+    int arg;                    /* direction for EV_DIR                 */
+} input_ev_t;
+
+/* a ring of input events */
+typedef struct {
+    /* written only by the producer */
+    unsigned int head __attribute__((aligned(EVRING_LINE)));
+    unsigned int tail_cache;    /* last tail seen by the producer       */
+    unsigned long drops;        /* events dropped because ring was full */
+
+    /* written only by the consumer */
+    unsigned int tail __attribute__((aligned(EVRING_LINE)));
+    unsigned int head_cache;    /* last head seen by the consumer       */
+
+    input_ev_t ev[EVRING_SIZE] __attribute__((aligned(EVRING_LINE)));
+} evring_t;
+
+/* read the monotonic clock in nanoseconds (for event times) */
+static inline unsigned long long evring_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* add an event made at time t_ns (producer only); returns 0, or -1 if full */
+static inline int evring_push_at(evring_t* r, unsigned long long t_ns,
+                                 input_ev_type_t type, int arg) {
+    unsigned int h = r->head;
+    input_ev_t* ev;
+
+    if (h - r->tail_cache == EVRING_SIZE) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (h - r->tail_cache == EVRING_SIZE) {
+            r->drops++;
+            return -1;
+        }
+    }
+    ev = &r->ev[h & (EVRING_SIZE - 1)];
+    ev->t_ns = t_ns;
+    ev->type = type;
+    ev->arg = arg;
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* add an event, stamped now (producer only); returns 0, or -1 if full */
+static inline int evring_push(evring_t* r, input_ev_type_t type, int arg) {
+    return evring_push_at(r, evring_now(), type, arg);
+}
+
+/* remove the oldest event (consumer only); returns 1, or 0 if empty */
+static inline int evring_pop(evring_t* r, input_ev_t* ev) {
+    unsigned int t = r->tail;
+
+    if (t == r->head_cache) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (t == r->head_cache)
+            return 0;
+    }
+    *ev = r->ev[t & (EVRING_SIZE - 1)];
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#endif /* EVRING_H */
@@ -44,6 +44,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/io.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <termio.h>
 #include <termios.h>
 #include <unistd.h>
@@ -64,6 +66,63 @@ static struct termios tio_orig;
 static int fd;
 static int tux_fd;
 int buttons;
+/* the controller's state page, or NULL to ask with TUX_BUTTONS */
+static const struct tux_state* tux_state = NULL;
+
+/* local functions--see function headers for details */
+static int map_tux_state(int tty_fd);
+static int read_tux_buttons();
+
+/* 
+ * map_tux_state
+ *   DESCRIPTION: Maps the read-only state page that the driver keeps for
+ *                the controller on tty_fd, so that the buttons can be
+ *                read without a system call.
+ *   INPUTS: tty_fd -- open controller tty using the tuxctl line discipline
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure (buttons are then read
+ *                 with TUX_BUTTONS)
+ *   SIDE EFFECTS: sets tux_state
+ */
+static int map_tux_state(int tty_fd) {
+    long page = sysconf(_SC_PAGESIZE);
+    int index;
+    int state_fd;
+    void* map;
+
+    if ((index = ioctl(tty_fd, TUX_STATE_INDEX, 0)) < 0)
+        return -1;
+    if ((state_fd = open("/dev/tuxctl", O_RDONLY)) < 0)
+        return -1;
+    map = mmap(NULL, page, PROT_READ, MAP_SHARED, state_fd, (off_t)index * page);
+    (void)close(state_fd);
+    if (map == MAP_FAILED)
+        return -1;
+    tux_state = map;
+    return 0;
+}
+
+/* 
+ * read_tux_buttons
+ *   DESCRIPTION: Reads the controller's buttons, from the state page if
+ *                it is mapped (a few loads), or else with TUX_BUTTONS.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buttons, as returned by TUX_BUTTONS
+ *   SIDE EFFECTS: none
+ */
+static int read_tux_buttons() {
+    struct tux_state s;
+    int b = 0;
+
+    if (tux_state != NULL) {
+        (void)tux_state_read(tux_state, &s);
+        return s.buttons;
+    }
+    if (ioctl(tux_fd, TUX_BUTTONS, (unsigned long) (&b)) != 0)
+        printf("TUX_BUTTONS failed\n");
+    return b;
+}
 /* 
  * init_input
  *   DESCRIPTION: Initializes the input controller.  As both keyboard and
@@ -179,8 +238,7 @@ cmd_t get_command(dir_t cur_dir) {
 #endif
     }
 
-    int r = ioctl(tux_fd, TUX_BUTTONS, (unsigned long) (&buttons));
-    if(r != 0) printf("r: %d\n", r);
+    buttons = read_tux_buttons();
     if(buttons == 0x10) pushed = DIR_UP;
     if(buttons == 0x20) pushed = DIR_DOWN;
     if(buttons == 0x30) pushed = DIR_LEFT;
@@ -244,6 +302,8 @@ int main() {
     ioctl(fd, TIOCSETD, &ldisc_num);
     ioctl(fd, TUX_INIT, 0);
     ioctl(fd, TUX_SET_LED, 0x07071234);
+    if (map_tux_state(fd) != 0)
+        perror("map_tux_state");
 
     /* Grant ourselves permission to use ports 0-1023 */
     if (ioperm(0, 1024, 1) == -1) {
@@ -253,7 +313,7 @@ int main() {
     int buttons = 0;
     init_input();
     while (1) {
-        ioctl(fd, TUX_BUTTONS, &buttons);
+        buttons = read_tux_buttons();
         printf("%x\n",buttons);
         // printf("CURRENT DIRECTION IS %s\n", dir_names[dir]);
         // while ((cmd = get_command(dir)) == TURN_NONE);
@@ -36,9 +36,11 @@
  *        Integrated Nate Taylor's "god mode."
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -54,17 +56,28 @@
 #define GOD_MODE 1
 
 /* local functions--see function headers for details */
-static int mark_maze_area(int x, int y);
-static void add_a_fruit_internal();
+static int mark_maze_area(maze_t* m, int x, int y);
+static void place_fruit(maze_t* m, int* fx, int* fy);
+static void compute_exit_dist(maze_t* m);
+static void compute_fruit_dist(maze_t* m);
+static void fruit_dist_add(maze_t* m, int room);
+static void fruit_dist_remove(maze_t* m, int room);
+static int room_neighbors(const maze_t* m, int room, int nbr[NUM_DIRS]);
+static void seed_rng(maze_t* m, unsigned long seed);
+static uint32_t rng_next(maze_t* m);
+static uint32_t rng_below(maze_t* m, uint32_t n);
 #if (TEST_MAZE_GEN == 0) /* not used when testing maze generation */
-static unsigned char* find_block(int x, int y);
-static void _add_a_fruit(int show);
+static unsigned char* find_block(const maze_t* m, int x, int y);
+static void fill_horiz(const maze_t* m, int x, int y, unsigned char buf[SCROLL_X_DIM]);
+static void _add_a_fruit(maze_t* m, int show);
+static void mark_dirty(maze_t* m, int x, int y);
 #endif
 
 /*
- * The maze array contains a one byte bit vector (maze_bit_t) for each
- * location in a maze.  The left and right boundaries of the maze are unified,
- * i.e., column 0 also forms the right boundary via wraparound.  Drawings
+ * The maze array (the maze field of a maze_t) contains a one byte bit
+ * vector (maze_bit_t) for each
+ * location in a maze.  The left and right boundaries of the maze are
+ * unified, i.e., column 0 also forms the right boundary via wraparound.  Drawings
  * for each block in the maze are chosen based on a five-point stencil
  * that includes north, east, south, and west neighbor blocks.  For
  * simplicity, the maze array is extended with additional rows on the top
@@ -78,17 +91,121 @@ static void _add_a_fruit(int show);
  * 2 X_DIM (2 Y_DIM + 3), and the space allocated is one larger than this
  * maximum index value.
  */
-static unsigned char maze[2 * MAZE_MAX_X_DIM * (2 * MAZE_MAX_Y_DIM + 3) + 1];
-static int maze_x_dim;          /* horizontal dimension of maze */
-static int maze_y_dim;          /* vertical dimension of maze   */
-static int n_fruits;            /* number of fruits in maze     */
-static int exit_x, exit_y;      /* lattice point of maze exit   */
+/*
+ * Maze generation draws its random numbers from a xoshiro128** generator
+ * kept in the maze_t rather than from random(), which takes a lock in
+ * glibc and cannot be replayed.  Each maze records the seed from which
+ * it was built, so a maze can be reproduced exactly, and mazes can be
+ * built on several threads at once.
+ */
 
 /* 
  * maze array index calculation macro; maze dimensions are valid only
- * after a call to make_maze
+ * after the maze has been generated
+ */
+#define MAZE_INDEX(m,a,b) ((a) + ((b) + 1) * (m)->x_dim * 2)
+
+/* 
+ * conversions between (odd,odd) lattice points and the room indices
+ * used by the distance fields
+ */
+#define ROOM_INDEX(m,a,b) (((b) >> 1) * (m)->x_dim + ((a) >> 1))
+#define ROOM_X(m,r)       (((r) % (m)->x_dim) * 2 + 1)
+#define ROOM_Y(m,r)       (((r) / (m)->x_dim) * 2 + 1)
+
+/* 
+ * seed_rng
+ *   DESCRIPTION: Initialize the maze random number generator from a seed.
+ *                The four words of xoshiro128** state are filled with the
+ *                output of a splitmix64 sequence started at the seed, which
+ *                guarantees that the state is never all zero.
+ *   INPUTS: m -- the maze whose generator is seeded
+ *           seed -- the seed value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the generator state and records the seed
+ */
+static void seed_rng(maze_t* m, unsigned long seed) {
+    uint64_t z;     /* splitmix64 output      */
+    uint64_t x;     /* splitmix64 state       */
+    int i;          /* loop index over words  */
+
+    m->seed = seed;
+    x = seed;
+    for (i = 0; i < 4; i += 2) {
+        z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= (z >> 31);
+        m->rng[i] = (uint32_t)z;
+        m->rng[i + 1] = (uint32_t)(z >> 32);
+    }
+}
+
+/* 
+ * rng_next
+ *   DESCRIPTION: Produce the next 32-bit value from the maze random number
+ *                generator (xoshiro128**).
+ *   INPUTS: m -- the maze whose generator is used
+ *   OUTPUTS: none
+ *   RETURN VALUE: a uniformly distributed 32-bit value
+ *   SIDE EFFECTS: advances the generator state
+ */
+static uint32_t rng_next(maze_t* m) {
+    uint32_t result;    /* value returned         */
+    uint32_t t;         /* shifted copy of word 1 */
+
+    result = m->rng[1] * 5;
+    result = ((result << 7) | (result >> 25)) * 9;
+    t = m->rng[1] << 9;
+    m->rng[2] ^= m->rng[0];
+    m->rng[3] ^= m->rng[1];
+    m->rng[1] ^= m->rng[2];
+    m->rng[0] ^= m->rng[3];
+    m->rng[2] ^= t;
+    m->rng[3] = (m->rng[3] << 11) | (m->rng[3] >> 21);
+
+    return result;
+}
+
+/* 
+ * rng_below
+ *   DESCRIPTION: Produce a random value uniformly distributed over [0,n).
+ *                Uses Lemire's multiply-and-shift reduction, rejecting the
+ *                few low products that would otherwise bias the result
+ *                (as taking the value modulo n does).
+ *   INPUTS: m -- the maze whose generator is used
+ *           n -- number of possible values; must be positive
+ *   OUTPUTS: none
+ *   RETURN VALUE: a value from 0 to n - 1
+ *   SIDE EFFECTS: advances the generator state
  */
-#define MAZE_INDEX(a,b) ((a) + ((b) + 1) * maze_x_dim * 2)
+static uint32_t rng_below(maze_t* m, uint32_t n) {
+    uint64_t prod;      /* 64-bit product of random value and n */
+    uint32_t threshold; /* smallest unbiased low word          */
+
+    prod = (uint64_t)rng_next(m) * n;
+    if ((uint32_t)prod < n) {
+        threshold = (0U - n) % n;
+        while ((uint32_t)prod < threshold)
+            prod = (uint64_t)rng_next(m) * n;
+    }
+    return (uint32_t)(prod >> 32);
+}
+
+/* 
+ * get_maze_seed
+ *   DESCRIPTION: Report the seed used to generate a maze.  Passing this
+ *                value to generate_maze with the same dimensions and
+ *                fruit count reproduces the maze exactly.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: the seed of the maze
+ *   SIDE EFFECTS: none
+ */
+unsigned long get_maze_seed(const maze_t* m) {
+    return m->seed;
+}
 
 /* 
  * mark_maze_area
@@ -96,12 +213,13 @@ static int exit_x, exit_y;      /* lattice point of maze exit   */
  *                maze accessible from (x,y) with the MAZE_REACH bit.
  *                Stops at walls and at maze locations already marked 
  *                as reached.
- *   INPUTS: (x,y) -- starting coordinate within maze
+ *   INPUTS: m -- the maze
+ *           (x,y) -- starting coordinate within maze
  *   OUTPUTS: none
  *   RETURN VALUE: number of maze locations marked
  *   SIDE EFFECTS: leaves MAZE_REACH markers on marked portion of maze
  */
-static int mark_maze_area(int x, int y) {
+static int mark_maze_area(maze_t* m, int x, int y) {
     /* 
      * queue for breadth-first search
      *
@@ -120,7 +238,7 @@ static int mark_maze_area(int x, int y) {
     unsigned char* cur;
 
     /* Mark the starting location as reached, then put it into the queue. */
-    q[0] = &maze[MAZE_INDEX(x, y)];
+    q[0] = &m->maze[MAZE_INDEX(m, x, y)];
     *(q[0]) |= MAZE_REACH;
     q_start = 0;
     q_end = 1;
@@ -141,20 +259,20 @@ static int mark_maze_area(int x, int y) {
          * being added when reached by multiple paths of equal length
          * from the starting point.
          */
-        if ((cur[-2 * maze_x_dim] & MAZE_WALL) == 0 &&
-            (cur[-4 * maze_x_dim] & MAZE_REACH) == 0) {
-            cur[-4 * maze_x_dim] |= MAZE_REACH;
-            q[q_end++] = &cur[-4 * maze_x_dim];
+        if ((cur[-2 * m->x_dim] & MAZE_WALL) == 0 &&
+            (cur[-4 * m->x_dim] & MAZE_REACH) == 0) {
+            cur[-4 * m->x_dim] |= MAZE_REACH;
+            q[q_end++] = &cur[-4 * m->x_dim];
         }
         if ((cur[1] & MAZE_WALL) == 0 &&
             (cur[2] & MAZE_REACH) == 0) {
             cur[2] |= MAZE_REACH;
             q[q_end++] = &cur[2];
         }
-        if ((cur[2 * maze_x_dim] & MAZE_WALL) == 0 &&
-            (cur[4 * maze_x_dim] & MAZE_REACH) == 0) {
-            cur[4 * maze_x_dim] |= MAZE_REACH;
-            q[q_end++] = &cur[4 * maze_x_dim];
+        if ((cur[2 * m->x_dim] & MAZE_WALL) == 0 &&
+            (cur[4 * m->x_dim] & MAZE_REACH) == 0) {
+            cur[4 * m->x_dim] |= MAZE_REACH;
+            q[q_end++] = &cur[4 * m->x_dim];
         }
         if ((cur[-1] & MAZE_WALL) == 0 &&
             (cur[-2] & MAZE_REACH) == 0) {
@@ -171,7 +289,7 @@ static int mark_maze_area(int x, int y) {
 }
 
 /* 
- * make_maze
+ * generate_maze
  *   DESCRIPTION: Create a maze of specified dimensions.  The maze is
  *                built as a two-dimensional lattice in which the points
  *       01234      with odd indices in both dimensions are always open,
@@ -205,16 +323,22 @@ static int mark_maze_area(int x, int y) {
  *                we scan the maze for such adjacent pairs (rather than
  *                choosing randomly) until the entire maze is reachable
  *                from (1,1).
- *   INPUTS: (x_dim,y_dim) -- size of maze
+ *
+ *                Only the maze passed in is touched, so mazes may be
+ *                generated on several threads at once.
+ *   INPUTS: m -- the maze to be filled in
+ *           (x_dim,y_dim) -- size of maze
  *           start_fruits -- number of fruits to place in maze
- *   OUTPUTS: none
+ *           seed -- seed for the maze's random number generator
+ *   OUTPUTS: *m -- the new maze
  *   RETURN VALUE: 0 on success, -1 on failure (if requested maze size
  *              exceeds limits set by defined values, with minimum
  *              (MAZE_MIN_X_DIM,MAZE_MIN_Y_DIM) and maximum
  *              (MAZE_MAX_X_DIM,MAZE_MAX_Y_DIM))
- *   SIDE EFFECTS: leaves MAZE_REACH markers on marked portion of maze
+ *   SIDE EFFECTS: none
  */
-int make_maze(int x_dim, int y_dim, int start_fruits) {
+int generate_maze(maze_t* m, int x_dim, int y_dim, int start_fruits,
+                  unsigned long seed) {
     /* 
      * worm turn weights; the first dimension is relative direction
      * (number of 90-degree turns clockwise from up); the second is 
@@ -230,14 +354,16 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
     if (x_dim < MAZE_MIN_X_DIM || x_dim > MAZE_MAX_X_DIM ||
         y_dim < MAZE_MIN_Y_DIM || y_dim > MAZE_MAX_Y_DIM)
         return -1;
-    maze_x_dim = x_dim;
-    maze_y_dim = y_dim;
+    m->x_dim = x_dim;
+    m->y_dim = y_dim;
 
     /* Fill the maze with walls. */
-    memset(maze, MAZE_WALL, sizeof (maze));
+    memset(m->maze, MAZE_WALL, sizeof (m->maze));
+    m->n_dirty = 0;
+    m->redraw_all = 0;
 
     /* Seed the random number generator. */
-    srandom(time (NULL));
+    seed_rng(m, seed);
 
     /*
      * 'worm' phase of maze generation
@@ -247,20 +373,20 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
      * Track the number of (odd,odd) lattice points still marked 
      * as MAZE_WALL. 
      */
-    remaining = maze_x_dim * maze_y_dim;
+    remaining = m->x_dim * m->y_dim;
     do {
     /* Pick an (odd,odd) lattice point still marked as a MAZE_WALL. */
         do {
-            x = (random() % maze_x_dim) * 2 + 1;
-            y = (random() % maze_y_dim) * 2 + 1;
-        } while ((maze[MAZE_INDEX(x, y)] & MAZE_WALL) == 0);
+            x = rng_below(m, m->x_dim) * 2 + 1;
+            y = rng_below(m, m->y_dim) * 2 + 1;
+        } while ((m->maze[MAZE_INDEX(m, x, y)] & MAZE_WALL) == 0);
 
         /* Empty the starting point. */
-        maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+        m->maze[MAZE_INDEX(m, x, y)] = MAZE_NONE;
         remaining--;
 
         /* The worm's initial preferred direction is random. */
-        pref_dir = (random() % 4);
+        pref_dir = rng_below(m, 4);
 
         /* Move around the maze until worm turns back on itself. */
         while (1) {
@@ -277,18 +403,18 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
              */
             total = 0;
             if (y > 1)
-                total += turn_wt[pref_dir][maze[MAZE_INDEX(x, y - 2)] == MAZE_WALL];
+                total += turn_wt[pref_dir][m->maze[MAZE_INDEX(m, x, y - 2)] == MAZE_WALL];
             wt[0] = total;
-            if (x < maze_x_dim * 2 - 1)
-                total += turn_wt[(pref_dir + 3) % 4][maze[MAZE_INDEX(x + 2, y)] == MAZE_WALL];
+            if (x < m->x_dim * 2 - 1)
+                total += turn_wt[(pref_dir + 3) % 4][m->maze[MAZE_INDEX(m, x + 2, y)] == MAZE_WALL];
             wt[1] = total;
-            if (y < maze_y_dim * 2 - 1)
-                total += turn_wt[(pref_dir + 2) % 4][maze[MAZE_INDEX(x, y + 2)] == MAZE_WALL];
+            if (y < m->y_dim * 2 - 1)
+                total += turn_wt[(pref_dir + 2) % 4][m->maze[MAZE_INDEX(m, x, y + 2)] == MAZE_WALL];
             wt[2] = total;
             if (x > 1)
-                total += turn_wt[(pref_dir + 1) % 4][maze[MAZE_INDEX(x - 2, y)] == MAZE_WALL];
+                total += turn_wt[(pref_dir + 1) % 4][m->maze[MAZE_INDEX(m, x - 2, y)] == MAZE_WALL];
             wt[3] = total;
-            pick = (random() % total);
+            pick = rng_below(m, total);
             for (dir = 0; pick >= wt[dir]; dir++);
 
             /* If worm decides to turn around, it's done. */
@@ -299,27 +425,27 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
             pref_dir = dir;
             switch (pref_dir) {
                 case 0:
-                    maze[MAZE_INDEX(x, y - 1)] = MAZE_NONE;
+                    m->maze[MAZE_INDEX(m, x, y - 1)] = MAZE_NONE;
                     y -=2;
                     break;
                 case 1:
-                    maze[MAZE_INDEX(x + 1, y)] = MAZE_NONE;
+                    m->maze[MAZE_INDEX(m, x + 1, y)] = MAZE_NONE;
                     x += 2;
                     break;
                 case 2:
-                    maze[MAZE_INDEX(x, y + 1)] = MAZE_NONE;
+                    m->maze[MAZE_INDEX(m, x, y + 1)] = MAZE_NONE;
                     y +=2;
                     break;
                 case 3:
-                    maze[MAZE_INDEX(x - 1, y)] = MAZE_NONE;
+                    m->maze[MAZE_INDEX(m, x - 1, y)] = MAZE_NONE;
                     x -= 2;
                     break;
             }
 
             /* If necessary, the worm 'eats' the wall at the new space. */
-            if (maze[MAZE_INDEX(x, y)] == MAZE_WALL)
+            if (m->maze[MAZE_INDEX(m, x, y)] == MAZE_WALL)
             remaining--;
-            maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+            m->maze[MAZE_INDEX(m, x, y)] = MAZE_NONE;
         } /* loop for one worm */
 
         /* 
@@ -333,7 +459,7 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
      * connectivity between all (odd,odd) lattice points in the maze.
      * We start by marking everything connected to (1,1).
      */
-    remaining = maze_x_dim * maze_y_dim - mark_maze_area (1, 1);
+    remaining = m->x_dim * m->y_dim - mark_maze_area(m, 1, 1);
     trials = 0;
     do {
         /*
@@ -343,86 +469,447 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
          * of the maze to the (1,1) lattice point.
          */
         if (remaining < 20 || ++trials > 100) {
-            if ((x += 2) > maze_x_dim * 2) {
-                x -= maze_x_dim * 2;
-                if ((y += 2) > 2 * maze_y_dim)
-                    y -= 2 * maze_y_dim;
+            if ((x += 2) > m->x_dim * 2) {
+                x -= m->x_dim * 2;
+                if ((y += 2) > 2 * m->y_dim)
+                    y -= 2 * m->y_dim;
             }
-            cur = &maze[MAZE_INDEX(x, y)];
+            cur = &m->maze[MAZE_INDEX(m, x, y)];
             if ((cur[0] & MAZE_REACH) != 0)
                 continue;
         } else {
             /* Pick an unconnected (odd,odd) lattice point at random. */
             do {
-                x = (random() % maze_x_dim) * 2 + 1;
-                y = (random() % maze_y_dim) * 2 + 1;
-                cur = &maze[MAZE_INDEX(x, y)];
+                x = rng_below(m, m->x_dim) * 2 + 1;
+                y = rng_below(m, m->y_dim) * 2 + 1;
+                cur = &m->maze[MAZE_INDEX(m, x, y)];
             } while ((cur[0] & MAZE_REACH) != 0);
         }
         /* 
          * Try to connect the unconnected point by knocking down a wall
          * in some direction.
          */
-        if (y > 1 && (cur[-4 * maze_x_dim] & MAZE_REACH) != 0)
-            cur[-2 * maze_x_dim] = MAZE_NONE;
+        if (y > 1 && (cur[-4 * m->x_dim] & MAZE_REACH) != 0)
+            cur[-2 * m->x_dim] = MAZE_NONE;
         else if (x > 1 && (cur[-2] & MAZE_REACH) != 0)
             cur[-1] = MAZE_NONE;
-        else if (x < 2 * maze_x_dim - 1 && (cur[2] & MAZE_REACH) != 0)
+        else if (x < 2 * m->x_dim - 1 && (cur[2] & MAZE_REACH) != 0)
             cur[1] = MAZE_NONE;
-        else if (y < 2 * maze_y_dim - 1 && (cur[4 * maze_x_dim] & MAZE_REACH) != 0)
-            cur[2 * maze_x_dim] = MAZE_NONE;
+        else if (y < 2 * m->y_dim - 1 && (cur[4 * m->x_dim] & MAZE_REACH) != 0)
+            cur[2 * m->x_dim] = MAZE_NONE;
         else 
             continue;
         /* 
          * Success!  Mark the newly connected portion of the maze
          * as reachable.
          */
-        remaining -= mark_maze_area(x, y);
+        remaining -= mark_maze_area(m, x, y);
     } while (remaining > 0);
 
     /* 
      * Remove the MAZE_REACH markers--these are reused to mark those
      * portions of the maze already seen by the player.
      */ 
-    for (x = 1; x < 2 * maze_x_dim; x += 2)
-        for (y = 1; y < 2 * maze_y_dim; y += 2)
-            maze[MAZE_INDEX(x, y)] &= ~MAZE_REACH;
+    for (x = 1; x < 2 * m->x_dim; x += 2)
+        for (y = 1; y < 2 * m->y_dim; y += 2)
+            m->maze[MAZE_INDEX(m, x, y)] &= ~MAZE_REACH;
 
 #if 0 /* Be kind and show the maze boundary at start. */
-    for (x = 0; x < 2 * maze_x_dim; x++) {
-        maze[MAZE_INDEX(x, 0)] |= MAZE_REACH;
-        maze[MAZE_INDEX(x, 2 * maze_y_dim)] |= MAZE_REACH;
+    for (x = 0; x < 2 * m->x_dim; x++) {
+        m->maze[MAZE_INDEX(m, x, 0)] |= MAZE_REACH;
+        m->maze[MAZE_INDEX(m, x, 2 * m->y_dim)] |= MAZE_REACH;
     }
-    /* The value at y == 2 * maze_y_dim is the bottom of the right boundary. */
-    for (y = 0; y <= 2 * maze_y_dim + 1; y++)
-        maze[MAZE_INDEX(0, y)] |= MAZE_REACH;
+    /* The value at y == 2 * m->y_dim is the bottom of the right boundary. */
+    for (y = 0; y <= 2 * m->y_dim + 1; y++)
+        m->maze[MAZE_INDEX(m, 0, y)] |= MAZE_REACH;
 #endif
 
 #if GOD_MODE /* Remove all walls! */
-    for (x = 1; x < 2 * maze_x_dim; x++) {
-        for (y = 1; y < 2 * maze_y_dim; y++) {
-            maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+    for (x = 1; x < 2 * m->x_dim; x++) {
+        for (y = 1; y < 2 * m->y_dim; y++) {
+            m->maze[MAZE_INDEX(m, x, y)] = MAZE_NONE;
         }
     }
 #endif
 
     /* Put the required number of fruits in the maze. */
-    n_fruits = 0;
+    m->n_fruits = 0;
     for (i = 0; i < start_fruits; i++)
-        add_a_fruit_internal();
+        place_fruit(m, &x, &y);
 
     /* Find an unfruited maze point and put the maze exit there. */
     do {
-        x = (random() % maze_x_dim) * 2 + 1;
-        y = (random() % maze_y_dim) * 2 + 1;
-    } while ((maze[MAZE_INDEX(x, y)] & MAZE_FRUIT));
-    maze[MAZE_INDEX(x, y)] |= MAZE_EXIT;
-    exit_x = x;
-    exit_y = y;
+        x = rng_below(m, m->x_dim) * 2 + 1;
+        y = rng_below(m, m->y_dim) * 2 + 1;
+    } while ((m->maze[MAZE_INDEX(m, x, y)] & MAZE_FRUIT));
+    m->maze[MAZE_INDEX(m, x, y)] |= MAZE_EXIT;
+    m->exit_x = x;
+    m->exit_y = y;
+
+    /* Compute the distance fields. */
+    compute_exit_dist(m);
+    compute_fruit_dist(m);
 
     return 0;
 }
 
+/* 
+ * restore_maze
+ *   DESCRIPTION: Finish loading a maze whose lattice, dimensions, exit,
+ *                fruit count, and generator state have been copied in
+ *                from a saved snapshot.  Checks the values, drops any
+ *                queued redraws, and rebuilds the distance fields, which
+ *                are not saved.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the maze values are not valid
+ *   SIDE EFFECTS: modifies the maze
+ */
+int restore_maze(maze_t* m) {
+    int i;
+
+    if (m->x_dim < MAZE_MIN_X_DIM || m->x_dim > MAZE_MAX_X_DIM ||
+        m->y_dim < MAZE_MIN_Y_DIM || m->y_dim > MAZE_MAX_Y_DIM ||
+        m->exit_x < 1 || m->exit_x >= 2 * m->x_dim ||
+        m->exit_y < 1 || m->exit_y >= 2 * m->y_dim ||
+        m->n_fruits < 0 || m->n_fruits > m->x_dim * m->y_dim ||
+        !(m->maze[MAZE_INDEX(m, m->exit_x, m->exit_y)] & MAZE_EXIT))
+        return -1;
+
+    for (i = 0; i < sizeof (m->maze); i++)
+        m->maze[i] &= ~MAZE_DIRTY;
+    m->n_dirty = 0;
+    m->redraw_all = 0;
+
+    compute_exit_dist(m);
+    compute_fruit_dist(m);
+    return 0;
+}
+
+/* 
+ * make_maze
+ *   DESCRIPTION: Create a maze of specified dimensions (see generate_maze),
+ *                seeded from the clock.  get_maze_seed reports the seed.
+ *   INPUTS: m -- the maze to be built
+ *           (x_dim,y_dim) -- size of maze
+ *           start_fruits -- number of fruits to place in maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: replaces the contents of the maze
+ */
+int make_maze(maze_t* m, int x_dim, int y_dim, int start_fruits) {
+    unsigned long seed; /* seed for the new maze */
+    struct timeval tv;
+
+    (void)gettimeofday(&tv, NULL);
+    seed = (unsigned long)tv.tv_sec * 1000003UL + tv.tv_usec;
+    return generate_maze(m, x_dim, y_dim, start_fruits, seed);
+}
+
+/* 
+ * place_fruit
+ *   DESCRIPTION: Add a random fruit to a random unfruited (odd,odd)
+ *                lattice point in a maze and update the maze's number
+ *                of fruits.  Could fall on the maze exit, if that is
+ *                already defined.  Nothing is drawn.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: *fx, *fy -- lattice point of the new fruit
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void place_fruit(maze_t* m, int* fx, int* fy) {
+    int x, y;    /* lattice point for new fruit */
+
+    do {
+        x = rng_below(m, m->x_dim) * 2 + 1;
+        y = rng_below(m, m->y_dim) * 2 + 1;
+    } while ((m->maze[MAZE_INDEX(m, x, y)] & MAZE_FRUIT));
+
+    m->maze[MAZE_INDEX(m, x, y)] |= (rng_below(m, NUM_FRUIT_TYPES) + 1) * MAZE_FRUIT_1;
+    ++m->n_fruits;
+
+    *fx = x;
+    *fy = y;
+}
+
+/* 
+ * room_neighbors
+ *   DESCRIPTION: Find the rooms reachable in one step from a room, i.e.,
+ *                adjacent rooms not separated from it by a wall.
+ *   INPUTS: m -- the maze
+ *           room -- room index of the starting point
+ *   OUTPUTS: nbr -- room indices of the neighbors
+ *   RETURN VALUE: number of neighbors found
+ *   SIDE EFFECTS: none
+ */
+static int room_neighbors(const maze_t* m, int room, int nbr[NUM_DIRS]) {
+    int x = ROOM_X(m, room);    /* lattice point of the room */
+    int y = ROOM_Y(m, room);
+    int n = 0;                  /* number of neighbors found */
+    const unsigned char* cur = &m->maze[MAZE_INDEX(m, x, y)];
+
+    if (y > 1 && (cur[-2 * m->x_dim] & MAZE_WALL) == 0)
+        nbr[n++] = room - m->x_dim;
+    if (x < 2 * m->x_dim - 1 && (cur[1] & MAZE_WALL) == 0)
+        nbr[n++] = room + 1;
+    if (y < 2 * m->y_dim - 1 && (cur[2 * m->x_dim] & MAZE_WALL) == 0)
+        nbr[n++] = room + m->x_dim;
+    if (x > 1 && (cur[-1] & MAZE_WALL) == 0)
+        nbr[n++] = room - 1;
+    return n;
+}
+
+/* 
+ * compute_exit_dist
+ *   DESCRIPTION: Fill in the exit distance field of a maze with a
+ *                breadth-first search from the exit.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes m->exit_dist
+ */
+static void compute_exit_dist(maze_t* m) {
+    int q[MAZE_MAX_ROOMS];      /* breadth-first search queue      */
+    int q_start, q_end;         /* first used and first free slots */
+    int nbr[NUM_DIRS];          /* neighbors of a room             */
+    int cur, n, i;
+
+    for (i = 0; i < m->x_dim * m->y_dim; i++)
+        m->exit_dist[i] = MAZE_NO_DIST;
+    q[0] = ROOM_INDEX(m, m->exit_x, m->exit_y);
+    m->exit_dist[q[0]] = 0;
+    q_start = 0;
+    q_end = 1;
+    while (q_start != q_end) {
+        cur = q[q_start++];
+        n = room_neighbors(m, cur, nbr);
+        for (i = 0; i < n; i++) {
+            if (m->exit_dist[nbr[i]] == MAZE_NO_DIST) {
+                m->exit_dist[nbr[i]] = m->exit_dist[cur] + 1;
+                q[q_end++] = nbr[i];
+            }
+        }
+    }
+}
+
+/* 
+ * compute_fruit_dist
+ *   DESCRIPTION: Fill in the fruit distance field of a maze with a
+ *                breadth-first search started from all fruits at once.
+ *                Each room also records which fruit is nearest; every
+ *                room other than a fruit then has a neighbor one step
+ *                closer to the same fruit, which the incremental updates
+ *                below rely upon.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes m->fruit_dist and m->fruit_src
+ */
+static void compute_fruit_dist(maze_t* m) {
+    int q[MAZE_MAX_ROOMS];      /* breadth-first search queue      */
+    int q_start, q_end;         /* first used and first free slots */
+    int nbr[NUM_DIRS];          /* neighbors of a room             */
+    int cur, n, i;
+
+    q_end = 0;
+    for (i = 0; i < m->x_dim * m->y_dim; i++) {
+        m->fruit_src[i] = i;
+        if (m->maze[MAZE_INDEX(m, ROOM_X(m, i), ROOM_Y(m, i))] & MAZE_FRUIT) {
+            m->fruit_dist[i] = 0;
+            q[q_end++] = i;
+        } else {
+            m->fruit_dist[i] = MAZE_NO_DIST;
+        }
+    }
+    q_start = 0;
+    while (q_start != q_end) {
+        cur = q[q_start++];
+        n = room_neighbors(m, cur, nbr);
+        for (i = 0; i < n; i++) {
+            if (m->fruit_dist[nbr[i]] == MAZE_NO_DIST) {
+                m->fruit_dist[nbr[i]] = m->fruit_dist[cur] + 1;
+                m->fruit_src[nbr[i]] = m->fruit_src[cur];
+                q[q_end++] = nbr[i];
+            }
+        }
+    }
+}
+
+/* 
+ * fruit_dist_add
+ *   DESCRIPTION: Update the fruit distance field after a fruit has been
+ *                placed in a room.  Distances can only shrink, so a
+ *                search from the new fruit visits only those rooms that
+ *                are now strictly closer to it than to any other fruit.
+ *   INPUTS: m -- the maze
+ *           room -- room index of the new fruit
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes m->fruit_dist and m->fruit_src
+ */
+static void fruit_dist_add(maze_t* m, int room) {
+    int q[MAZE_MAX_ROOMS];      /* breadth-first search queue      */
+    int q_start, q_end;         /* first used and first free slots */
+    int nbr[NUM_DIRS];          /* neighbors of a room             */
+    int cur, n, i;
+
+    m->fruit_dist[room] = 0;
+    m->fruit_src[room] = room;
+    q[0] = room;
+    q_start = 0;
+    q_end = 1;
+    while (q_start != q_end) {
+        cur = q[q_start++];
+        n = room_neighbors(m, cur, nbr);
+        for (i = 0; i < n; i++) {
+            if (m->fruit_dist[nbr[i]] > m->fruit_dist[cur] + 1) {
+                m->fruit_dist[nbr[i]] = m->fruit_dist[cur] + 1;
+                m->fruit_src[nbr[i]] = room;
+                q[q_end++] = nbr[i];
+            }
+        }
+    }
+}
+
+/* 
+ * fruit_dist_remove
+ *   DESCRIPTION: Update the fruit distance field after the fruit in a room
+ *                has been removed.  Only rooms whose nearest fruit was the
+ *                removed one change.  These rooms are cleared, seeded from
+ *                their unaffected neighbors, and settled in order of
+ *                distance with a bucket queue (Dial's algorithm).
+ *   INPUTS: m -- the maze
+ *           room -- room index of the removed fruit
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes m->fruit_dist and m->fruit_src
+ */
+static void fruit_dist_remove(maze_t* m, int room) {
+    int area[MAZE_MAX_ROOMS];           /* rooms that lost their fruit    */
+    short next[MAZE_MAX_ROOMS];         /* bucket queue links             */
+    short head[MAZE_MAX_ROOMS];         /* first room at each distance    */
+    int n_area = 0;                     /* number of rooms in area        */
+    int nbr[NUM_DIRS];                  /* neighbors of a room            */
+    int min_d;                          /* distance of first bucket       */
+    int cur, d, n, i, j;
+
+    /* 
+     * Find and clear the rooms closest to the removed fruit.  These form
+     * a connected area around the fruit, so a search from the fruit that
+     * stays within rooms with the same source finds all of them.
+     */
+    area[n_area++] = room;
+    m->fruit_dist[room] = MAZE_NO_DIST;
+    for (i = 0; i < n_area; i++) {
+        n = room_neighbors(m, area[i], nbr);
+        for (j = 0; j < n; j++) {
+            if (m->fruit_src[nbr[j]] == room &&
+                m->fruit_dist[nbr[j]] != MAZE_NO_DIST) {
+                m->fruit_dist[nbr[j]] = MAZE_NO_DIST;
+                area[n_area++] = nbr[j];
+            }
+        }
+    }
+
+    /* If no fruit is left, every cleared room stays unreachable. */
+    if (m->n_fruits == 0)
+        return;
+
+    /* Seed each cleared room from its best unaffected neighbor. */
+    min_d = MAZE_NO_DIST;
+    for (i = 0; i < n_area; i++) {
+        cur = area[i];
+        n = room_neighbors(m, cur, nbr);
+        for (j = 0; j < n; j++) {
+            if (m->fruit_src[nbr[j]] != room &&
+                m->fruit_dist[nbr[j]] != MAZE_NO_DIST &&
+                m->fruit_dist[nbr[j]] + 1 < m->fruit_dist[cur]) {
+                m->fruit_dist[cur] = m->fruit_dist[nbr[j]] + 1;
+                m->fruit_src[cur] = m->fruit_src[nbr[j]];
+            }
+        }
+        if (m->fruit_dist[cur] < min_d)
+            min_d = m->fruit_dist[cur];
+    }
+    if (min_d == MAZE_NO_DIST)
+        return;
+
+    /* 
+     * The area is connected, so every room in it ends up within n_area - 1
+     * steps of the closest seed, and n_area buckets starting at min_d
+     * suffice.  Seeds beyond the last bucket are improved by relaxation.
+     */
+    for (i = 0; i < n_area; i++)
+        head[i] = -1;
+    for (i = 0; i < n_area; i++) {
+        cur = area[i];
+        if ((d = m->fruit_dist[cur] - min_d) < n_area) {
+            next[cur] = head[d];
+            head[d] = cur;
+        }
+    }
+
+    /* 
+     * Settle rooms in order of distance.  Entries whose distance has
+     * since dropped are stale and skipped.
+     */
+    for (d = 0; d < n_area; d++) {
+        while ((cur = head[d]) != -1) {
+            head[d] = next[cur];
+            if (m->fruit_dist[cur] != min_d + d)
+                continue;
+            n = room_neighbors(m, cur, nbr);
+            for (j = 0; j < n; j++) {
+                if (d + 1 < n_area &&
+                    m->fruit_dist[nbr[j]] > min_d + d + 1) {
+                    m->fruit_dist[nbr[j]] = min_d + d + 1;
+                    m->fruit_src[nbr[j]] = m->fruit_src[cur];
+                    next[nbr[j]] = head[d + 1];
+                    head[d + 1] = nbr[j];
+                }
+            }
+        }
+    }
+}
+
+/* 
+ * exit_distance
+ *   DESCRIPTION: Look up the number of steps from a lattice point in the
+ *                current maze to the maze exit.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- an (odd,odd) lattice point in the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: the distance in maze squares, or -1 if the point is
+ *                 invalid or cannot reach the exit
+ *   SIDE EFFECTS: none
+ */
+int exit_distance(const maze_t* m, int x, int y) {
+
+    if (x < 1 || x >= 2 * m->x_dim || y < 1 || y >= 2 * m->y_dim ||
+        (x & y & 1) == 0 || m->exit_dist[ROOM_INDEX(m, x, y)] == MAZE_NO_DIST)
+        return -1;
+    return m->exit_dist[ROOM_INDEX(m, x, y)];
+}
+
+/* 
+ * fruit_distance
+ *   DESCRIPTION: Look up the number of steps from a lattice point in the
+ *                current maze to the nearest fruit.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- an (odd,odd) lattice point in the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: the distance in maze squares, or -1 if the point is
+ *                 invalid or no fruit is reachable
+ *   SIDE EFFECTS: none
+ */
+int fruit_distance(const maze_t* m, int x, int y) {
+
+    if (x < 1 || x >= 2 * m->x_dim || y < 1 || y >= 2 * m->y_dim ||
+        (x & y & 1) == 0 || m->fruit_dist[ROOM_INDEX(m, x, y)] == MAZE_NO_DIST)
+        return -1;
+    return m->fruit_dist[ROOM_INDEX(m, x, y)];
+}
+
 /*
  * The functions inside the preprocessor block below rely on block image
  * data in blocks.s.  These external data are neither available nor 
@@ -435,29 +922,30 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
  * find_block
  *   DESCRIPTION: Find the appropriate image to be used for a given maze
  *                lattice point.
- *   INPUTS: (x,y) -- the maze lattice point
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the maze lattice point
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to an image of a BLOCK_X_DIM x BLOCK_Y_DIM
  *                 block of data with one byte per pixel laid out as a
  *                 C array of dimension [BLOCK_Y_DIM][BLOCK_X_DIM]
  *   SIDE EFFECTS: none
  */
-static unsigned char* find_block(int x, int y) {
+static unsigned char* find_block(const maze_t* m, int x, int y) {
     int fnum;     /* fruit found                           */
     int pattern;  /* stencil pattern for surrounding walls */
 
     /* Record whether fruit is present. */
-    fnum = (maze[MAZE_INDEX(x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
+    fnum = (m->maze[MAZE_INDEX(m, x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
 
     /* The exit is always visible once the last fruit is collected. */
-    if (n_fruits == 0 && (maze[MAZE_INDEX(x, y)] & MAZE_EXIT) != 0)
+    if (m->n_fruits == 0 && (m->maze[MAZE_INDEX(m, x, y)] & MAZE_EXIT) != 0)
         return (unsigned char*)blocks[BLOCK_EXIT];
 
     /* 
      * Everything else not reached is shrouded in mist, although fruits
      * show up as bumps.
      */
-    if ((maze[MAZE_INDEX(x, y)] & MAZE_REACH) == 0) {
+    if ((m->maze[MAZE_INDEX(m, x, y)] & MAZE_REACH) == 0) {
         if (fnum != 0)
             return (unsigned char*)blocks[BLOCK_FRUIT_SHADOW];
         return (unsigned char*)blocks[BLOCK_SHADOW];
@@ -468,14 +956,14 @@ static unsigned char* find_block(int x, int y) {
         return (unsigned char*)blocks[BLOCK_FRUIT_1 + fnum - 1];
 
     /* Show empty space. */
-    if ((maze[MAZE_INDEX(x, y)] & MAZE_WALL) == 0)
+    if ((m->maze[MAZE_INDEX(m, x, y)] & MAZE_WALL) == 0)
         return (unsigned char*)blocks[BLOCK_EMPTY];
 
     /* Show different types of walls. */
-    pattern = (((maze[MAZE_INDEX(x, y - 1)] & MAZE_WALL) != 0) << 0) |
-              (((maze[MAZE_INDEX(x + 1, y)] & MAZE_WALL) != 0) << 1) |
-              (((maze[MAZE_INDEX(x, y + 1)] & MAZE_WALL) != 0) << 2) |
-              (((maze[MAZE_INDEX(x - 1, y)] & MAZE_WALL) != 0) << 3);
+    pattern = (((m->maze[MAZE_INDEX(m, x, y - 1)] & MAZE_WALL) != 0) << 0) |
+              (((m->maze[MAZE_INDEX(m, x + 1, y)] & MAZE_WALL) != 0) << 1) |
+              (((m->maze[MAZE_INDEX(m, x, y + 1)] & MAZE_WALL) != 0) << 2) |
+              (((m->maze[MAZE_INDEX(m, x - 1, y)] & MAZE_WALL) != 0) << 3);
     return (unsigned char*)blocks[pattern];
 }
 
@@ -485,12 +973,13 @@ static unsigned char* find_block(int x, int y) {
  *                pixel of a line to be drawn on the screen, this routine 
  *                produces an image of the line.  Each pixel on the line
  *                is represented as a single byte in the image.
- *   INPUTS: (x,y) -- leftmost pixel of line to be drawn 
+ *   INPUTS: m -- the maze
+ *           (x,y) -- leftmost pixel of line to be drawn 
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]) {
+static void fill_horiz(const maze_t* m, int x, int y, unsigned char buf[SCROLL_X_DIM]) {
     int map_x, map_y;     /* maze lattice point of the first block on line */
     int sub_x, sub_y;     /* sub-block address                             */
     int idx;              /* loop index over pixels in the line            */ 
@@ -506,7 +995,7 @@ void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]) {
     for (idx = 0; idx < SCROLL_X_DIM; ) {
 
         /* Find address of block to be drawn. */
-        block = find_block(map_x++, map_y) + sub_y * BLOCK_X_DIM + sub_x;
+        block = find_block(m, map_x++, map_y) + sub_y * BLOCK_X_DIM + sub_x;
 
         /* Write block colors from one line into buffer. */
         for (; idx < SCROLL_X_DIM && sub_x < BLOCK_X_DIM; idx++, sub_x++)
@@ -520,18 +1009,34 @@ void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]) {
     }
 }
 
+/* 
+ * fill_horiz_buffer
+ *   DESCRIPTION: Produce an image of a horizontal line of a maze (see
+ *                fill_horiz); used as a line callback by modex.c.
+ *   INPUTS: maze -- the maze (a maze_t)
+ *           (x,y) -- leftmost pixel of line to be drawn 
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void fill_horiz_buffer(void* maze, int x, int y, unsigned char buf[SCROLL_X_DIM]) {
+    fill_horiz(maze, x, y, buf);
+}
+
 /* 
  * fill_vert_buffer
  *   DESCRIPTION: Given the (x,y) map pixel coordinate of the top pixel of 
  *                a vertical line to be drawn on the screen, this routine 
  *                produces an image of the line.  Each pixel on the line
  *                is represented as a single byte in the image.
- *   INPUTS: (x,y) -- top pixel of line to be drawn 
+ *   INPUTS: maze -- the maze (a maze_t)
+ *           (x,y) -- top pixel of line to be drawn 
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
+void fill_vert_buffer(void* maze, int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
+    const maze_t* m = maze;
     int map_x, map_y;     /* maze lattice point of the first block on line */
     int sub_x, sub_y;     /* sub-block address                             */
     int idx;              /* loop index over pixels in the line            */ 
@@ -547,7 +1052,7 @@ void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
     for (idx = 0; idx < SCROLL_Y_DIM; ) {
 
         /* Find address of block to be drawn. */
-        block = find_block(map_x, map_y++) + sub_y * BLOCK_X_DIM + sub_x;
+        block = find_block(m, map_x, map_y++) + sub_y * BLOCK_X_DIM + sub_x;
 
         /* Write block colors from one line into buffer. */
         for (; idx < SCROLL_Y_DIM && sub_y < BLOCK_Y_DIM; 
@@ -564,17 +1069,125 @@ void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
     return;
 }
 
+/* 
+ * mark_dirty
+ *   DESCRIPTION: Queue a maze lattice point to be redrawn by the next call
+ *                to draw_dirty_blocks.  Each point is queued at most once
+ *                (the MAZE_DIRTY bit records that it is queued).  If the
+ *                queue is full, the whole view window is redrawn instead.
+ *                Nothing is drawn here.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the lattice point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void mark_dirty(maze_t* m, int x, int y) {
+    unsigned char* cur = &m->maze[MAZE_INDEX(m, x, y)];
+    unsigned short key = (y << 8) | x;  /* sorts in row-major order */
+    int i;
+
+    if (m->redraw_all)
+        return;
+
+    /* 
+     * The right boundary shares its maze array entries with the left
+     * boundary one row down, so a set MAZE_DIRTY bit may belong to the
+     * other point; check the queue itself in that case.
+     */
+    if (*cur & MAZE_DIRTY) {
+        for (i = 0; i < m->n_dirty; i++)
+            if (m->dirty[i] == key)
+                return;
+    }
+    if (m->n_dirty == MAZE_MAX_DIRTY) {
+        m->redraw_all = 1;
+        return;
+    }
+    *cur |= MAZE_DIRTY;
+    m->dirty[m->n_dirty++] = key;
+}
+
+/* 
+ * render_full_view
+ *   DESCRIPTION: Draw the whole logical view window of a maze into the
+ *                build buffer, as when a level starts, a snapshot is
+ *                loaded, or the view jumps.  Each lattice point in the
+ *                window is looked up once and its block copied straight
+ *                into the planes; only the blocks on the edges of the
+ *                window are clipped.
+ *   INPUTS: m -- the maze
+ *           scr -- the screen showing the maze, with its view window set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the screen's build buffer
+ */
+void render_full_view(const maze_t* m, screen_t* scr) {
+    int view_x = scr->show_x;   /* upper left pixel of the view window */
+    int view_y = scr->show_y;
+    int x, y;                   /* lattice point being drawn           */
+
+    for (y = view_y / BLOCK_Y_DIM; y * BLOCK_Y_DIM < view_y + SCROLL_Y_DIM; y++)
+        for (x = view_x / BLOCK_X_DIM; x * BLOCK_X_DIM < view_x + SCROLL_X_DIM; x++)
+            draw_full_block(scr, x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(m, x, y));
+}
+
+/* 
+ * draw_dirty_blocks
+ *   DESCRIPTION: Redraw all maze lattice points queued since the last call,
+ *                in row-major order.  Points outside the view window are
+ *                skipped; the line fill functions draw them correctly if
+ *                they later scroll into view.  If the queue overflowed,
+ *                every point in the view window is redrawn.
+ *   INPUTS: m -- the maze
+ *           scr -- the screen showing the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the screen's build buffer; empties the queue
+ */
+void draw_dirty_blocks(maze_t* m, screen_t* scr) {
+    int view_x = scr->show_x;   /* upper left pixel of the view window */
+    int view_y = scr->show_y;
+    unsigned short key;     /* point being sorted or drawn */
+    int x, y, i, j;
+
+    /* Sort the (short) queue by insertion. */
+    for (i = 1; i < m->n_dirty; i++) {
+        key = m->dirty[i];
+        for (j = i; j > 0 && m->dirty[j - 1] > key; j--)
+            m->dirty[j] = m->dirty[j - 1];
+        m->dirty[j] = key;
+    }
+
+    for (i = 0; i < m->n_dirty; i++) {
+        x = (m->dirty[i] & 0xFF);
+        y = (m->dirty[i] >> 8);
+        m->maze[MAZE_INDEX(m, x, y)] &= ~MAZE_DIRTY;
+        if (m->redraw_all ||
+            (x + 1) * BLOCK_X_DIM <= view_x || x * BLOCK_X_DIM >= view_x + SCROLL_X_DIM ||
+            (y + 1) * BLOCK_Y_DIM <= view_y || y * BLOCK_Y_DIM >= view_y + SCROLL_Y_DIM)
+            continue;
+        draw_full_block (scr, x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(m, x, y));
+    }
+
+    if (m->redraw_all)
+        render_full_view(m, scr);
+    m->n_dirty = 0;
+    m->redraw_all = 0;
+}
+
 /* 
  * unveil_space
  *   DESCRIPTION: Unveils a maze lattice point (marks as MAZE_REACH, which
  *                means that it is drawn normally rather than as under mist),
- *                redrawing it if necessary.
- *   INPUTS: (x,y) -- the lattice point to be unveiled
+ *                queueing it to be redrawn if necessary.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the lattice point to be unveiled
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: may draw to the screen
+ *   SIDE EFFECTS: queues the point for draw_dirty_blocks
  */
-void unveil_space(int x, int y) {
+void unveil_space(maze_t* m, int x, int y) {
     unsigned char* cur; /* pointer to the maze lattice point */
     
     /* 
@@ -592,17 +1205,17 @@ void unveil_space(int x, int y) {
      * Allow exposure of bottom and right boundaries (left and right 
      * boundaries are the same lattice point in the maze).
      */
-    if (x < 0 || x > 2 * maze_x_dim || y < 0 || y > 2 * maze_y_dim)
+    if (x < 0 || x > 2 * m->x_dim || y < 0 || y > 2 * m->y_dim)
         return;
 
     /* Has the location already been seen?  If so, do nothing. */
-    cur = &maze[MAZE_INDEX(x, y)];
+    cur = &m->maze[MAZE_INDEX(m, x, y)];
     if (*cur & MAZE_REACH)
         return;
 
-    /* Unveil the location and redraw it. */
+    /* Unveil the location and queue it to be redrawn. */
     *cur |= MAZE_REACH;
-    draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+    mark_dirty(m, x, y);
 }
 
 /* 
@@ -610,36 +1223,38 @@ void unveil_space(int x, int y) {
  *   DESCRIPTION: Checks a maze lattice point for fruit, eats the fruit if
  *                one is present (i.e., removes it from the maze), and updates
  *                the number of fruits (including displayed number).
- *   INPUTS: (x,y) -- the lattice point to be checked for fruit
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the lattice point to be checked for fruit
  *   OUTPUTS: none
  *   RETURN VALUE: fruit number found (1 to NUM_FRUITS), or 0 for no fruit
- *   SIDE EFFECTS: may draw to the screen (empty fruit and, once last fruit
- *                 is eaten, the maze exit)
+ *   SIDE EFFECTS: may queue points to be redrawn (empty fruit and, once
+ *                 last fruit is eaten, the maze exit)
  */
-int check_for_fruit(int x, int y) {
+int check_for_fruit(maze_t* m, int x, int y) {
     int fnum;  /* fruit number found */
     
     /* If outside the feasible fruit range, return no fruit. */
-    if (x < 0 || x >= 2 * maze_x_dim || y < 0 || y >= 2 * maze_y_dim)
+    if (x < 0 || x >= 2 * m->x_dim || y < 0 || y >= 2 * m->y_dim)
         return 0;
 
     /* Calculate the fruit number. */
-    fnum = (maze[MAZE_INDEX(x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
+    fnum = (m->maze[MAZE_INDEX(m, x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
 
     /* If fruit was present... */
     if (fnum != 0) {
         /* ...remove it. */
-        maze[MAZE_INDEX(x, y)] &= ~MAZE_FRUIT;
+        m->maze[MAZE_INDEX(m, x, y)] &= ~MAZE_FRUIT;
 
-        /* Update the count of fruits. */
-        --n_fruits;
+        /* Update the count of fruits and the distances to them. */
+        --m->n_fruits;
+        fruit_dist_remove(m, ROOM_INDEX(m, x, y));
 
         /* The exit may appear. */
-        if (n_fruits == 0)
-            draw_full_block (exit_x * BLOCK_X_DIM, exit_y * BLOCK_Y_DIM, find_block(exit_x, exit_y));
+        if (m->n_fruits == 0)
+            mark_dirty(m, m->exit_x, m->exit_y);
 
         /* Redraw the space with no fruit. */
-        draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+        mark_dirty(m, x, y);
     }
 
     /* Return the fruit number found. */
@@ -651,18 +1266,19 @@ int check_for_fruit(int x, int y) {
  *   DESCRIPTION: Checks whether the play has won the maze by reaching a 
  *                given maze lattice point.  Winning occurs when no fruits
  *                remain in the maze, and the player reaches the maze exit.
- *   INPUTS: (x,y) -- the lattice point at which the player has arrived
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the lattice point at which the player has arrived
  *   OUTPUTS: none
  *   RETURN VALUE: 1 if player has won, 0 if not
  *   SIDE EFFECTS: none
  */
-int check_for_win(int x, int y) {
+int check_for_win(const maze_t* m, int x, int y) {
     /* Check that position falls within valid boundaries for exit. */
-    if (x < 0 || x >= 2 * maze_x_dim || y < 0 || y >= 2 * maze_y_dim)
+    if (x < 0 || x >= 2 * m->x_dim || y < 0 || y >= 2 * m->y_dim)
         return 0;
     
     /* Return win condition. */
-    return (n_fruits == 0 && (maze[MAZE_INDEX(x, y)] & MAZE_EXIT) != 0);
+    return (m->n_fruits == 0 && (m->maze[MAZE_INDEX(m, x, y)] & MAZE_EXIT) != 0);
 }
 
 /* 
@@ -670,32 +1286,22 @@ int check_for_win(int x, int y) {
  *   DESCRIPTION: Add a fruit to a random (odd,odd) lattice point in the
  *                maze.  Update the number of fruits, including the displayed
  *                value.  If requested, draw the new fruit on the screen.
- *   INPUTS: show -- 1 if new fruit should be drawn, 0 if not
+ *   INPUTS: m -- the maze
+ *           show -- 1 if new fruit should be drawn, 0 if not
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: changes displayed fruit value, may draw to screen
  */
-static void _add_a_fruit(int show) {
+static void _add_a_fruit(maze_t* m, int show) {
     int x, y;    /* lattice point for new fruit */
 
-    /*
-     * Pick an unfruited lattice point at random.  Could fall on the 
-     * maze exit, if that is already defined.
-     */
-    do {
-        x = (random() % maze_x_dim) * 2 + 1;
-        y = (random() % maze_y_dim) * 2 + 1;
-    } while ((maze[MAZE_INDEX(x, y)] & MAZE_FRUIT));
-
-    /* Add a random fruit to that location. */
-    maze[MAZE_INDEX(x, y)] |= ((random() % NUM_FRUIT_TYPES) + 1) * MAZE_FRUIT_1;
-
-    /* Update the number of fruits. */
-    ++n_fruits;
+    /* Pick the location and the fruit. */
+    place_fruit(m, &x, &y);
+    fruit_dist_add(m, ROOM_INDEX(m, x, y));
 
     /* If necessary, draw the fruit on the screen. */
     if (show)
-    draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+        mark_dirty(m, x, y);
 }
 
 /* 
@@ -704,22 +1310,21 @@ static void _add_a_fruit(int show) {
  *                maze.  Update the number of fruits, including the displayed
  *                value.  Draw the new fruit on the screen.  If the new fruit
  *                is the only one in the maze, erase the maze exit.
- *   INPUTS: none
+ *   INPUTS: m -- the maze
  *   OUTPUTS: none
  *   RETURN VALUE: the number of fruits in the maze (after addition)
  *   SIDE EFFECTS: changes displayed fruit value, may draw to screen
  */
-int add_a_fruit() {
+int add_a_fruit(maze_t* m) {
     /* Most of the work is done by a helper function. */
-    _add_a_fruit(1);
+    _add_a_fruit(m, 1);
 
     /* The exit may disappear. */
-    if (n_fruits == 1)
-    draw_full_block (exit_x * BLOCK_X_DIM, exit_y * BLOCK_Y_DIM, 
-             find_block(exit_x, exit_y));
+    if (m->n_fruits == 1)
+        mark_dirty(m, m->exit_x, m->exit_y);
 
     /* Return the current number of fruits in the maze. */
-    return n_fruits;
+    return m->n_fruits;
 }
 
 
@@ -727,7 +1332,8 @@ int add_a_fruit() {
  * turnToString
  *   DESCRIPTION: turns the level number, the minute, and the second and puts them all into a string to be
  *                  put on the status bar
- *   INPUTS: level - the level number the player is at
+ *   INPUTS: m -- the maze
+ *           level - the level number the player is at
  *           min - minutes passed since the game has passed
  *           sec - seconds passed since the game has passed
  *           str - the array of char that is the string that the function puts everything together
@@ -735,61 +1341,43 @@ int add_a_fruit() {
  *   RETURN VALUE: 
  *   SIDE EFFECTS: changes str to the string to be put on the status bar
  */
-extern void turnToString(int level, int min, int sec, char * str) {
+extern void turnToString(const maze_t* m, int level, int min, int sec, char * str) {
     // check if the number of fruits in the game is 1 so that it says "Fruit" instead of "Fruits"
-    if(n_fruits == 1) {
+    if(m->n_fruits == 1) {
         if(sec < 10) {
             if(min < 10) {
-                snprintf(str, 41, "     Level:  %d    %d Fruit    0%d:0%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level:  %d    %d Fruit    0%d:0%d      ", level, m->n_fruits , min, sec);
             } else {
-                snprintf(str, 41, "     Level:  %d    %d Fruit    %d:0%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level:  %d    %d Fruit    %d:0%d      ", level, m->n_fruits , min, sec);
             }
         } else {
             if(min < 10) {
-                snprintf(str, 41, "     Level:  %d    %d Fruit    0%d:%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level:  %d    %d Fruit    0%d:%d      ", level, m->n_fruits , min, sec);
             } else {
-                snprintf(str, 41, "     Level:  %d    %d Fruit    %d:%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level:  %d    %d Fruit    %d:%d      ", level, m->n_fruits , min, sec);
             }
         }
     } 
     else {
         if(sec < 10) {
             if(min < 10) {
-                snprintf(str, 41, "     Level: %2d   %2d Fruits   0%d:0%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level: %2d   %2d Fruits   0%d:0%d      ", level, m->n_fruits , min, sec);
             } else {
-                snprintf(str, 41, "     Level: %2d   %2d Fruits   %d:0%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level: %2d   %2d Fruits   %d:0%d      ", level, m->n_fruits , min, sec);
             }
         } else {
             if(min < 10) {
-                snprintf(str, 41, "     Level: %2d   %2d Fruits   0%d:%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level: %2d   %2d Fruits   0%d:%d      ", level, m->n_fruits , min, sec);
             } else {
-                snprintf(str, 41, "     Level: %2d   %2d Fruits   %d:%d      ", level, n_fruits , min, sec);
+                snprintf(str, 41, "     Level: %2d   %2d Fruits   %d:%d      ", level, m->n_fruits , min, sec);
             }
         }
     }
 
 }
 
-extern int return_n_fruits() {
-    return n_fruits;
-}
-
-/* 
- * add_a_fruit_internal
- *   DESCRIPTION: Add a fruit to a random (odd,odd) lattice point in the
- *                maze.  Update the number of fruits, including the displayed
- *                value.
- *   INPUTS: none
- *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: changes displayed fruit value
- */
-static void add_a_fruit_internal() {
-    /* 
-     * Call a helper function, indicating that fruit should not be drawn 
-     * on the screen at this point.
-     */
-    _add_a_fruit(0);
+extern int return_n_fruits(const maze_t* m) {
+    return m->n_fruits;
 }
 
 /* 
@@ -828,19 +1416,111 @@ unsigned char* get_player_mask(dir_t cur_dir) {
  * find_open_directions
  *   DESCRIPTION: Determine which directions are open to movement from a 
  *              given maze point.
- *   INPUTS: (x,y) -- lattice point of interest in maze
+ *   INPUTS: m -- the maze
+ *           (x,y) -- lattice point of interest in maze
  *   OUTPUTS: open[] -- array of boolean values indicating that a direction
  *                   is open; indexed by DIR_* enumeration values 
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-void find_open_directions(int x, int y, int op[NUM_DIRS]) {
-    op[DIR_UP]    = (0 == (maze[MAZE_INDEX(x, y - 1)] & MAZE_WALL));
-    op[DIR_RIGHT] = (0 == (maze[MAZE_INDEX(x + 1, y)] & MAZE_WALL));
-    op[DIR_DOWN]  = (0 == (maze[MAZE_INDEX(x, y + 1)] & MAZE_WALL));
-    op[DIR_LEFT]  = (0 == (maze[MAZE_INDEX(x - 1, y)] & MAZE_WALL));
+void find_open_directions(const maze_t* m, int x, int y, int op[NUM_DIRS]) {
+    op[DIR_UP]    = (0 == (m->maze[MAZE_INDEX(m, x, y - 1)] & MAZE_WALL));
+    op[DIR_RIGHT] = (0 == (m->maze[MAZE_INDEX(m, x + 1, y)] & MAZE_WALL));
+    op[DIR_DOWN]  = (0 == (m->maze[MAZE_INDEX(m, x, y + 1)] & MAZE_WALL));
+    op[DIR_LEFT]  = (0 == (m->maze[MAZE_INDEX(m, x - 1, y)] & MAZE_WALL));
+}
+
+#if defined(DIST_FIELD_BENCH)
+/* 
+ * The code here measures the cost of the incremental fruit distance
+ * field updates against recomputing the whole field after each change,
+ * and checks that both give the same distances.  Build with
+ * "make distbench".
+ */
+
+/* 
+ * bench_change_fruit
+ *   DESCRIPTION: Remove a random fruit from a maze and place a new one,
+ *                updating the fruit distance field either incrementally
+ *                or by recomputing it.
+ *   INPUTS: m -- the maze
+ *           full -- 1 to recompute the field, 0 to update incrementally
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the maze's fruits and generator state
+ */
+static void bench_change_fruit(maze_t* m, int full) {
+    int n_rooms = m->x_dim * m->y_dim;
+    int room, x, y;
+
+    room = rng_below(m, n_rooms);
+    while (!(m->maze[MAZE_INDEX(m, ROOM_X(m, room), ROOM_Y(m, room))] & MAZE_FRUIT))
+        room = (room + 1) % n_rooms;
+    m->maze[MAZE_INDEX(m, ROOM_X(m, room), ROOM_Y(m, room))] &= ~MAZE_FRUIT;
+    --m->n_fruits;
+    if (!full)
+        fruit_dist_remove(m, room);
+    place_fruit(m, &x, &y);
+    if (full)
+        compute_fruit_dist(m);
+    else
+        fruit_dist_add(m, ROOM_INDEX(m, x, y));
+}
+
+/* 
+ * bench_time
+ *   DESCRIPTION: Time a number of fruit changes on a maze.
+ *   INPUTS: m -- the maze
+ *           full -- passed to bench_change_fruit
+ *           iters -- number of changes
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds per change
+ *   SIDE EFFECTS: changes the maze
+ */
+static double bench_time(maze_t* m, int full, int iters) {
+    struct timespec t0, t1;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < iters; i++)
+        bench_change_fruit(m, full);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / iters;
 }
 
+/* 
+ * main
+ *   DESCRIPTION: main program for the distance field benchmark; builds
+ *                two copies of the largest maze and applies the same
+ *                sequence of fruit changes to both
+ *   INPUTS: none (command line arguments are ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 1 if the two fields disagree
+ */
+int main() {
+    static maze_t inc, full;
+    static const int fruit_counts[] = {1, 6, 30};
+    int iters = 20000;
+    int k, i, bad;
+    double t_inc, t_full;
+
+    for (k = 0; k < sizeof (fruit_counts) / sizeof (fruit_counts[0]); k++) {
+        generate_maze(&inc, MAZE_MAX_X_DIM, MAZE_MAX_Y_DIM, fruit_counts[k], 1);
+        full = inc;
+        t_inc = bench_time(&inc, 0, iters);
+        t_full = bench_time(&full, 1, iters);
+        bad = 0;
+        for (i = 0; i < inc.x_dim * inc.y_dim; i++)
+            bad += (inc.fruit_dist[i] != full.fruit_dist[i]);
+        printf("%2d fruits: incremental %8.0f ns, recompute %8.0f ns per change%s\n",
+               fruit_counts[k], t_inc, t_full, bad ? "  MISMATCH" : "");
+        if (bad)
+            return 1;
+    }
+    return 0;
+}
+#endif /* DIST_FIELD_BENCH */
+
 #else /* TEST_MAZE_GEN == 1 */
 /* 
  * The code here allows you to test the maze generation routines visually 
@@ -850,29 +1530,29 @@ void find_open_directions(int x, int y, int op[NUM_DIRS]) {
 /* 
  * print_maze
  *   DESCRIPTION: Print a maze as ASCII text.
- *   INPUTS: none
+ *   INPUTS: m -- the maze
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: prints to stdout
  */
-void print_maze() {
+void print_maze(const maze_t* m) {
     int i;  /* vertical loop index   */
     int j;  /* horizontal loop index */
 
     /* Loop over maze rows. */
-    for (i = 0; i <= 2 * maze_y_dim; i++) {
+    for (i = 0; i <= 2 * m->y_dim; i++) {
 
         /* Loop over maze columns. */
-        for (j = 0; j <= 2 * maze_x_dim; j++) {
+        for (j = 0; j <= 2 * m->x_dim; j++) {
 
             /* 
              * Print open spaces and walls, reached and unreached, as
              * distinct characters.
              */
             printf("%c", 
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_WALL) ? 
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_REACH) ? '*' : '%') :
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_REACH) ? '.' : ' ')));
+                  ((m->maze[MAZE_INDEX(m, j, i)] & MAZE_WALL) ? 
+                  ((m->maze[MAZE_INDEX(m, j, i)] & MAZE_REACH) ? '*' : '%') :
+                  ((m->maze[MAZE_INDEX(m, j, i)] & MAZE_REACH) ? '.' : ' ')));
         }
 
         /* End the printed line. */
@@ -880,12 +1560,6 @@ void print_maze() {
     }
 }
 
-/* 
- * This function is called in maze generation. We define a stub to keep
- * the linker happy.
- */
-static void add_a_fruit_internal() {}
-
 /* 
  * main
  *   DESCRIPTION: main program for testing maze generation; hardwired to
@@ -895,8 +1569,11 @@ static void add_a_fruit_internal() {}
  *   RETURN VALUE: 0 on success (always!)
  */
 int main() {
-    make_maze(20, 20, 0);
-    print_maze();
+    static maze_t maze;
+
+    make_maze(&maze, 20, 20, 0);
+    print_maze(&maze);
+    printf("seed %lu\n", get_maze_seed(&maze));
     return 0;
 }
 
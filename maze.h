@@ -37,6 +37,8 @@
 #ifndef MAZE_H
 #define MAZE_H
 
+#include <stdint.h>
+
 #include "blocks.h"
 #include "modex.h"
 
@@ -63,32 +65,88 @@ typedef enum {
     LAST_MAZE_FRUIT_BIT = MAZE_FRUIT_3,
     MAZE_FRUIT          = (MAZE_FRUIT_1 | MAZE_FRUIT_2 | MAZE_FRUIT_3),
     MAZE_EXIT           = 16,   /* exit from maze                           */
+    MAZE_DIRTY          = 32,   /* must be redrawn (see draw_dirty_blocks)  */
     MAZE_REACH          = 128   /* seen already (not shrouded in mist)      */
 } maze_bit_t;
 
-/* create a maze and place some fruits inside it */
-extern int make_maze(int x_dim, int y_dim, int start_fruits);
+/* number of (odd,odd) lattice points ("rooms") in the largest maze */
+#define MAZE_MAX_ROOMS (MAZE_MAX_X_DIM * MAZE_MAX_Y_DIM)
 
-/* fill a buffer with the pixels for a horizontal line of the maze */
-extern void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]);
+/* 
+ * maximum number of lattice points awaiting redraw; if more are marked,
+ * the whole view window is redrawn instead
+ */
+#define MAZE_MAX_DIRTY 64
 
-/* fill a buffer with the pixels for a vertical line of the maze */
-extern void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]);
+/* distance field value for rooms that cannot reach any source */
+#define MAZE_NO_DIST   0xFFFF
 
-/* mark a maze location as reached and draw it onto the screen if necessary */
-extern void unveil_space(int x, int y);
+/* 
+ * state of a single maze, passed explicitly to all of the functions
+ * below, so that any number of mazes can be in use at once; the layout
+ * of the maze array is described in maze.c (see make_maze and MAZE_INDEX)
+ *
+ * The distance fields hold, for each room (indexed by row, then column,
+ * of the (odd,odd) lattice points), the number of room-to-room steps to
+ * the exit and to the nearest fruit.  The exit field is computed once per
+ * maze; the fruit field (and the room holding each room's nearest fruit)
+ * is updated as fruits are eaten and added.
+ */
+typedef struct {
+    unsigned char maze[2 * MAZE_MAX_X_DIM * (2 * MAZE_MAX_Y_DIM + 3) + 1];
+    int x_dim, y_dim;       /* dimensions of maze               */
+    int n_fruits;           /* number of fruits in maze         */
+    int exit_x, exit_y;     /* lattice point of maze exit       */
+    uint32_t rng[4];        /* random number generator state    */
+    unsigned long seed;     /* seed from which maze was built   */
+    unsigned short exit_dist[MAZE_MAX_ROOMS];   /* steps to exit       */
+    unsigned short fruit_dist[MAZE_MAX_ROOMS];  /* steps to a fruit    */
+    unsigned short fruit_src[MAZE_MAX_ROOMS];   /* room of that fruit  */
+    unsigned short dirty[MAZE_MAX_DIRTY];   /* points to redraw, y:x   */
+    int n_dirty;                            /* number of such points   */
+    int redraw_all;         /* 1 if too many points were marked */
+} maze_t;
+
+/* create a maze in m from a given seed; safe to call from any thread */
+extern int generate_maze(maze_t* m, int x_dim, int y_dim, int start_fruits,
+                         unsigned long seed);
+
+/* rebuild derived state of a maze loaded from a snapshot */
+extern int restore_maze(maze_t* m);
+
+/* get the seed used to generate a maze */
+extern unsigned long get_maze_seed(const maze_t* m);
+
+/* create a maze seeded from the clock and place some fruits inside it */
+extern int make_maze(maze_t* m, int x_dim, int y_dim, int start_fruits);
+
+/* 
+ * fill a buffer with the pixels for a horizontal or vertical line of a
+ * maze; the first argument is the maze_t (see set_mode_X)
+ */
+extern void fill_horiz_buffer(void* maze, int x, int y, unsigned char buf[SCROLL_X_DIM]);
+extern void fill_vert_buffer(void* maze, int x, int y, unsigned char buf[SCROLL_Y_DIM]);
+
+/* mark a maze location as reached and queue it for redrawing */
+extern void unveil_space(maze_t* m, int x, int y);
+
+/* draw the whole view window of a maze into the screen's build buffer */
+extern void render_full_view(const maze_t* m, screen_t* scr);
+
+/* redraw queued maze locations that fall within the screen's view window */
+extern void draw_dirty_blocks(maze_t* m, screen_t* scr);
 
 /* consume fruit at a space, if any; returns the fruit number consumed */
-extern int check_for_fruit(int x, int y);
+extern int check_for_fruit(maze_t* m, int x, int y);
 
 /* check whether the player has reached the exit with no fruits left */
-extern int check_for_win(int x, int y);
+extern int check_for_win(const maze_t* m, int x, int y);
 
 /* add a new fruit randomly in the maze */
-extern int add_a_fruit();
+extern int add_a_fruit(maze_t* m);
 
 /* change the level number, minutes passed, seconds passed, and the number of fruits left in the game into a string */
-extern void turnToString(int level, int min, int sec, char * str);
+extern void turnToString(const maze_t* m, int level, int min, int sec, char * str);
 
 /* get pointer to the player's block image; depends on direction of motion */
 extern unsigned char* get_player_block(dir_t cur_dir);
@@ -97,8 +155,15 @@ extern unsigned char* get_player_block(dir_t cur_dir);
 extern unsigned char* get_player_mask(dir_t cur_dir);
 
 /* determine which directions are open to movement from a given maze point */
-extern void find_open_directions(int x, int y, int op[NUM_DIRS]);
+extern void find_open_directions(const maze_t* m, int x, int y, int op[NUM_DIRS]);
 
-extern int return_n_fruits();
+extern int return_n_fruits(const maze_t* m);
+
+/* 
+ * steps from lattice point (x,y) to the exit or to the nearest fruit;
+ * -1 if no such path exists or (x,y) is not an (odd,odd) point
+ */
+extern int exit_distance(const maze_t* m, int x, int y);
+extern int fruit_distance(const maze_t* m, int x, int y);
 
 #endif /* MAZE_H */
@@ -38,13 +38,18 @@
 #include <string.h>
 
 #include "blocks.h"
+#include "evring.h"
 #include "maze.h"
 #include "modex.h"
+#include "prof.h"
+#include "sim.h"
+#include "snapshot.h"
 #include "text.h"
+#include "tick.h"
+#include "timer.h"
 #include "module/tuxctl-ioctl.h"
 
 // New Includes and Defines
-#include <linux/rtc.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -52,6 +57,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/io.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <termios.h>
 #include <pthread.h>
 
@@ -73,8 +80,6 @@ static int sanity_check();
 
 
 /* a few constants */
-#define PAN_BORDER      5  /* pan when border in maze squares reaches 5    */
-#define MAX_LEVEL       10 /* maximum level number                         */
 #define text_length     15      /*set length of the text*/
 #define FONT_HEIGHT     16                                          /*height of the font*/        
 #define FONT_WIDTH      8       /*width of the font*/ 
@@ -82,6 +87,7 @@ static int sanity_check();
 #define floating_text_x (float_length/2)      /**/
 #define floating_text_y 20      /*have the text be 20 pixels above the */
 #define text_timer_length   60          /*set number for how long we want the text to be floating abov wehn the fruit is picked*/
+#define COLOR_STEPS     11      /* simulation steps between player colors   */
 /* outcome of each level, and of the game as a whole */
 typedef enum {GAME_WON, GAME_LOST, GAME_QUIT} game_condition_t;
 
@@ -91,212 +97,505 @@ typedef struct {
     int number;                  /* starts at 1...                   */
     int maze_x_dim, maze_y_dim;  /* min to max, in steps of 2        */
     int initial_fruit_count;     /* 1 to 6, in steps of 1/2          */
-    int time_to_first_fruit;     /* 300 to 120, in steps of -30      */
-    int time_between_fruits;     /* 300 to 60, in steps of -30       */
+    int time_to_first_fruit;     /* 300 to 120 s, in steps of -30    */
+    int time_between_fruits;     /* 300 to 60 s, in steps of -60     */
     int tick_usec;         /* 20000 to 5000, in steps of -1750 */
     /* dynamic values within a level -- you may want to add more... */
     unsigned int map_x, map_y;   /* current upper left display pixel */
 } game_info_t;
 
-static game_info_t game_info;
+/* 
+ * The maze for the next level is built by level_thread while the current
+ * level is being played.  Levels alternate between the two mazes.  The
+ * next_level structure belongs to level_thread from start_level_prep
+ * until the thread is joined in prepare_maze_level.
+ */
+typedef struct {
+    int level;                  /* level number (starts at 1)           */
+    unsigned long seed;         /* seed for the level's maze            */
+    int status;                 /* 0 on success, -1 on failure          */
+    game_info_t info;           /* parameters for the level             */
+    maze_t* maze;               /* maze for the level                   */
+} level_prep_t;
+
+/* 
+ * Everything about one game being played: its levels, its player, and
+ * the screen it is drawn to.  The game functions below work only on the
+ * game passed to them, and the maze code works only on the maze passed
+ * to it, so nothing about a game is hidden in globals.  The VGA
+ * registers and video memory behind the screen are still shared, as
+ * there is only one display.
+ */
+typedef struct {
+    game_info_t info;           /* parameters of the current level      */
+    sim_state_t sim;            /* player state within the level        */
+    maze_t mazes[2];            /* mazes of odd and even levels         */
+    level_prep_t next_level;    /* level being built by level_thread    */
+    pthread_t prep_tid;         /* the level_thread, if prep_running    */
+    int prep_running;           /* 1 while a level is being built       */
+
+    /* 
+     * seed from which each level's maze seed is derived; level n uses
+     * base_seed + n - 1, so a whole game can be replayed from one value
+     */
+    unsigned long base_seed;
+
+    screen_t screen;            /* build buffer and logical view        */
+    tick_src_t tick;            /* wakes the game loop once per frame   */
+    tick_accum_t steps;         /* sim steps owed at info.tick_usec     */
+    int frame_usec;             /* shortest frame (display refresh)     */
+    int next_dir;               /* direction requested by the player    */
+
+    /* 
+     * timed events of the level being played, run on simulation steps
+     * (timer.h); the callbacks only change the game, and the frame loop
+     * draws what they marked as changed
+     */
+    timer_wheel_t timers;
+    game_timer_t fruit_timer;   /* adds a fruit to the maze             */
+    game_timer_t text_timer;    /* hides the fruit text                 */
+    game_timer_t color_timer;   /* cycles the player's color            */
+    game_timer_t clock_timer;   /* counts seconds played                */
+    int elapsed;                /* seconds played in the level          */
+    int color_frames;           /* steps counted for player color       */
+    int text_fruit;             /* fruit named by the text, or 0        */
+    int recolor;                /* 1 if the player color changed        */
+    int status_changed;         /* 1 if the status bar must be redrawn  */
+
+    /* input events, drained by the game loop once per tick (evring.h) */
+    evring_t kbd_ring;          /* keystrokes, from input_thread        */
+    evring_t tux_ring;          /* buttons, from input_thread           */
+    int stop_fd;                /* eventfd that stops input_thread      */
+} game_t;
+
+static game_t game;
+
+#define REFRESH_HZ          70  /* default display refresh (mode X)    */
+#define MAX_STEPS           8   /* default cap on sim steps per frame  */
+
+#define INPUT_BUF_SIZE      64  /* keystrokes read from stdin at once  */
+#define INPUT_MAX_EVENTS    4   /* epoll events taken at once          */
+#define INPUT_MAX_TUX       8   /* button events read at once          */
 
-int fnum;
+/* 
+ * Pressing 's' saves a snapshot of the game to SNAP_FILE at the end of
+ * the current frame.  A game started with "-l <file>" resumes from a
+ * snapshot instead of building level 1.
+ */
+#define SNAP_FILE       "mazegame.snap"
+static int save_flag = 0;
+static const char* load_path = NULL;
+static snap_game_t loaded;
 
 /* local functions--see function headers for details */
-static int prepare_maze_level(int level);
-static void move_up(int* ypos);
-static void move_right(int* xpos);
-static void move_down(int* ypos);
-static void move_left(int* xpos);
-static int unveil_around_player(int play_x, int play_y);
-static void * tux_thread(void * arg);
+static void set_level_info(game_info_t* info, int level);
+static void* level_thread(void* arg);
+static int start_level_prep(game_t* g, int level);
+static int finish_level_prep(game_t* g);
+static int prepare_maze_level(game_t* g, int level);
+static int resume_maze_level(game_t* g, const snap_game_t* snap);
+static void show_view_events(game_t* g, int events);
+static void drain_input(game_t* g);
+static void parse_keys(game_t* g, int* state, const unsigned char* buf, int n);
+static void read_tux(game_t* g, int* prev_but);
+static void *input_thread(void *arg);
 static void *rtc_thread(void *arg);
-static void *keyboard_thread(void *arg);
-int tux_time(int min, int sec);
+static unsigned long secs_to_steps(const game_t* g, int sec);
+static void fruit_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg);
+static void text_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg);
+static void color_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg);
+static void clock_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg);
+static void show_fruit_text(game_t* g, int fruit, int steps);
+static void start_level_timers(game_t* g, const snap_game_t* snap);
+static void save_game(game_t* g);
 
 static char* fruit_strings[7] = {"   an apple!   ", "  eww, grapes  ", "  eh, a peach  ", 
 		" a strawberry  ", "   A BANANA!   ", "  melonwater   ", "   Uh...Dew?   "};
 /* 
- * prepare_maze_level
- *   DESCRIPTION: Prepare for a maze of a given level.  Fills the game_info
- *          structure, creates a maze, and initializes the display.
+ * set_level_info
+ *   DESCRIPTION: Fill in the parameters of a game_info structure for a
+ *                given level.
  *   INPUTS: level -- level to be used for selecting parameter values
- *   OUTPUTS: none
- *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: writes entire game_info structure; changes maze;
- *                 initializes display
+ *   OUTPUTS: *info -- the level parameters and initial dynamic values
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
  */
-static int prepare_maze_level(int level) {
-    int i; /* loop index for drawing display */
-    
+static void set_level_info(game_info_t* info, int level) {
     /*
      * Record level in game_info; other calculations use offset from
      * level 1.
      */
-    game_info.number = level--;
+    info->number = level--;
 
     /* Set per-level parameter values. */
-    if ((game_info.maze_x_dim = MAZE_MIN_X_DIM + 2 * level) > MAZE_MAX_X_DIM)
-        game_info.maze_x_dim = MAZE_MAX_X_DIM;
-    if ((game_info.maze_y_dim = MAZE_MIN_Y_DIM + 2 * level) > MAZE_MAX_Y_DIM)
-        game_info.maze_y_dim = MAZE_MAX_Y_DIM;
-    if ((game_info.initial_fruit_count = 1 + level / 2) > 6)
-        game_info.initial_fruit_count = 6;
-    if ((game_info.time_to_first_fruit = 300 - 30 * level) < 120)
-        game_info.time_to_first_fruit = 120;
-    if ((game_info.time_between_fruits = 300 - 60 * level) < 60)
-        game_info.time_between_fruits = 60;
-    if ((game_info.tick_usec = 20000 - 1750 * level) < 5000)
-        game_info.tick_usec = 5000;
+    if ((info->maze_x_dim = MAZE_MIN_X_DIM + 2 * level) > MAZE_MAX_X_DIM)
+        info->maze_x_dim = MAZE_MAX_X_DIM;
+    if ((info->maze_y_dim = MAZE_MIN_Y_DIM + 2 * level) > MAZE_MAX_Y_DIM)
+        info->maze_y_dim = MAZE_MAX_Y_DIM;
+    if ((info->initial_fruit_count = 1 + level / 2) > 6)
+        info->initial_fruit_count = 6;
+    if ((info->time_to_first_fruit = 300 - 30 * level) < MIN_FIRST_FRUIT)
+        info->time_to_first_fruit = MIN_FIRST_FRUIT;
+    if ((info->time_between_fruits = 300 - 60 * level) < MIN_BETWEEN_FRUITS)
+        info->time_between_fruits = MIN_BETWEEN_FRUITS;
+    if ((info->tick_usec = 20000 - 1750 * level) < MIN_TICK_USEC)
+        info->tick_usec = MIN_TICK_USEC;
 
     /* Initialize dynamic values. */
-    game_info.map_x = game_info.map_y = SHOW_MIN;
+    info->map_x = info->map_y = SHOW_MIN;
+}
+
+/* 
+ * level_thread
+ *   DESCRIPTION: Thread that prepares a level ahead of time: fills in
+ *                its game_info and creates its maze in the level_prep_t.
+ *                It uses nothing but the level_prep_t, so it never
+ *                touches the level being played.
+ *   INPUTS: arg -- pointer to the level_prep_t to be filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: writes the level_prep_t and its maze
+ */
+static void* level_thread(void* arg) {
+    level_prep_t* prep = arg;
+    game_info_t* info = &prep->info;
+
+    set_level_info(info, prep->level);
+    prep->status = generate_maze(prep->maze, info->maze_x_dim, info->maze_y_dim,
+                                 info->initial_fruit_count, prep->seed);
+    return NULL;
+}
 
-    /* Create a maze. */
-    if (make_maze(game_info.maze_x_dim, game_info.maze_y_dim, game_info.initial_fruit_count) != 0)
+/* 
+ * start_level_prep
+ *   DESCRIPTION: Start building a level in the background.  The level
+ *                uses whichever of the two mazes is not used by the
+ *                level before it.
+ *   INPUTS: g -- the game
+ *           level -- the level to be built
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the thread cannot be created
+ *   SIDE EFFECTS: starts level_thread on g->next_level
+ */
+static int start_level_prep(game_t* g, int level) {
+    g->next_level.level = level;
+    g->next_level.seed = g->base_seed + level - 1;
+    g->next_level.maze = &g->mazes[level & 1];
+    if (pthread_create(&g->prep_tid, NULL, level_thread, &g->next_level) != 0)
         return -1;
-    
+    g->prep_running = 1;
+    return 0;
+}
+
+/* 
+ * finish_level_prep
+ *   DESCRIPTION: Wait for the game's level_thread, if it is running.
+ *   INPUTS: g -- the game
+ *   OUTPUTS: none
+ *   RETURN VALUE: status of the prepared level (0 on success, -1 on
+ *                 failure or if no level was being prepared)
+ *   SIDE EFFECTS: joins level_thread
+ */
+static int finish_level_prep(game_t* g) {
+    if (!g->prep_running)
+        return -1;
+    pthread_join(g->prep_tid, NULL);
+    g->prep_running = 0;
+    return g->next_level.status;
+}
+
+/* 
+ * prepare_maze_level
+ *   DESCRIPTION: Switch to a maze of a given level, which must be the one
+ *          being prepared by level_thread.  Fills the game_info
+ *          structure, makes the level's maze current, and draws the
+ *          initial screen.  Then starts preparing the
+ *          level after it.
+ *   INPUTS: g -- the game
+ *           level -- level to be used for selecting parameter values
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: writes entire game_info structure; changes maze;
+ *                 initializes display
+ */
+static int prepare_maze_level(game_t* g, int level) {
+    /* Wait for the level to be built (normally, it already is). */
+    if (finish_level_prep(g) != 0 || g->next_level.level != level)
+        return -1;
+
+    /* Switch to the new level. */
+    g->info = g->next_level.info;
+    g->sim.maze = g->next_level.maze;
+    set_screen_fill_arg(&g->screen, g->next_level.maze);
+
     /* Set logical view and draw initial screen. */
-    set_view_window(game_info.map_x, game_info.map_y);
-    for (i = 0; i < SCROLL_Y_DIM; i++)
-        (void)draw_horiz_line (i);
+    set_view_window(&g->screen, g->info.map_x, g->info.map_y);
+    render_full_view(g->sim.maze, &g->screen);
+
+    /* Build the next level while this one is played. */
+    if (level < MAX_LEVEL)
+        (void)start_level_prep(g, level + 1);
 
     /* Return success. */
     return 0;
 }
 
 /* 
- * move_up
- *   DESCRIPTION: Move the player up one pixel (assumed to be a legal move)
- *   INPUTS: ypos -- pointer to player's y position (pixel) in the maze
- *   OUTPUTS: *ypos -- reduced by one from initial value
+ * resume_maze_level
+ *   DESCRIPTION: Switch to a level loaded from a snapshot, whose maze must
+ *          already be in the maze slot for its level.  Fills the
+ *          game_info structure, makes the maze current, and draws the
+ *          initial screen.  Then starts preparing the level after it.
+ *   INPUTS: g -- the game
+ *           snap -- game state loaded with the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: writes entire game_info structure; changes maze;
+ *                 initializes display
+ */
+static int resume_maze_level(game_t* g, const snap_game_t* snap) {
+    maze_t* m;
+
+    if (snap->level < 1 || snap->level > MAX_LEVEL)
+        return -1;
+
+    /* Restore the level parameters as they were saved. */
+    g->info.number = snap->level;
+    g->info.maze_x_dim = snap->maze_x_dim;
+    g->info.maze_y_dim = snap->maze_y_dim;
+    g->info.initial_fruit_count = snap->initial_fruit_count;
+    g->info.time_to_first_fruit = snap->time_to_first_fruit;
+    g->info.time_between_fruits = snap->time_between_fruits;
+    g->info.tick_usec = snap->tick_usec;
+    g->info.map_x = snap->map_x;
+    g->info.map_y = snap->map_y;
+    m = &g->mazes[snap->level & 1];
+    g->sim.maze = m;
+    set_screen_fill_arg(&g->screen, m);
+
+    /* Set logical view and draw initial screen. */
+    set_view_window(&g->screen, g->info.map_x, g->info.map_y);
+    render_full_view(m, &g->screen);
+
+    /* Build the next level while this one is played. */
+    if (snap->level < MAX_LEVEL)
+        (void)start_level_prep(g, snap->level + 1);
+
+    /* Return success. */
+    return 0;
+}
+
+/* 
+ * show_view_events
+ *   DESCRIPTION: Bring the display up to date with the view window panning
+ *                reported by the simulation: move the logical view and
+ *                draw the line of pixels that scrolled into it.
+ *   INPUTS: g -- the game
+ *           events -- events reported by sim_step
+ *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: changes game_info map position; draws to the screen
  */
-static void move_up(int* ypos) {
-    /*
-     * Move player by one pixel and check whether display should be panned.
-     * Panning is necessary when the player moves past the upper pan border
-     * while the top pixels of the maze are not on-screen.
-     */
-    if (--(*ypos) < game_info.map_y + BLOCK_Y_DIM * PAN_BORDER && game_info.map_y > SHOW_MIN) {
-        /*
-         * Shift the logical view upwards by one pixel and draw the
-         * new line.
-         */
-        set_view_window(game_info.map_x, --game_info.map_y);
-        (void)draw_horiz_line(0);
-    }
+static void show_view_events(game_t* g, int events) {
+    if (!(events & SIM_EV_SCROLL))
+        return;
+    g->info.map_x = g->sim.map_x;
+    g->info.map_y = g->sim.map_y;
+    set_view_window(&g->screen, g->info.map_x, g->info.map_y);
+    if (events & SIM_EV_SCROLL_UP)
+        (void)draw_horiz_line(&g->screen, 0);
+    if (events & SIM_EV_SCROLL_RIGHT)
+        (void)draw_vert_line(&g->screen, SCROLL_X_DIM - 1);
+    if (events & SIM_EV_SCROLL_DOWN)
+        (void)draw_horiz_line(&g->screen, SCROLL_Y_DIM - 1);
+    if (events & SIM_EV_SCROLL_LEFT)
+        (void)draw_vert_line(&g->screen, 0);
+}
+
+/* 
+ * secs_to_steps
+ *   DESCRIPTION: Convert a time in seconds of play into simulation steps
+ *                of the current level, rounding up.
+ *   INPUTS: g -- the game
+ *           sec -- the time in seconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of steps
+ *   SIDE EFFECTS: none
+ */
+static unsigned long secs_to_steps(const game_t* g, int sec) {
+    return ((unsigned long long)sec * 1000000 + g->info.tick_usec - 1) /
+           g->info.tick_usec;
 }
 
 /* 
- * move_right
- *   DESCRIPTION: Move the player right one pixel (assumed to be a legal move)
- *   INPUTS: xpos -- pointer to player's x position (pixel) in the maze
- *   OUTPUTS: *xpos -- increased by one from initial value
+ * fruit_timer_fn
+ *   DESCRIPTION: Timer callback that adds a fruit to the maze, first
+ *                time_to_first_fruit seconds into the level and then
+ *                every time_between_fruits seconds.
+ *   INPUTS: w -- the game's timer wheel
+ *           t -- the fruit timer
+ *           arg -- the game
+ *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: changes the maze; marks the status bar as changed
  */
-static void move_right(int* xpos) {
-    /*
-     * Move player by one pixel and check whether display should be panned.
-     * Panning is necessary when the player moves past the right pan border
-     * while the rightmost pixels of the maze are not on-screen.
-     */
-    if (++(*xpos) > game_info.map_x + SCROLL_X_DIM - BLOCK_X_DIM * (PAN_BORDER + 1) &&
-        game_info.map_x + SCROLL_X_DIM < (2 * game_info.maze_x_dim + 1) * BLOCK_X_DIM - SHOW_MIN) {
-        /*
-         * Shift the logical view to the right by one pixel and draw the
-         * new line.
-         */
-        set_view_window(++game_info.map_x, game_info.map_y);
-        (void)draw_vert_line(SCROLL_X_DIM - 1);
-    }
+static void fruit_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg) {
+    game_t* g = arg;
+
+    (void)add_a_fruit(g->sim.maze);
+    g->status_changed = 1;
 }
 
 /* 
- * move_down
- *   DESCRIPTION: Move the player right one pixel (assumed to be a legal move)
- *   INPUTS: ypos -- pointer to player's y position (pixel) in the maze
- *   OUTPUTS: *ypos -- increased by one from initial value
+ * text_timer_fn
+ *   DESCRIPTION: Timer callback that hides the fruit text
+ *                text_timer_length steps after it was shown.
+ *   INPUTS: w -- the game's timer wheel
+ *           t -- the text timer
+ *           arg -- the game
+ *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: none
  */
-static void move_down(int* ypos) {
-    /*
-     * Move player by one pixel and check whether display should be panned.
-     * Panning is necessary when the player moves past the right pan border
-     * while the bottom pixels of the maze are not on-screen.
-     */
-    if (++(*ypos) > game_info.map_y + SCROLL_Y_DIM - BLOCK_Y_DIM * (PAN_BORDER + 1) && 
-        game_info.map_y + SCROLL_Y_DIM < (2 * game_info.maze_y_dim + 1) * BLOCK_Y_DIM - SHOW_MIN) {
-        /*
-         * Shift the logical view downwards by one pixel and draw the
-         * new line.
-         */
-        set_view_window(game_info.map_x, ++game_info.map_y);
-        (void)draw_horiz_line(SCROLL_Y_DIM - 1);
-    }
+static void text_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg) {
+    game_t* g = arg;
+
+    g->text_fruit = 0;
 }
 
 /* 
- * move_left
- *   DESCRIPTION: Move the player right one pixel (assumed to be a legal move)
- *   INPUTS: xpos -- pointer to player's x position (pixel) in the maze
- *   OUTPUTS: *xpos -- decreased by one from initial value
+ * color_timer_fn
+ *   DESCRIPTION: Timer callback that moves the player to the next color
+ *                every COLOR_STEPS steps.
+ *   INPUTS: w -- the game's timer wheel
+ *           t -- the color timer
+ *           arg -- the game
+ *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: none
  */
-static void move_left(int* xpos) {
-    /*
-     * Move player by one pixel and check whether display should be panned.
-     * Panning is necessary when the player moves past the left pan border
-     * while the leftmost pixels of the maze are not on-screen.
-     */
-    if (--(*xpos) < game_info.map_x + BLOCK_X_DIM * PAN_BORDER && game_info.map_x > SHOW_MIN) {
-        /*
-         * Shift the logical view to the left by one pixel and draw the
-         * new line.
-         */
-        set_view_window(--game_info.map_x, game_info.map_y);
-        (void)draw_vert_line (0);
-    }
+static void color_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg) {
+    game_t* g = arg;
+
+    g->color_frames = (g->color_frames / COLOR_STEPS + 1) * COLOR_STEPS;
+    g->recolor = 1;
 }
 
 /* 
- * unveil_around_player
- *   DESCRIPTION: Show the maze squares in an area around the player.
- *                Consume any fruit under the player.  Check whether
- *                player has won the maze level.
- *   INPUTS: (play_x,play_y) -- player coordinates in pixels
+ * clock_timer_fn
+ *   DESCRIPTION: Timer callback that counts a second of play, and sets
+ *                itself to run again at the step that ends the next
+ *                second.
+ *   INPUTS: w -- the game's timer wheel
+ *           t -- the clock timer
+ *           arg -- the game
  *   OUTPUTS: none
- *   RETURN VALUE: 1 if player wins the level by entering the square
- *                 0 if not
- *   SIDE EFFECTS: draws maze squares for newly visible maze blocks,
- *                 consumed fruit, and maze exit; consumes fruit and
- *                 updates displayed fruit counts
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the clock and status bar as changed
  */
-static int unveil_around_player(int play_x, int play_y) {
-    int x = play_x / BLOCK_X_DIM; /* player's maze lattice position */
-    int y = play_y / BLOCK_Y_DIM;
-    int i, j;            /* loop indices for unveiling maze squares */
+static void clock_timer_fn(timer_wheel_t* w, game_timer_t* t, void* arg) {
+    game_t* g = arg;
 
-    /* Check for fruit at the player's position. */
-    fnum = check_for_fruit (x, y);
+    g->elapsed++;
+    g->status_changed = 1;
+    timer_add(w, t, secs_to_steps(g, g->elapsed + 1) -
+                    secs_to_steps(g, g->elapsed), 0);
+}
 
-    
+/* 
+ * show_fruit_text
+ *   DESCRIPTION: Start showing the name of a fruit above the player.
+ *   INPUTS: g -- the game
+ *           fruit -- the fruit (1 or more)
+ *           steps -- number of steps to show the text
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets the text timer; marks the status bar as changed
+ */
+static void show_fruit_text(game_t* g, int fruit, int steps) {
+    g->text_fruit = fruit;
+    g->status_changed = 1;
+    timer_add(&g->timers, &g->text_timer, steps, 0);
+}
 
-    /* Unveil spaces around the player. */
-    for (i = -1; i < 2; i++)
-        for (j = -1; j < 2; j++)
-            unveil_space(x + i, y + j);
-        unveil_space(x, y - 2);
-        unveil_space(x + 2, y);
-        unveil_space(x, y + 2);
-        unveil_space(x - 2, y);
-
-    /* Check whether the player has won the maze level. */
-    return check_for_win (x, y);
+/* 
+ * start_level_timers
+ *   DESCRIPTION: Start the clock and the timed events of a level, either
+ *                from the level's start or from where a snapshot left
+ *                off.  Fruits appear at fixed times of play, so their
+ *                schedule is recovered from the time played.
+ *   INPUTS: g -- the game, with the level's game_info filled in
+ *           snap -- game state loaded from a snapshot, or NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restarts the game's timer wheel
+ */
+static void start_level_timers(game_t* g, const snap_game_t* snap) {
+    int first = g->info.time_to_first_fruit;
+    int between = g->info.time_between_fruits;
+
+    timer_wheel_init(&g->timers);
+    timer_init(&g->fruit_timer, fruit_timer_fn, g);
+    timer_init(&g->text_timer, text_timer_fn, g);
+    timer_init(&g->color_timer, color_timer_fn, g);
+    timer_init(&g->clock_timer, clock_timer_fn, g);
+
+    g->elapsed = g->color_frames = g->text_fruit = 0;
+    if (snap != NULL) {
+        g->elapsed = snap->elapsed;
+        g->color_frames = snap->color_frames;
+        if (snap->fruit_found && snap->text_timer >= 0 &&
+            snap->text_timer < text_timer_length &&
+            snap->fruit_num >= 1 && snap->fruit_num <= NUM_FRUIT_TYPES)
+            show_fruit_text(g, snap->fruit_num,
+                            text_timer_length - snap->text_timer);
+    }
+    g->recolor = g->status_changed = 1;
+
+    timer_add(&g->timers, &g->fruit_timer, secs_to_steps(g,
+              g->elapsed < first ? first - g->elapsed :
+              between - (g->elapsed - first) % between),
+              secs_to_steps(g, between));
+    timer_add(&g->timers, &g->color_timer,
+              COLOR_STEPS - g->color_frames % COLOR_STEPS, COLOR_STEPS);
+    timer_add(&g->timers, &g->clock_timer, secs_to_steps(g, g->elapsed + 1) -
+                                           secs_to_steps(g, g->elapsed), 0);
+}
+
+/* 
+ * save_game
+ *   DESCRIPTION: Save a snapshot of the level being played to SNAP_FILE.
+ *   INPUTS: g -- the game
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes SNAP_FILE
+ */
+static void save_game(game_t* g) {
+    snap_game_t snap;
+
+    snap.base_seed = g->base_seed;
+    snap.level = g->info.number;
+    snap.maze_x_dim = g->info.maze_x_dim;
+    snap.maze_y_dim = g->info.maze_y_dim;
+    snap.initial_fruit_count = g->info.initial_fruit_count;
+    snap.time_to_first_fruit = g->info.time_to_first_fruit;
+    snap.time_between_fruits = g->info.time_between_fruits;
+    snap.tick_usec = g->info.tick_usec;
+    snap.map_x = g->info.map_x;
+    snap.map_y = g->info.map_y;
+    snap.play_x = g->sim.play_x;
+    snap.play_y = g->sim.play_y;
+    snap.last_dir = g->sim.last_dir;
+    snap.dir = g->sim.dir;
+    snap.next_dir = g->next_dir;
+    snap.move_cnt = g->sim.move_cnt;
+    snap.elapsed = g->elapsed;
+    snap.fruit_found = (g->text_fruit != 0);
+    snap.fruit_num = g->text_fruit;
+    snap.text_timer = (g->text_fruit != 0 ? text_timer_length -
+                       (int)timer_remaining(&g->timers, &g->text_timer) : -1);
+    snap.color_frames = g->color_frames;
+    (void)save_snapshot(SNAP_FILE, g->sim.maze, &snap);
 }
 
 #ifndef NDEBUG
@@ -325,442 +624,522 @@ static int sanity_check() {
 // Shared Global Variables
 int quit_flag = 0;
 int winner= 0;
-int next_dir = UP;
-int play_x, play_y, last_dir, dir;
-int move_cnt = 0;
-int fd;
 int tux_fd;
-pthread_t tid3;
 
-unsigned long data;
 static struct termios tio_orig;
-static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t tux_mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cv =  PTHREAD_COND_INITIALIZER;
-volatile int buttons_pressed = 0;
-volatile int buttons;
-volatile int prev_but = 0;
 
 /*
- * tux_thread
- *   DESCRIPTION: Thread that handles the tux inputs
- *   INPUTS: none
- *   OUTPUTS: none
+ * parse_keys
+ *   DESCRIPTION: Turn keystrokes read from stdin into input events.  Arrow
+ *                keys arrive as ESC [ A-D; a sequence split across reads
+ *                is continued on the next call through *state.
+ *   INPUTS: g -- the game to be steered
+ *           state -- how much of an arrow key sequence has been seen
+ *           buf, n -- the keystrokes read
+ *   OUTPUTS: *state -- updated for the keystrokes
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: fills the game's kbd_ring
  */
-static void * tux_thread(void * arg) {
-
-    while(winner == 0) {
-        // lock the mutex
-        pthread_mutex_lock(&tux_mtx);
-        // wait for the button to be pressed
-        while(!buttons_pressed) {
-            pthread_cond_wait(&cv, &tux_mtx);
-        }
-        // move according to the direction that the buttons moved
-        // the hex values are according the mp document that explains how the buttons are as an integer
-        /* 0x10 = UP, 0x20 = DOWN, 0x40 = LEFT, 0x80 = RIGHT */
-        switch(buttons) {
-            case 0x10: {
-                next_dir = DIR_UP;
-                break;
-            }
-            case 0x20: {
-                next_dir = DIR_DOWN;
-                break;
-            }
-            case 0x40: {
-                next_dir = DIR_LEFT;
-                break;
-            }
-            case 0x80: {
-                next_dir = DIR_RIGHT;
-                break;
-            }
-        }
-        // return the value of the buttons_pressed to 0 and unlock the mutex
-        buttons_pressed = 0;
-        pthread_mutex_unlock(&tux_mtx);
-    }
-    return NULL;
-}
+static void parse_keys(game_t* g, int* state, const unsigned char* buf, int n) {
+    unsigned char key;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = buf[i];
 
-/*
- * keyboard_thread
- *   DESCRIPTION: Thread that handles keyboard inputs
- *   INPUTS: none
- *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: none
- */
-static void *keyboard_thread(void *arg) {
-    char key;
-    int state = 0;
-    // Break only on win or quit input - '`'
-    while (winner == 0) {        
-        // Get Keyboard Input
-        key = getc(stdin);
-        
         // Check for '`' to quit
         if (key == BACKQUOTE) {
-            quit_flag = 1;
-            break;
+            (void)evring_push(&g->kbd_ring, EV_QUIT, 0);
+            *state = 0;
+            continue;
         }
-        
+
+        // Check for 's' to save a snapshot
+        if (key == 's') {
+            (void)evring_push(&g->kbd_ring, EV_SAVE, 0);
+            *state = 0;
+            continue;
+        }
+
         // Compare and Set next_dir
         // Arrow keys deliver 27, 91, ##
         if (key == 27) {
-            state = 1;
+            *state = 1;
         }
-        else if (key == 91 && state == 1) {
-            state = 2;
+        else if (key == 91 && *state == 1) {
+            *state = 2;
         }
-        else {    
-            if (key >= UP && key <= LEFT && state == 2) {
-                pthread_mutex_lock(&mtx);
+        else {
+            if (key >= UP && key <= LEFT && *state == 2) {
                 switch(key) {
                     case UP:
-                        next_dir = DIR_UP;
+                        (void)evring_push(&g->kbd_ring, EV_DIR, DIR_UP);
                         break;
                     case DOWN:
-                        next_dir = DIR_DOWN;
+                        (void)evring_push(&g->kbd_ring, EV_DIR, DIR_DOWN);
                         break;
                     case RIGHT:
-                        next_dir = DIR_RIGHT;
+                        (void)evring_push(&g->kbd_ring, EV_DIR, DIR_RIGHT);
                         break;
                     case LEFT:
-                        next_dir = DIR_LEFT;
+                        (void)evring_push(&g->kbd_ring, EV_DIR, DIR_LEFT);
                         break;
                 }
-                pthread_mutex_unlock(&mtx);
             }
-            state = 0;
+            *state = 0;
         }
     }
+}
 
-    return 0;
+/*
+ * read_tux
+ *   DESCRIPTION: Read all of the button events queued by the Tux
+ *                controller driver, and queue a direction event for each
+ *                change to a single arrow.  Direction events keep the
+ *                time at which the driver saw the change.
+ *   INPUTS: g -- the game to be steered
+ *           prev_but -- the buttons seen by the last event
+ *   OUTPUTS: *prev_but -- the buttons seen now
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the game's tux_ring
+ */
+static void read_tux(game_t* g, int* prev_but) {
+    struct tux_event ev[INPUT_MAX_TUX];
+    int n, i, dir;
+
+    // The controller is non-blocking; read until its queue is empty.
+    while ((n = read(tux_fd, ev, sizeof (ev))) >= (int)sizeof (ev[0])) {
+        for (i = 0; i < n / (int)sizeof (ev[0]); i++) {
+            if (ev[i].buttons == *prev_but)
+                continue;
+            *prev_but = ev[i].buttons;
+            // move according to the direction that the buttons moved
+            // the hex values are according the mp document that explains how the buttons are as an integer
+            /* 0x10 = UP, 0x20 = DOWN, 0x40 = LEFT, 0x80 = RIGHT */
+            switch(ev[i].buttons) {
+                case 0x10: dir = DIR_UP; break;
+                case 0x20: dir = DIR_DOWN; break;
+                case 0x40: dir = DIR_LEFT; break;
+                case 0x80: dir = DIR_RIGHT; break;
+                default: continue;
+            }
+            (void)evring_push_at(&g->tux_ring,
+                                 ev[i].sec * 1000000000ULL + ev[i].nsec,
+                                 EV_DIR, dir);
+        }
+    }
 }
 
-/* some stats about how often we take longer than a single timer tick */
-static int goodcount = 0;
-static int badcount = 0;
-static int total = 0;
+/*
+ * input_thread
+ *   DESCRIPTION: Thread that handles all player input.  It sleeps in
+ *                epoll_wait until stdin has keystrokes, the Tux
+ *                controller has button events, or the game loop signals
+ *                stop_fd, so it uses no CPU while the player is idle.
+ *   INPUTS: arg -- the game to be steered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the game's input rings
+ */
+static void *input_thread(void *arg) {
+    game_t* g = arg;
+    struct epoll_event ev, ready[INPUT_MAX_EVENTS];
+    unsigned char buf[INPUT_BUF_SIZE];
+    int ep, n, i;
+    int state = 0;
+    int prev_but = 0;
+    int running = 1;
+
+    if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return NULL;
+    ev.events = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    (void)epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    ev.data.fd = g->stop_fd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, g->stop_fd, &ev) != 0) {
+        close(ep);
+        return NULL;
+    }
+
+    if (tux_fd >= 0) {
+        ev.data.fd = tux_fd;
+        (void)epoll_ctl(ep, EPOLL_CTL_ADD, tux_fd, &ev);
+    }
+
+    while (running) {
+        if ((n = epoll_wait(ep, ready, INPUT_MAX_EVENTS, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (ready[i].data.fd == g->stop_fd) {
+                running = 0;
+            }
+            else if (ready[i].data.fd == STDIN_FILENO) {
+                // Take everything typed so far (stdin is non-blocking).
+                int len;
+                while ((len = read(STDIN_FILENO, buf, sizeof (buf))) > 0)
+                    parse_keys(g, &state, buf, len);
+                if (len == 0)
+                    (void)epoll_ctl(ep, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            }
+            else if (ready[i].data.fd == tux_fd) {
+                read_tux(g, &prev_but);
+            }
+        }
+    }
+
+    close(ep);
+    return NULL;
+}
+
+/*
+ * drain_input
+ *   DESCRIPTION: Take every queued input event from the keyboard and the
+ *                Tux controller.  If both sources asked for a direction,
+ *                the later request wins.  The time each event spent in
+ *                its ring is recorded.
+ *   INPUTS: g -- the game
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change g->next_dir, quit_flag, and save_flag;
+ *                 empties the game's input rings
+ */
+static void drain_input(game_t* g) {
+    evring_t* rings[2] = {&g->kbd_ring, &g->tux_ring};
+    unsigned long long dir_t = 0;
+    input_ev_t ev;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        while (evring_pop(rings[i], &ev)) {
+            PROF_SAMPLE(PROF_INPUT_WAIT, g->info.number,
+                        evring_now() - ev.t_ns);
+            switch (ev.type) {
+                case EV_DIR:
+                    if (ev.t_ns >= dir_t) {
+                        dir_t = ev.t_ns;
+                        g->next_dir = ev.arg;
+                    }
+                    break;
+                case EV_QUIT:
+                    quit_flag = 1;
+                    break;
+                case EV_SAVE:
+                    save_flag = 1;
+                    break;
+            }
+        }
+    }
+}
 
 /*
  * rtc_thread
  *   DESCRIPTION: Thread that handles updating the screen
- *   INPUTS: none
+ *   INPUTS: arg -- the game to be played
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 static void *rtc_thread(void *arg) {
-    int ticks = 0;
+    game_t* g = arg;
+    screen_t* scr = &g->screen;
+    int steps;
+    int text_shown;
     int level;
-    int ret;
-    int open[NUM_DIRS];
+    int events;
     int goto_next_level = 0;
     int font_height = 8; 
     int font_width = 16;
-    int save_time = 0;
+    int resuming = (load_path != NULL);
+    PROF_FRAME(frame);
+
+    // Build the first level, unless it was loaded from a snapshot.
+    if (resuming)
+        level = loaded.level;
+    else {
+        level = 1;
+        (void)start_level_prep(g, 1);
+    }
 
     // Loop over levels until a level is lost or quit.
-    for (level = 1; (level <= MAX_LEVEL) && (quit_flag == 0); level++) {
+    for (; (level <= MAX_LEVEL) && (quit_flag == 0); level++) {
         // Prepare for the level.  If we fail, just let the player win.
-        if (prepare_maze_level(level) != 0)
+        if ((resuming ? resume_maze_level(g, &loaded) :
+                        prepare_maze_level(g, level)) != 0)
             break;
         goto_next_level = 0;
 
-        // Start the player at (1,1)
-        play_x = BLOCK_X_DIM;
-        play_y = BLOCK_Y_DIM;
-
-        // move_cnt tracks moves remaining between maze squares.
-        // When not moving, it should be 0.
-        move_cnt = 0;
-
-        // Initialize last direction moved to up
-        last_dir = DIR_UP;
+        // Start the player at (1,1), stopped and facing up
+        sim_init(&g->sim, g->sim.maze);
+        g->next_dir = DIR_STOP;
+
+        // Pick up where a snapshot left off.
+        if (resuming) {
+            g->sim.play_x = loaded.play_x;
+            g->sim.play_y = loaded.play_y;
+            g->sim.move_cnt = loaded.move_cnt;
+            g->sim.last_dir = loaded.last_dir;
+            g->sim.dir = loaded.dir;
+            g->sim.map_x = g->info.map_x;
+            g->sim.map_y = g->info.map_y;
+            g->next_dir = loaded.next_dir;
+        }
 
-        // Initialize the current direction of motion to stopped
-        dir = DIR_STOP;
-        next_dir = DIR_STOP;
+        // Start the level's clock and timed events.  The controller
+        // counts the seconds on its LEDs by itself from here on.
+        start_level_timers(g, resuming ? &loaded : NULL);
+        ioctl(tux_fd, TUX_CLK_START, g->elapsed);
+        resuming = 0;
 
         // Show maze around the player's original position
-        int fruit_found = 0;                        // fruit has not been found yet
-        int n_fruits = return_n_fruits();
-        int text_timer = -1;                        // timer for how long the text will last
-        int save_fnum;
-        (void)unveil_around_player(play_x, play_y);
-
-        if(n_fruits != return_n_fruits()) {
-            save_fnum = fnum;
-            text_timer = 0;                         // set this to 0 because the text has been found so start the timer                 
-            fruit_found = 1;                        // the fruit has been found
-            n_fruits = return_n_fruits();
-        }
-
-        set_palette_color(level, 0);
+        if (sim_unveil(&g->sim) & SIM_EV_FRUIT)
+            show_fruit_text(g, g->sim.fruit, text_timer_length);
+
+        // Step at this level's rate, and draw a frame once per step or
+        // once per display refresh, whichever is longer, starting one
+        // frame from now.
+        if (tick_accum_set_step(&g->steps, g->info.tick_usec) != 0 ||
+            tick_set_period(&g->tick, (g->info.tick_usec > g->frame_usec ?
+                                       g->info.tick_usec : g->frame_usec)) != 0)
+            break;
 
         // buffer to store the background
         unsigned char maze_buffer[BLOCK_X_DIM * BLOCK_Y_DIM];
+        // status bar text
+        char str[50];
+
+        set_palette_color(level, g->color_frames);
+        g->recolor = 0;
 
+        // draw the maze blocks changed since the view was drawn
+        draw_dirty_blocks(g->sim.maze, scr);
         // save the background
-        store_background(play_x, play_y, maze_buffer);
+        store_background(scr, g->sim.play_x, g->sim.play_y, maze_buffer);
         // draw the player to the new position
-        draw_player_block(play_x, play_y, get_player_block(last_dir) ,get_player_mask(last_dir));
+        draw_player_block(scr, g->sim.play_x, g->sim.play_y, get_player_block(g->sim.last_dir) ,get_player_mask(g->sim.last_dir));
 
-        show_screen();
+        show_screen(scr);
         // draw the background back after the plaer leaves
-        draw_full_block(play_x, play_y, maze_buffer);
-
-        int player_color_change = 0;
-        time_t start;
-
-        time(&start);
-
-        // turn the appropriate values into a string to display into the screen
-        char str[50];
-        turnToString(level, 0, 0, str);
-        show_statusbar(str, level);
-
-        // get first Periodic Interrupt
-        ret = read(fd, &data, sizeof(unsigned long));
+        draw_full_block(scr, g->sim.play_x, g->sim.play_y, maze_buffer);
 
         while ((quit_flag == 0) && (goto_next_level == 0)) {
-            // Wait for Periodic Interrupt
-            ret = read(fd, &data, sizeof(unsigned long));
-        
-            // Update tick to keep track of time.  If we missed some
-            // interrupts we want to update the player multiple times so
-            // that player velocity is smooth
-            ticks = data >> 8;    
-
-            total += ticks;
-
-            // If the system is completely overwhelmed we better slow down:
-            if (ticks > 8) ticks = 8;
-
-            if (ticks > 1) {
-                badcount++;
-            }
-            else {
-                goodcount++;
+            // Wait for the next frame, then run every simulation step
+            // owed for the real time that has passed, so that the player
+            // moves at the level's speed however long frames take.  If the
+            // system is completely overwhelmed, the steps are capped and
+            // the game slows down.
+            if (tick_wait(&g->tick) < 0) {
+                quit_flag = 1;
+                break;
             }
-
-            while (ticks--) {
-                /*call the tux ioctl for the buttons to let the buttons work*/
-                ioctl(tux_fd, TUX_BUTTONS, &buttons);
-                // lock the mutex
-                pthread_mutex_lock(&tux_mtx);
-                // check to see if a button has been pressed
-                if(buttons != prev_but) {
-                    buttons_pressed = 1;
-                    prev_but = buttons;
-                }
-                // if the button has been pressed, send cond_signal
-                if(buttons_pressed) {
-                    pthread_cond_signal(&cv);
-                }
-                // unlock the mutex
-                pthread_mutex_unlock(&tux_mtx);
-
-
-                // Lock the mutex
-                pthread_mutex_lock(&mtx);
-
-                // Check to see if a key has been pressed
-                if (next_dir != dir) {
-                    // Check if new direction is backwards...if so, do immediately
-                    if ((dir == DIR_UP && next_dir == DIR_DOWN) ||
-                        (dir == DIR_DOWN && next_dir == DIR_UP) ||
-                        (dir == DIR_LEFT && next_dir == DIR_RIGHT) ||
-                        (dir == DIR_RIGHT && next_dir == DIR_LEFT)) {
-                        if (move_cnt > 0) {
-                            if (dir == DIR_UP || dir == DIR_DOWN)
-                                move_cnt = BLOCK_Y_DIM - move_cnt;
-                            else
-                                move_cnt = BLOCK_X_DIM - move_cnt;
-                        }
-                        dir = next_dir;
-                    }
-                }
-                // New Maze Square!
-                if (move_cnt == 0) {
-                    // The player has reached a new maze square; unveil nearby maze
-                    // squares and check whether the player has won the level.
-                    if (unveil_around_player(play_x, play_y)) {
-                        pthread_mutex_unlock(&mtx);
-                        goto_next_level = 1;
-                        break;
-                    }
-                    if(n_fruits != return_n_fruits()) {
-                        text_timer = 0;
-                        fruit_found = 1;
-                        save_fnum = fnum;
-                        n_fruits = return_n_fruits();
-                    }
-                
-                    // Record directions open to motion.
-                    find_open_directions (play_x / BLOCK_X_DIM, play_y / BLOCK_Y_DIM, open);
-        
-                    // Change dir to next_dir if next_dir is open 
-                    if (open[next_dir]) {
-                        dir = next_dir;
-                    }
-    
-                    // The direction may not be open to motion...
-                    //   1) ran into a wall
-                    //   2) initial direction and its opposite both face walls
-                    if (dir != DIR_STOP) {
-                        if (!open[dir]) {
-                            dir = DIR_STOP;
-                        }
-                        else if (dir == DIR_UP || dir == DIR_DOWN) {    
-                            move_cnt = BLOCK_Y_DIM;
-                        }
-                        else {
-                            move_cnt = BLOCK_X_DIM;
-                        }
-                    }
-                }
-                // Unlock the mutex
-                pthread_mutex_unlock(&mtx);
-        
-                if (dir != DIR_STOP) {
-                    // move in chosen direction
-                    last_dir = dir;
-                    move_cnt--;    
-                    switch (dir) {
-                        case DIR_UP:    
-                            move_up(&play_y);    
-                            break;
-                        case DIR_RIGHT: 
-                            move_right(&play_x); 
-                            break;
-                        case DIR_DOWN:  
-                            move_down(&play_y);  
-                            break;
-                        case DIR_LEFT:  
-                            move_left(&play_x);  
-                            break;
-                    }  
-
+            PROF_BEGIN(frame);
+            steps = tick_accum_steps(&g->steps);
+
+            while (steps--) {
+                // Take the player's requests from the input threads
+                drain_input(g);
+                PROF_LAP(frame, PROF_INPUT);
+
+                // Advance the player in the requested direction
+                events = sim_step(&g->sim, g->next_dir);
+                PROF_LAP(frame, PROF_SIM);
+
+                // The player has won the level by reaching the exit.
+                if (events & SIM_EV_WON) {
+                    goto_next_level = 1;
+                    break;
                 }
+                if (events & SIM_EV_FRUIT)
+                    show_fruit_text(g, g->sim.fruit, text_timer_length);
+                show_view_events(g, events);
+                PROF_LAP(frame, PROF_REDRAW);
+
+                // run the timed events due at this step
+                timer_advance(&g->timers, 1);
+                PROF_LAP(frame, PROF_SIM);
             }
 
-            player_color_change++;
-
-            // if statement so that the player's color doesn't change too fast - 11 is a pretty arbitrary number, I just chose it because I liked that speed that the player's color changed
-            if(player_color_change % 11 == 0)
-                set_palette_color(level, player_color_change);
+            // set the player color if its timer changed it
+            if (g->recolor) {
+                g->recolor = 0;
+                set_palette_color(level, g->color_frames);
+                PROF_LAP(frame, PROF_PALETTE);
+            }
 
+            // draw the maze blocks changed during this frame's steps
+            draw_dirty_blocks(g->sim.maze, scr);
+            PROF_LAP(frame, PROF_REDRAW);
             // save the background
-            store_background(play_x, play_y, maze_buffer);        
+            store_background(scr, g->sim.play_x, g->sim.play_y, maze_buffer);        
             // save the background of the floating text
             unsigned char floating_background[font_height * text_length * font_width];
-            save_floating_background(play_x - floating_text_x, play_y - floating_text_y, floating_background);
+            save_floating_background(scr, g->sim.play_x - floating_text_x, g->sim.play_y - floating_text_y, floating_background);
 
 
             // draw the character on the new position
-            draw_player_block(play_x, play_y, get_player_block(last_dir) ,get_player_mask(last_dir));  
+            draw_player_block(scr, g->sim.play_x, g->sim.play_y, get_player_block(g->sim.last_dir) ,get_player_mask(g->sim.last_dir));  
 
-            // if a fruit is found, display the floating text for a certain period of time
-            if(fruit_found && text_timer < text_timer_length){
+            // if a fruit is found, display the floating text until its timer runs out
+            text_shown = (g->text_fruit != 0);
+            if (text_shown) {
                 unsigned char floating_mask[font_height * font_width * 15];
-                text_to_mask(fruit_strings[save_fnum - 1], floating_mask);
-                draw_floating_text(play_x - floating_text_x, play_y - floating_text_y, floating_mask, floating_background);
+                text_to_mask(fruit_strings[g->text_fruit - 1], floating_mask);
+                draw_floating_text(scr, g->sim.play_x - floating_text_x, g->sim.play_y - floating_text_y, floating_mask, floating_background);
             }
 
-            show_screen();
+            PROF_LAP(frame, PROF_SPRITE);
+
+            show_screen(scr);
+            PROF_LAP(frame, PROF_SHOW);
 
             // draw the background back
-            draw_full_block(play_x, play_y, maze_buffer);
+            draw_full_block(scr, g->sim.play_x, g->sim.play_y, maze_buffer);
 
-            if(fruit_found && text_timer < text_timer_length) {
-                text_timer++;
-                redraw_floating_background(play_x - floating_text_x, play_y - floating_text_y, floating_background);
+            if (text_shown) {
+                redraw_floating_background(scr, g->sim.play_x - floating_text_x, g->sim.play_y - floating_text_y, floating_background);
             }
-
-            // calculate how much time has passed 
-            time_t end;
-            time(&end);
-            int diff = difftime(end, start);
-
-            int min = diff / 60;
-            int sec = diff % 60;
-            
-            // update the LED only when a second has passed
-            if(diff != save_time) {
-                save_time = diff;
-                int clock = tux_time(min, sec);
-                ioctl(tux_fd, TUX_SET_LED, clock);
+            PROF_LAP(frame, PROF_SPRITE);
+
+            // update the status bar only when the clock or the fruit
+            // count changed
+            if (g->status_changed) {
+                g->status_changed = 0;
+                turnToString(g->sim.maze, level, g->elapsed / 60, g->elapsed % 60, str);
+                show_statusbar(str, level); 
             }
-            
+            PROF_LAP(frame, PROF_STATUS);
+            PROF_END(frame, level);
 
-            // display the correct level, minutes passed and time passed on the display           
-            turnToString(level, min, sec, str);
-            show_statusbar(str, level); 
+            // save a snapshot if one was requested
+            if (save_flag) {
+                save_flag = 0;
+                save_game(g);
+            }
         }  
+
+        // Hold the level's time on the LEDs until the next level starts
+        ioctl(tux_fd, TUX_CLK_STOP, 0);
     }
+    (void)finish_level_prep(g);
     if (quit_flag == 0)
         winner = 1;
-    pthread_cancel(tid3);
+    (void)eventfd_write(g->stop_fd, 1);
     return 0;
 }
 
-/*  tux_time()
- *  INTERFACE : helper function used to create the appropriate integer to put into the LED
- *  input: min - the amount of minutes passed since the game has started
- *          sec - the amount of seconds passed since the games has started
- *  output: the time on the LED
- *  return: the integer value that puts the correct time on the LED
- */
-int tux_time(int min, int sec) {
-    int time;
-    // turn on all lights and the second decimal
-    time =  0x020F0000;
-
-    // calculate the correct integer that can put up the right value ont the LED. 
-    time = time | (sec % 10);
-    time = time | ((sec / 10) << 4 );
-    time = time | ((min % 10) << 8 );
-    time = time | ((min / 10) << 12 );
-    return time;
-}
-
 /*
  * main
  *   DESCRIPTION: Initializes and runs the two threads
- *   INPUTS: none
+ *   INPUTS: argc, argv -- "-s <seed>" replays the mazes of an earlier game
+ *                         "-l <file>" resumes a game saved with 's'
+ *                         "-t <source>" paces the game with "timerfd"
+ *                                       (the default), "sleep", or "rtc"
+ *                         "-r <hz>" draws at most hz frames per second
+ *                                   (default REFRESH_HZ; 0 for no limit)
+ *                         "-c <steps>" runs at most this many simulation
+ *                                      steps per frame (default MAX_STEPS)
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: prints the maze seed and tick statistics on exit
  */
-int main() {
-    int ret;
+int main(int argc, char* argv[]) {
     struct termios tio_new;
-    unsigned long update_rate = 32; /* in Hz */
+    const char* seed_arg = NULL;
+    tick_kind_t tick_kind = TICK_TIMERFD;
+    int refresh_hz = REFRESH_HZ;
+    int max_steps = MAX_STEPS;
+    int opt;
 
     pthread_t tid1;
     pthread_t tid2;
 
-    // Initialize RTC
-    fd = open("/dev/rtc", O_RDONLY, 0);
+    // Parse the command line
+    while ((opt = getopt(argc, argv, "s:l:t:r:c:")) != -1) {
+        if (opt == 's')
+            seed_arg = optarg;
+        else if (opt == 'l')
+            load_path = optarg;
+        else if (opt == 't') {
+            for (tick_kind = 0; tick_kind < NUM_TICK_KINDS; tick_kind++)
+                if (strcmp(optarg, tick_kind_name(tick_kind)) == 0)
+                    break;
+        }
+        else if (opt == 'r')
+            refresh_hz = atoi(optarg);
+        else if (opt == 'c')
+            max_steps = atoi(optarg);
+        if (opt == '?' || tick_kind == NUM_TICK_KINDS ||
+            refresh_hz < 0 || max_steps < 1 ||
+            (seed_arg != NULL && load_path != NULL)) {
+            fprintf(stderr, "usage: %s [-s seed | -l snapshot] "
+                    "[-t timerfd|sleep|rtc] [-r refresh_hz] [-c max_steps]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+    if (optind != argc) {
+        fprintf(stderr, "usage: %s [-s seed | -l snapshot] "
+                "[-t timerfd|sleep|rtc] [-r refresh_hz] [-c max_steps]\n",
+                argv[0]);
+        return -1;
+    }
+
+    // Pick the maze seed, either from the command line, from a snapshot,
+    // or from the clock
+    if (seed_arg != NULL) {
+        game.base_seed = strtoul(seed_arg, NULL, 0);
+    }
+    else if (load_path != NULL) {
+        if (load_snapshot(load_path, &game.mazes[0], &loaded) != 0 ||
+            loaded.level < 1 || loaded.level > MAX_LEVEL) {
+            fprintf(stderr, "%s: cannot load snapshot %s\n", argv[0], load_path);
+            return -1;
+        }
+        // The snapshot was loaded into the slot of an even level.
+        if (loaded.level & 1)
+            game.mazes[1] = game.mazes[0];
+        game.base_seed = loaded.base_seed;
+    }
+    else {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        game.base_seed = (unsigned long)tv.tv_sec * 1000003UL + tv.tv_usec;
+    }
+
+    // Open the tick source; the rate is set again at each level.  If
+    // /dev/rtc was asked for but cannot be used, a timerfd is used instead.
+    if (tick_open(&game.tick, tick_kind, 20000) != 0) {
+        perror("tick source");
+        return -1;
+    }
+    if (game.tick.kind != tick_kind)
+        fprintf(stderr, "%s: using %s ticks instead of %s\n", argv[0],
+                tick_kind_name(game.tick.kind), tick_kind_name(tick_kind));
+    game.frame_usec = (refresh_hz > 0 ? 1000000 / refresh_hz : 0);
+    tick_accum_init(&game.steps, max_steps);
+
     // initialize the tux
-    tux_fd = open("/dev/ttyS0", O_RDWR | O_NOCTTY);
+    // (non-blocking, so that input_thread can read all queued events)
+    tux_fd = open("/dev/ttyS0", O_RDWR | O_NOCTTY | O_NONBLOCK);
     int ldisc_num = N_MOUSE;
     ioctl(tux_fd, TIOCSETD, &ldisc_num);
-    ioctl(tux_fd, TUX_INIT, 0);
-    
-    // Enable RTC periodic interrupts at update_rate Hz
-    // Default max is 64...must change in /proc/sys/dev/rtc/max-user-freq
-    ret = ioctl(fd, RTC_IRQP_SET, update_rate);    
-    ret = ioctl(fd, RTC_PIE_ON, 0);
+    // ...and hold its clock at zero while the first level is built
+    struct tux_cmd tux_setup[3] = {{TUX_INIT, 0, 0}, {TUX_CLK_START, 0, 0},
+                                   {TUX_CLK_STOP, 0, 0}};
+    struct tux_batch tux_batch = {3, tux_setup};
+    ioctl(tux_fd, TUX_BATCH, &tux_batch);
+
+    // The game loop signals this when the game ends, to stop input_thread
+    if ((game.stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return -1;
+    }
 
     // Initialize Keyboard
-    // Turn on non-blocking mode
+    // Turn on non-blocking mode, so that input_thread can read all of
+    // the keystrokes waiting without blocking
     if (fcntl(fileno(stdin), F_SETFL, O_NONBLOCK) != 0) {
         perror("fcntl to make stdin non-blocking");
         return -1;
@@ -784,28 +1163,28 @@ int main() {
     }
 
     // Perform Sanity Checks and then initialize input and display
-    if ((sanity_check() != 0) || (set_mode_X(fill_horiz_buffer, fill_vert_buffer) != 0)){
+    if ((sanity_check() != 0) || (set_mode_X(&game.screen, fill_horiz_buffer, fill_vert_buffer,
+                                               &game.mazes[0]) != 0)){
         return 3;
     }
 
     // Create the threads
-    pthread_create(&tid1, NULL, rtc_thread, NULL);
-    pthread_create(&tid2, NULL, keyboard_thread, NULL);
-    pthread_create(&tid3, NULL, tux_thread, NULL);
+    pthread_create(&tid1, NULL, rtc_thread, &game);
+    pthread_create(&tid2, NULL, input_thread, &game);
     
     // Wait for all the threads to end
     pthread_join(tid1, NULL);
     pthread_join(tid2, NULL);
-    pthread_join(tid3, NULL);
+    close(game.stop_fd);
 
     // Shutdown Display
-    clear_mode_X();
+    clear_mode_X(&game.screen);
     
     // Close Keyboard
     (void)tcsetattr(fileno(stdin), TCSANOW, &tio_orig);
         
-    // Close RTC
-    close(fd);
+    // Close the tick source
+    tick_close(&game.tick);
 
     // Print outcome of the game
     if (winner == 1) {    
@@ -817,6 +1196,13 @@ int main() {
     else {
         printf ("Sorry, you lose...\n");
     }
+    printf("Maze seed: %lu (replay with -s %lu)\n", game.base_seed, game.base_seed);
+    tick_print_stats(&game.tick);
+    tick_accum_print_stats(&game.steps);
+    if (game.kbd_ring.drops != 0 || game.tux_ring.drops != 0)
+        printf("Input events dropped: %lu keyboard, %lu controller\n",
+               game.kbd_ring.drops, game.tux_ring.drops);
+    PROF_REPORT(stdout);
 
     // Return success
     return 0;
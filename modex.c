@@ -64,11 +64,9 @@
  * Strictly speaking (try it), no extra space is necessary, but the minimum
  * means an extra 64kB memory copy with every scroll pixel.  Finally,
  * BUILD_BASE_INIT places initial (or transferred) logical view in the
- * middle of the available buffer area.
+ * middle of the available buffer area.  All but BUILD_BASE_INIT are
+ * defined in modex.h, as each screen_t holds its own build buffer.
  */
-#define SCROLL_SIZE             (SCROLL_X_WIDTH * SCROLL_Y_DIM)
-#define SCREEN_SIZE             (SCROLL_SIZE * 4 + 1)
-#define BUILD_BUF_SIZE          (SCREEN_SIZE + 20000)
 #define BUILD_BASE_INIT         ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
 #define FONT_HEIGHT             16                                          /*height of the font*/        
 #define STATUS_BAR_SIZE         ((FONT_HEIGHT + 2) * IMAGE_X_DIM)           /*font height + 1 pixel above and 1 pixel belo times the width of the screen*/
@@ -185,6 +183,9 @@ static void transparent_palette();
 static void write_font_data();
 static void set_text_mode_3(int clear_scr);
 static void copy_image(unsigned char* img, unsigned short scr_addr);
+#ifndef TEXT_RESTORE_PROGRAM
+static void copy_horiz_line(screen_t* scr, int y, unsigned char buf[SCROLL_X_DIM]);
+#endif
 
 /*
  * Images are built in this buffer, then copied to the video memory.
@@ -205,6 +206,10 @@ static void copy_image(unsigned char* img, unsigned short scr_addr);
  * with plane 1 when plane 0 was offset by 1 from plane 1, i.e., when
  * displaying a one-pixel left shift.
  *
+ * Each screen_t holds a build buffer along with the position of the
+ * logical view window within it, so several screens can be drawn at
+ * once; only one of them is shown on the VGA.
+ *
  * The memory fence (included when NDEBUG is not defined) allocates
  * the build buffer with extra space on each side.  The extra space
  * is filled with magic numbers (something unlikely to be written in
@@ -212,30 +217,12 @@ static void copy_image(unsigned char* img, unsigned short scr_addr);
  * the end of the program to detect array access bugs (writes past
  * the ends of the build buffer).
  */
-#ifndef NDEBUG
-#define MEM_FENCE_WIDTH 256
-#else
-#define MEM_FENCE_WIDTH 0
-#endif
 #define MEM_FENCE_MAGIC 0xF3
 
-static unsigned char build[BUILD_BUF_SIZE + 2 * MEM_FENCE_WIDTH];
-static int img3_off;                /* offset of upper left pixel   */
-static unsigned char* img3;         /* pointer to upper left pixel  */
-static int show_x, show_y;          /* logical view coordinates     */
-
                                     /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
 
-/*
- * functions provided by the caller to set_mode_X() and used to obtain
- * graphic images of lines (pixels) to be mapped into the build buffer
- * planes for display in mode X
- */
-static void (*horiz_line_fn)(int, int, unsigned char[SCROLL_X_DIM]);
-static void (*vert_line_fn)(int, int, unsigned char[SCROLL_Y_DIM]);
-
 /*
  * macro used to target a specific video plane or planes when writing
  * to video memory in mode X; bits 8-11 in the mask_hi_bits enable writes
@@ -307,9 +294,10 @@ do {                                                                \
 } while (0)
 
 /*
- * set_mode_X
- *   DESCRIPTION: Puts the VGA into mode X.
- *   INPUTS: horiz_fill_fn -- this function is used as a callback (by
+ * init_screen
+ *   DESCRIPTION: Prepare a screen for drawing without touching the VGA.
+ *   INPUTS: scr -- the screen
+ *           horiz_fill_fn -- this function is used as a callback (by
  *                     draw_horiz_line) to obtain a graphical
  *                     image of a particular logical line for
  *                     drawing to the build buffer
@@ -317,13 +305,15 @@ do {                                                                \
  *                    draw_vert_line) to obtain a graphical
  *                    image of a particular logical line for
  *                    drawing to the build buffer
+ *           fill_arg -- first argument passed to both callbacks
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: initializes the logical view window; maps video memory
- *                 and obtains permission for VGA ports; clears video memory
+ *   SIDE EFFECTS: initializes the logical view window and memory fence
  */
-int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-               void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM])) {
+int init_screen(screen_t* scr,
+                void (*horiz_fill_fn)(void*, int, int, unsigned char[SCROLL_X_DIM]),
+                void (*vert_fill_fn)(void*, int, int, unsigned char[SCROLL_Y_DIM]),
+                void* fill_arg) {
 
     /* loop index for filling memory fence with magic numbers */
     int i;
@@ -334,20 +324,56 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
      */
     if (horiz_fill_fn == NULL || vert_fill_fn == NULL)
         return -1;
-    horiz_line_fn = horiz_fill_fn;
-    vert_line_fn = vert_fill_fn;
+    scr->horiz_line_fn = horiz_fill_fn;
+    scr->vert_line_fn = vert_fill_fn;
+    scr->fill_arg = fill_arg;
 
     /* Initialize the logical view window to position (0,0). */
-    show_x = show_y = 0;
-    img3_off = BUILD_BASE_INIT;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
+    scr->show_x = scr->show_y = 0;
+    scr->img3_off = BUILD_BASE_INIT;
+    scr->img3 = scr->build + scr->img3_off + MEM_FENCE_WIDTH;
 
     /* Set up the memory fence on the build buffer. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        build[i] = MEM_FENCE_MAGIC;
-        build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
+        scr->build[i] = MEM_FENCE_MAGIC;
+        scr->build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
     }
 
+    /* Return success. */
+    return 0;
+}
+
+/*
+ * set_screen_fill_arg
+ *   DESCRIPTION: Change the first argument passed to a screen's line
+ *                callbacks, as when the screen is to show a new maze.
+ *   INPUTS: scr -- the screen
+ *           fill_arg -- the new argument
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void set_screen_fill_arg(screen_t* scr, void* fill_arg) {
+    scr->fill_arg = fill_arg;
+}
+
+/*
+ * set_mode_X
+ *   DESCRIPTION: Puts the VGA into mode X, showing a given screen.
+ *   INPUTS: scr, horiz_fill_fn, vert_fill_fn, fill_arg -- as for
+ *                  init_screen
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: initializes the logical view window; maps video memory
+ *                 and obtains permission for VGA ports; clears video memory
+ */
+int set_mode_X(screen_t* scr,
+               void (*horiz_fill_fn)(void*, int, int, unsigned char[SCROLL_X_DIM]),
+               void (*vert_fill_fn)(void*, int, int, unsigned char[SCROLL_Y_DIM]),
+               void* fill_arg) {
+    if (init_screen(scr, horiz_fill_fn, vert_fill_fn, fill_arg) != 0)
+        return -1;
+
     /* One display page goes at the start of video memory. */
     target_img = 0x5A0;
 
@@ -383,13 +409,13 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
 /*
  * clear_mode_X
  *   DESCRIPTION: Puts the VGA into text mode 3 (color text).
- *   INPUTS: none
+ *   INPUTS: scr -- the screen
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: restores font data to video memory; clears screens;
  *                 unmaps video memory; checks memory fence integrity
  */
-void clear_mode_X() {
+void clear_mode_X(screen_t* scr) {
     /* loop index for checking memory fence */
     int i;
 
@@ -401,13 +427,13 @@ void clear_mode_X() {
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        if (build[i] != MEM_FENCE_MAGIC) {
+        if (scr->build[i] != MEM_FENCE_MAGIC) {
             puts("lower build fence was broken");
             break;
         }
     }
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        if (build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] != MEM_FENCE_MAGIC) {
+        if (scr->build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] != MEM_FENCE_MAGIC) {
             puts("upper build fence was broken");
             break;
         }
@@ -423,13 +449,14 @@ void clear_mode_X() {
  *                window that are within the new screen to the appropriate
  *                new location, so only data not previously on the screen
  *                must be drawn before calling show_screen.
- *   INPUTS: (scr_x,scr_y) -- new upper left pixel of logical view window
+ *   INPUTS: scr -- the screen
+ *           (scr_x,scr_y) -- new upper left pixel of logical view window
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: may shift position of logical view window within build
  *                 buffer
  */
-void set_view_window(int scr_x, int scr_y) {
+void set_view_window(screen_t* scr, int scr_x, int scr_y) {
     int old_x, old_y;       /* old position of logical view window           */
     int start_x, start_y;   /* starting position for copying from old to new */
     int end_x, end_y;       /* ending position for copying from old to new   */
@@ -441,19 +468,19 @@ void set_view_window(int scr_x, int scr_y) {
     unsigned char* target_addr; /* destination memory address for copy */
 
     /* Record the old position. */
-    old_x = show_x;
-    old_y = show_y;
+    old_x = scr->show_x;
+    old_y = scr->show_y;
 
     /* Keep track of the new view window. */
-    show_x = scr_x;
-    show_y = scr_y;
+    scr->show_x = scr_x;
+    scr->show_y = scr_y;
 
     /*
      * If the new view window fits within the boundaries of the build
      * buffer, we need move nothing around.
      */
-    if (img3_off + (scr_x >> 2) + scr_y * SCROLL_X_WIDTH >= 0 &&
-        img3_off + 3 * SCROLL_SIZE +
+    if (scr->img3_off + (scr_x >> 2) + scr_y * SCROLL_X_WIDTH >= 0 &&
+        scr->img3_off + 3 * SCROLL_SIZE +
         ((scr_x + SCROLL_X_DIM - 1) >> 2) +
         (scr_y + SCROLL_Y_DIM - 1) * SCROLL_X_WIDTH < BUILD_BUF_SIZE)
         return;
@@ -465,8 +492,8 @@ void set_view_window(int scr_x, int scr_y) {
      */
     if (scr_x <= old_x - SCROLL_X_DIM || scr_x >= old_x + SCROLL_X_DIM ||
         scr_y <= old_y - SCROLL_Y_DIM || scr_y >= old_y + SCROLL_Y_DIM) {
-        img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
-        img3 = build + img3_off + MEM_FENCE_WIDTH;
+        scr->img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
+        scr->img3 = scr->build + scr->img3_off + MEM_FENCE_WIDTH;
         return;
     }
 
@@ -507,11 +534,11 @@ void set_view_window(int scr_x, int scr_y) {
      * offset plus one (plus the three screens in between planes 3 and 0).
      */
     start_off = (start_x >> 2) + start_y * SCROLL_X_WIDTH;
-    start_addr = img3 + start_off;
+    start_addr = scr->img3 + start_off;
     length = (end_x >> 2) + end_y * SCROLL_X_WIDTH + 1 - start_off + 3 * SCROLL_SIZE;
-    img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-    target_addr = img3 + start_off;
+    scr->img3_off = BUILD_BASE_INIT - (scr->show_x >> 2) - scr->show_y * SCROLL_X_WIDTH;
+    scr->img3 = scr->build + scr->img3_off + MEM_FENCE_WIDTH;
+    target_addr = scr->img3 + start_off;
 
     /*
      * Copy the relevant portion of the screen from the old location to the
@@ -529,13 +556,13 @@ void set_view_window(int scr_x, int scr_y) {
 /*
  * show_screen
  *   DESCRIPTION: Show the logical view window on the video display.
- *   INPUTS: none
+ *   INPUTS: scr -- the screen
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: copies from the build buffer to video memory;
  *                 shifts the VGA display source to point to the new image
  */
-void show_screen() {
+void show_screen(screen_t* scr) {
     unsigned char* addr;    /* source address for copy             */
     int p_off;              /* plane offset of first display plane */
     int i;                  /* loop index over video planes        */
@@ -545,7 +572,7 @@ void show_screen() {
      * Calculate offset of build buffer plane to be mapped into plane 0
      * of display.
      */
-    p_off = (3 - (show_x & 3));
+    p_off = (3 - (scr->show_x & 3));
 
 
     /* Switch to the other target screen in video memory. */
@@ -553,7 +580,7 @@ void show_screen() {
     else target_img = 0x6000;
 
     /* Calculate the source address. */
-    addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+    addr = scr->img3 + (scr->show_x >> 2) + scr->show_y * SCROLL_X_WIDTH;
 
     /* Draw to each plane in the video memory. */
     for (i = 0; i < 4; i++) {
@@ -634,47 +661,44 @@ void clear_screens() {
  *   DESCRIPTION: Draw a BLOCK_X_DIM x BLOCK_Y_DIM block at absolute
  *                coordinates.  Mask any portion of the block not inside
  *                the logical view window.
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           blk -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM])
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
-void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
+void draw_full_block(screen_t* scr, int pos_x, int pos_y, unsigned char* blk) {
     int dx, dy;          /* loop indices for x and y traversal of block */
+    int i;               /* loop index over pixels of a row in a plane  */
+    unsigned char* dst;  /* build buffer address of a pixel             */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + BLOCK_X_DIM <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + BLOCK_Y_DIM <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0;
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
         x_right = BLOCK_X_DIM;
     /* Skip the first x_left pixels in both screen position and block data. */
     pos_x += x_left;
     blk += x_left;
 
-    /*
-     * Adjust x_right to hold the number of pixels to be drawn, and x_left
-     * to hold the amount to skip between rows in the block, which is the
-     * sum of the original left clip and (BLOCK_X_DIM - the original right
-     * clip).
-     */
+    /* Adjust x_right to hold the number of pixels to be drawn. */
     x_right -= x_left;
-    x_left = BLOCK_X_DIM - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
         y_bottom = BLOCK_Y_DIM;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -685,13 +709,18 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
     /* Adjust y_bottom to hold the number of pixel rows to be drawn. */
     y_bottom -= y_top;
 
-    /* Draw the clipped image. */
-    for (dy = 0; dy < y_bottom; dy++, pos_y++) {
-        for (dx = 0; dx < x_right; dx++, pos_x++, blk++)
-            *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
-            (3 - (pos_x & 3)) * SCROLL_SIZE) = *blk;
-        pos_x -= x_right;
-        blk += x_left;
+    /* 
+     * Draw the clipped image.  Every fourth pixel of a row lies in the
+     * same plane at consecutive addresses, so each row is copied one
+     * plane at a time.
+     */
+    for (dy = 0; dy < y_bottom; dy++, pos_y++, blk += BLOCK_X_DIM) {
+        for (dx = 0; dx < x_right && dx < 4; dx++) {
+            dst = scr->img3 + ((pos_x + dx) >> 2) + pos_y * SCROLL_X_WIDTH +
+                  (3 - ((pos_x + dx) & 3)) * SCROLL_SIZE;
+            for (i = dx; i < x_right; i += 4)
+                *dst++ = blk[i];
+        }
     }
 }
 
@@ -699,7 +728,8 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
  * draw_player_block
  *   DESCRIPTION: Draw a BLOCK_X_DIM x BLOCK_Y_DIM block at absolute
  *                coordinates.  Mask any portion of the block that's not 1
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           blk -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM])
  *           mask - mask data for block that should be copied as a C array of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM]
@@ -707,21 +737,21 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
-void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char * mask) {
+void draw_player_block(screen_t* scr, int pos_x, int pos_y, unsigned char * blk, unsigned char * mask) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + BLOCK_X_DIM <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + BLOCK_Y_DIM <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0;
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
         x_right = BLOCK_X_DIM;
     /* Skip the first x_left pixels in both screen position and block data. */
     pos_x += x_left;
@@ -737,10 +767,10 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
     x_left = BLOCK_X_DIM - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
         y_bottom = BLOCK_Y_DIM;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -756,7 +786,7 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
         for (dx = 0; dx < x_right; dx++, pos_x++, blk++)
             // check if the mask bit is 1, if so, copy. else do not
             if(mask[dy * BLOCK_X_DIM + dx] == 1) {
-                *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
+                *(scr->img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
                 (3 - (pos_x & 3)) * SCROLL_SIZE) = *blk;
             }
         pos_x -= x_right;
@@ -769,28 +799,29 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
 /*
  * store_background
  *   DESCRIPTION: save the background image into the buffer
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           buffer -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM])
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
- void store_background(int pos_x, int pos_y, unsigned char * buffer) {
+ void store_background(screen_t* scr, int pos_x, int pos_y, unsigned char * buffer) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + BLOCK_X_DIM <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + BLOCK_Y_DIM <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0;
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > BLOCK_X_DIM)
         x_right = BLOCK_X_DIM;
     /* Skip the first x_left pixels in both screen position and block data. */
     pos_x += x_left;
@@ -805,10 +836,10 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
     x_left = BLOCK_X_DIM - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
         y_bottom = BLOCK_Y_DIM;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -822,7 +853,7 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
     for (dy = 0; dy < y_bottom; dy++, pos_y++) {
         for (dx = 0; dx < x_right; dx++, pos_x++){
             // copy into the buffer of each pixel of that block in the original image
-            buffer[dy * BLOCK_X_DIM + dx] = *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH + (3 - (pos_x & 3)) * SCROLL_SIZE);
+            buffer[dy * BLOCK_X_DIM + dx] = *(scr->img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH + (3 - (pos_x & 3)) * SCROLL_SIZE);
         }
         pos_x -= x_right;
     }
@@ -833,7 +864,8 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
  * draw_floating_text
  *   DESCRIPTION: Draw a float_length x FONT_HEIGHT block at absolute
  *                coordinates.  Mask any portion of the block that's not 1
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           blk -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [float_length][FONT_HEIGHT])
  *           mask - mask data for block that should be copied as a C array of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM]
@@ -841,28 +873,28 @@ void draw_player_block(int pos_x, int pos_y, unsigned char * blk, unsigned char
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
-void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned char * background) {
+void draw_floating_text(screen_t* scr, int pos_x, int pos_y, unsigned char * mask, unsigned char * background) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     /*edge case for when the player goes to the top of the screen*/
-    if(pos_y < show_y) {
-        pos_y = show_y;
+    if(pos_y < scr->show_y) {
+        pos_y = scr->show_y;
     }
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + float_length <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + FONT_HEIGHT <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + float_length <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + FONT_HEIGHT <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0; 
     
     
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > float_length)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > float_length)
         x_right = float_length;
     
     
@@ -883,10 +915,10 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
     x_left = float_length - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
         y_bottom = FONT_HEIGHT;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -904,7 +936,7 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
             if(*mask == 1) {
                 transparent_palette();
                 // check to make sure the color doesn't go over 63
-                 *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
+                 *(scr->img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
                 (3 - (pos_x & 3)) * SCROLL_SIZE) = *background + 63;
             }
         }
@@ -918,34 +950,35 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
 /*
  * save_floating_background
  *   DESCRIPTION: save the background image into the buffer
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           buffer -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [FONT_HEIGHT][float_length])
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
- void save_floating_background(int pos_x, int pos_y, unsigned char * buffer) {
+ void save_floating_background(screen_t* scr, int pos_x, int pos_y, unsigned char * buffer) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     // if it's at the top of the screen, save from the top of the screen
-    if(pos_y < show_y) {
-        pos_y = show_y;
+    if(pos_y < scr->show_y) {
+        pos_y = scr->show_y;
     }
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + float_length <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + FONT_HEIGHT <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + float_length <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + FONT_HEIGHT <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0;    
     
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > float_length)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > float_length)
         x_right = float_length;
     
     /* Skip the first x_left pixels in both screen position and block data. */
@@ -961,10 +994,10 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
     x_left = float_length - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
         y_bottom = FONT_HEIGHT;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -979,7 +1012,7 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
     for (dy = 0; dy < y_bottom; dy++, pos_y++) {
         for (dx = 0; dx < x_right; dx++, pos_x++, buffer++){
             // copy into the buffer of each pixel of that block in the original image
-            *buffer = *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH + (3 - (pos_x & 3)) * SCROLL_SIZE);
+            *buffer = *(scr->img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH + (3 - (pos_x & 3)) * SCROLL_SIZE);
         }
         pos_x -= x_right;
         buffer += x_left;
@@ -990,7 +1023,8 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
  * redraw_floating_background
  *   DESCRIPTION: Draw a float_length x FONT_HEIGHT block at absolute
  *                coordinates.  Mask any portion of the block that's not 1
- *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   INPUTS: scr -- the screen
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
  *           blk -- image data for block (one byte per pixel, as a C array
  *                  of dimensions [FONT_HEIGHT][float_length])
  *           mask - mask data for block that should be copied as a C array of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM]
@@ -998,27 +1032,27 @@ void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned cha
  *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
-void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk) {
+void redraw_floating_background(screen_t* scr, int pos_x, int pos_y, unsigned char * blk) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
 
     /*redraw starting at the top of the screen*/
-    if(pos_y < show_y) {
-        pos_y = show_y;
+    if(pos_y < scr->show_y) {
+        pos_y = scr->show_y;
     }
 
     /* If block is completely off-screen, we do nothing. */
-    if (pos_x + float_length <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-        pos_y + FONT_HEIGHT <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+    if (pos_x + float_length <= scr->show_x || pos_x >= scr->show_x + SCROLL_X_DIM ||
+        pos_y + FONT_HEIGHT <= scr->show_y || pos_y >= scr->show_y + SCROLL_Y_DIM)
         return;
 
     /* Clip any pixels falling off the left side of screen. */
-    if ((x_left = show_x - pos_x) < 0)
+    if ((x_left = scr->show_x - pos_x) < 0)
         x_left = 0;
     
     /* Clip any pixels falling off the right side of screen. */
-    if ((x_right = show_x + SCROLL_X_DIM - pos_x) > float_length)
+    if ((x_right = scr->show_x + SCROLL_X_DIM - pos_x) > float_length)
         x_right = float_length;
     /* Skip the first x_left pixels in both screen position and block data. */
     pos_x += x_left;
@@ -1034,10 +1068,10 @@ void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk) {
     x_left = float_length - x_right;
 
     /* Clip any pixels falling off the top of the screen. */
-    if ((y_top = show_y - pos_y) < 0)
+    if ((y_top = scr->show_y - pos_y) < 0)
         y_top = 0;
     /* Clip any pixels falling off the bottom of the screen. */
-    if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
+    if ((y_bottom = scr->show_y + SCROLL_Y_DIM - pos_y) > FONT_HEIGHT)
         y_bottom = FONT_HEIGHT;
     /*
      * Skip the first y_left pixel in screen position and the first
@@ -1052,7 +1086,7 @@ void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk) {
     for (dy = 0; dy < y_bottom; dy++, pos_y++) {
         for (dx = 0; dx < x_right; dx++, pos_x++, blk++){
             /*write stuff here*/
-            *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
+            *(scr->img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
             (3 - (pos_x & 3)) * SCROLL_SIZE) = *blk;
         }
         pos_x -= x_right;
@@ -1074,7 +1108,8 @@ void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk) {
  *   DESCRIPTION: Draw a vertical map line into the build buffer.  The
  *                line should be offset from the left side of the logical
  *                view window screen by the given number of pixels.
- *   INPUTS: x -- the 0-based pixel column number of the line to be drawn
+ *   INPUTS: scr -- the screen
+ *           x -- the 0-based pixel column number of the line to be drawn
  *                within the logical view window (equivalent to the number
  *                of pixels from the leftmost pixel to the line to be
  *                drawn)
@@ -1083,7 +1118,7 @@ void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk) {
  *                 SCROLL range, the function returns -1.
  *   SIDE EFFECTS: draws into the build buffer
  */
-int draw_vert_line(int x) {
+int draw_vert_line(screen_t* scr, int x) {
     /* to be written... */
 
     unsigned char buf[SCROLL_Y_DIM];    /* buffer for graphical image of line */
@@ -1097,13 +1132,13 @@ int draw_vert_line(int x) {
         return -1;
 
     /* Adjust x to the logical column value. */
-    x += show_x;
+    x += scr->show_x;
 
     /* Get the image of the line. */
-    (*vert_line_fn) (x, show_y, buf);
+    (*scr->vert_line_fn) (scr->fill_arg, x, scr->show_y, buf);
 
     /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH;
+    addr = scr->img3 + (x >> 2) + scr->show_y * SCROLL_X_WIDTH;
 
     /* Calculate plane offset of first pixel. */
     p_off = (3 - (x & 3));
@@ -1124,7 +1159,8 @@ int draw_vert_line(int x) {
  *   DESCRIPTION: Draw a horizontal map line into the build buffer.  The
  *                line should be offset from the top of the logical view
  *                window screen by the given number of pixels.
- *   INPUTS: y -- the 0-based pixel row number of the line to be drawn
+ *   INPUTS: scr -- the screen
+ *           y -- the 0-based pixel row number of the line to be drawn
  *                within the logical view window (equivalent to the number
  *                of pixels from the top pixel to the line to be drawn)
  *   OUTPUTS: none
@@ -1132,28 +1168,47 @@ int draw_vert_line(int x) {
  *                 SCROLL range, the function returns -1.
  *   SIDE EFFECTS: draws into the build buffer
  */
-int draw_horiz_line(int y) {
+int draw_horiz_line(screen_t* scr, int y) {
     unsigned char buf[SCROLL_X_DIM];    /* buffer for graphical image of line */
-    unsigned char* addr;                /* address of first pixel in build    */
-                                        /*     buffer (without plane offset)  */
-    int p_off;                          /* offset of plane of first pixel     */
-    int i;                              /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
         return -1;
 
-    /* Adjust y to the logical row value. */
-    y += show_y;
+    /* Get the image of the line and copy it into the build buffer. */
+    (*scr->horiz_line_fn) (scr->fill_arg, scr->show_x, y + scr->show_y, buf);
+    copy_horiz_line(scr, y, buf);
 
-    /* Get the image of the line. */
-    (*horiz_line_fn) (show_x, y, buf);
+    /* Return success. */
+    return 0;
+}
+
+/*
+ * copy_horiz_line
+ *   DESCRIPTION: Copy the image of a horizontal line into the planes of
+ *                the build buffer.
+ *   INPUTS: scr -- the screen
+ *           y -- the 0-based pixel row number of the line within the
+ *                logical view window; must be valid
+ *           buf -- image of the line
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void copy_horiz_line(screen_t* scr, int y, unsigned char buf[SCROLL_X_DIM]) {
+    unsigned char* addr;                /* address of first pixel in build    */
+                                        /*     buffer (without plane offset)  */
+    int p_off;                          /* offset of plane of first pixel     */
+    int i;                              /* loop index over pixels             */
+
+    /* Adjust y to the logical row value. */
+    y += scr->show_y;
 
     /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+    addr = scr->img3 + (scr->show_x >> 2) + y * SCROLL_X_WIDTH;
 
     /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+    p_off = (3 - (scr->show_x & 3));
 
     /* Copy image data into appropriate planes in build buffer. */
     for (i = 0; i < SCROLL_X_DIM; i++) {
@@ -1163,9 +1218,6 @@ int draw_horiz_line(int y) {
             addr++;
         }
     }
-
-    /* Return success. */
-    return 0;
 }
 
 #endif /* !defined(TEXT_RESTORE_PROGRAM) */
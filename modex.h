@@ -57,6 +57,30 @@
 #define FONT_HEIGHT     16                      /*height of the font according to text.h*/
 #define FONT_WIDTH      8                       /*width of the font according to text.h*/
 
+/* build buffer sizes (see modex.c) */
+#define SCROLL_SIZE     (SCROLL_X_WIDTH * SCROLL_Y_DIM)
+#define SCREEN_SIZE     (SCROLL_SIZE * 4 + 1)
+#define BUILD_BUF_SIZE  (SCREEN_SIZE + 20000)
+#ifndef NDEBUG
+#define MEM_FENCE_WIDTH 256
+#else
+#define MEM_FENCE_WIDTH 0
+#endif
+
+/* 
+ * a logical view window and the build buffer in which its image is drawn;
+ * the line callbacks supply images of lines of the logical space
+ */
+typedef struct {
+    unsigned char build[BUILD_BUF_SIZE + 2 * MEM_FENCE_WIDTH];
+    int img3_off;               /* offset of upper left pixel       */
+    unsigned char* img3;        /* pointer to upper left pixel      */
+    int show_x, show_y;         /* logical view coordinates         */
+    void (*horiz_line_fn)(void*, int, int, unsigned char[SCROLL_X_DIM]);
+    void (*vert_line_fn)(void*, int, int, unsigned char[SCROLL_Y_DIM]);
+    void* fill_arg;             /* first argument of line callbacks */
+} screen_t;
+
 
 /*
  * NOTES
@@ -109,19 +133,29 @@
  * is drawn.  Other data are left untouched in most cases.
  */
 
-/* configure VGA for mode X; initializes logical view to (0,0) */
-extern int set_mode_X(
-        void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-        void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]));
+/* prepare a screen for drawing; initializes logical view to (0,0) */
+extern int init_screen(screen_t* scr,
+        void (*horiz_fill_fn)(void*, int, int, unsigned char[SCROLL_X_DIM]),
+        void (*vert_fill_fn)(void*, int, int, unsigned char[SCROLL_Y_DIM]),
+        void* fill_arg);
+
+/* change the first argument of a screen's line callbacks */
+extern void set_screen_fill_arg(screen_t* scr, void* fill_arg);
+
+/* configure VGA for mode X and prepare the screen it shows (see init_screen) */
+extern int set_mode_X(screen_t* scr,
+        void (*horiz_fill_fn)(void*, int, int, unsigned char[SCROLL_X_DIM]),
+        void (*vert_fill_fn)(void*, int, int, unsigned char[SCROLL_Y_DIM]),
+        void* fill_arg);
 
 /* return to text mode */
-extern void clear_mode_X();
+extern void clear_mode_X(screen_t* scr);
 
 /* set logical view window coordinates */
-extern void set_view_window(int scr_x, int scr_y);
+extern void set_view_window(screen_t* scr, int scr_x, int scr_y);
 
 /* show the logical view window on the monitor */
-extern void show_screen();
+extern void show_screen(screen_t* scr);
 
 /* display the status bar on the monitor */
 extern void show_statusbar(char * str, int level);
@@ -134,7 +168,7 @@ extern void clear_screens();
  * (pos_x,pos_y); any part of the block outside of the logical view window
  * is clipped (cut off and not drawn)
  */
-extern void draw_full_block(int pos_x, int pos_y, unsigned char* blk);
+extern void draw_full_block(screen_t* scr, int pos_x, int pos_y, unsigned char* blk);
 
 extern void set_palette_color(int level, int time);
 
@@ -143,23 +177,23 @@ extern void set_palette_color(int level, int time);
  * (pos_x,pos_y); any part of the block outside of the mask
  * is clipped (cut off and not drawn)
  */
-extern void draw_player_block(int pos_x, int pox_y, unsigned char * blk, unsigned char * mask);
+extern void draw_player_block(screen_t* scr, int pos_x, int pox_y, unsigned char * blk, unsigned char * mask);
 
 /*
  * saves the background into the buffer
  */
-extern void store_background(int pos_x, int pox_y, unsigned char * buffer);
+extern void store_background(screen_t* scr, int pos_x, int pox_y, unsigned char * buffer);
 
 
-extern void draw_floating_text(int pos_x, int pos_y, unsigned char * mask, unsigned char * background);
-extern void redraw_floating_background(int pos_x, int pos_y, unsigned char * blk);
-extern void save_floating_background(int pos_x, int pos_y, unsigned char * buffer);
+extern void draw_floating_text(screen_t* scr, int pos_x, int pos_y, unsigned char * mask, unsigned char * background);
+extern void redraw_floating_background(screen_t* scr, int pos_x, int pos_y, unsigned char * blk);
+extern void save_floating_background(screen_t* scr, int pos_x, int pos_y, unsigned char * buffer);
 
 /* draw a horizontal line at vertical pixel y within the logical view window */
-extern int draw_horiz_line(int y);
+extern int draw_horiz_line(screen_t* scr, int y);
 
 /* draw a vertical line at horizontal pixel x within the logical view window */
-extern int draw_vert_line(int x);
+extern int draw_vert_line(screen_t* scr, int x);
 
 /*copy the status bar*/
 void copy_statusbar(unsigned char* img, unsigned short scr_addr);
@@ -0,0 +1,637 @@
+/* mtcp-core.c
+ * MTCP protocol logic shared by the tuxctl driver and the user-space
+ * tools. See mtcp-core.h. Builds in the kernel and in user space alike,
+ * so it uses nothing but the language itself.
+ */
+
+#include "mtcp-core.h"
+
+/* segments that show each hex digit on the LEDs */
+#define ZERO	0xE7
+#define ONE		0x06
+#define TWO		0xCB
+#define THREE	0x8F
+#define FOUR	0x2E
+#define FIVE	0xAD
+#define SIX		0xED
+#define SEVEN	0x86
+#define EIGHT	0xEF
+#define NINE	0xAF
+#define A		0xEE
+#define B		0x6D
+#define C		0xE1
+#define D		0x4F
+#define E		0xE9
+#define F		0xE8
+#define DECIMAL	0x10
+
+/*array of the hex values according to their ascii values*/
+static const unsigned char letters[] = {ZERO, ONE, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, A, B, C, D, E, F};
+
+/*
+ * mtcp_parser_init
+ *   DESCRIPTION: start a parser in sync, with no packet under way
+ *   INPUTS: p -- the parser
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+void
+mtcp_parser_init(mtcp_parser_t *p)
+{
+	p->pkt_len = 0;
+	p->in_sync = 1;
+	p->packets = 0;
+	p->resyncs = 0;
+	p->dropped = 0;
+}
+
+/*
+ * lose_sync
+ *   DESCRIPTION: throw away n bytes that cannot be part of a packet,
+ * 				  counting a resync the first time framing is lost
+ *   INPUTS: p -- the parser
+ *           n -- bytes thrown away
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+static void
+lose_sync(mtcp_parser_t *p, int n)
+{
+	p->dropped += n;
+	if(p->in_sync){
+		p->in_sync = 0;
+		p->resyncs++;
+	}
+}
+
+/*
+ * mtcp_parse
+ *   DESCRIPTION: feed received bytes to a parser. A byte with its high bit
+ * 				  clear always starts a packet, and the next two must have
+ * 				  it set; a byte that breaks this rule ends the packet
+ * 				  being assembled, whose bytes are dropped.
+ *   INPUTS: p -- the parser
+ *           buf, n -- the bytes
+ *   OUTPUTS: pkts -- the packets completed, in order
+ *   RETURN VALUE: number of packets completed
+ */
+int
+mtcp_parse(mtcp_parser_t *p, const unsigned char *buf, int n,
+	   unsigned char pkts[][MTCP_PKT_LEN])
+{
+	int n_pkts = 0;
+	unsigned char c;
+	int i;
+
+	while(n-- > 0){
+		c = *buf++;
+		if(!(c & MTCP_PKT_FRAME)){
+			/* Start of a packet; one in progress is cut short. */
+			if(p->pkt_len > 0)
+				lose_sync(p, p->pkt_len);
+			p->pkt[0] = c;
+			p->pkt_len = 1;
+		}else if(p->pkt_len == 0){
+			/* Not inside a packet: skip to the next start. */
+			lose_sync(p, 1);
+		}else{
+			p->pkt[p->pkt_len++] = c;
+			if(p->pkt_len == MTCP_PKT_LEN){
+				for(i = 0; i < MTCP_PKT_LEN; i++)
+					pkts[n_pkts][i] = p->pkt[i];
+				n_pkts++;
+				p->pkt_len = 0;
+				p->in_sync = 1;
+			}
+		}
+	}
+	p->packets += n_pkts;
+	return n_pkts;
+}
+
+/*
+ * mtcp_buttons
+ *   DESCRIPTION: creates the integer returned by TUX_BUTTONS from the data
+ * 				  bytes of a button packet: active high, with
+ * 				  | right | left | down | up | C | B | A | START | in bits 7:0
+ *   INPUTS: b -- second byte of the packet (C, B, A, START, active low)
+ *           c -- third byte of the packet (right, down, left, up, active low)
+ *   OUTPUTS:
+ *   RETURN VALUE: the buttons
+ */
+unsigned long
+mtcp_buttons(unsigned b, unsigned c)
+{
+	unsigned buttons = ~b & 0x0F;
+	unsigned dirs = ~c & 0x0F;
+
+	// check if left and down are different
+	if(((dirs >> 1) & 1) ^ ((dirs >> 2) & 1)) {
+		// then swap
+		dirs ^= 0x06;
+	}
+	return buttons | (dirs << 4);
+}
+
+/*
+ * mtcp_button_bytes
+ *   DESCRIPTION: the reverse of mtcp_buttons, for sending button packets
+ *   INPUTS: buttons -- the buttons, as returned by TUX_BUTTONS
+ *   OUTPUTS: b, c -- second and third bytes of the packet
+ *   RETURN VALUE:
+ */
+void
+mtcp_button_bytes(unsigned long buttons, unsigned char *b, unsigned char *c)
+{
+	unsigned dirs = (buttons >> 4) & 0x0F;
+
+	if(((dirs >> 1) & 1) ^ ((dirs >> 2) & 1))
+		dirs ^= 0x06;
+	*b = MTCP_PKT_FRAME | (~buttons & 0x0F);
+	*c = MTCP_PKT_FRAME | (~dirs & 0x0F);
+}
+
+/*
+ * mtcp_led_segments
+ *   DESCRIPTION: turns a TUX_SET_LED argument into segments. The low 16
+ * 				  bits are the digits, LED0 in bits 3:0; bits 19:16 turn
+ * 				  LEDs on and bits 27:24 turn on decimal points, each for
+ * 				  LED3 down to LED0 (bit 16 and bit 24 are LED3)
+ *   INPUTS: arg -- the TUX_SET_LED argument
+ *   OUTPUTS: seg -- segments of LED0 to LED3
+ *   RETURN VALUE:
+ */
+void
+mtcp_led_segments(unsigned long arg, unsigned char *seg)
+{
+	int i;
+
+	for(i = 0; i < 4; i++) {
+		seg[i] = letters[(arg >> (4 * i)) & 0xF];
+		if(!((arg >> (19 - i)) & 1))
+			seg[i] = 0x0;
+		if((arg >> (27 - i)) & 1)
+			seg[i] += DECIMAL;
+	}
+}
+
+/*
+ * mtcp_led_value
+ *   DESCRIPTION: turns the segments of the four LEDs back into a
+ * 				  TUX_SET_LED argument. A blank LED is reported as off, and
+ * 				  so is one whose segments are not a hex digit (its
+ * 				  decimal point is still reported).
+ *   INPUTS: seg -- segments of LED0 to LED3
+ *   OUTPUTS:
+ *   RETURN VALUE: the display in the form taken by TUX_SET_LED
+ */
+unsigned long
+mtcp_led_value(const unsigned char *seg)
+{
+	unsigned long value = 0;
+	int i;
+	int num;
+
+	for(i = 0; i < 4; i++) {
+		unsigned char let = seg[i] & ~DECIMAL;
+		if(seg[i] & DECIMAL)
+			value |= 1UL << (27 - i);			// decimal points in bits 27:24
+		for(num = 0; num < 16; num++) {
+			if(letters[num] == let)
+				break;
+		}
+		if(num == 16)
+			continue;
+		value |= (unsigned long)num << (4 * i);	// digits in bits 15:0
+		value |= 1UL << (19 - i);				// LEDs on in bits 19:16
+	}
+	return value;
+}
+
+/*
+ * mtcp_led_cmd
+ *   DESCRIPTION: builds the MTCP_LED_SET command for all four LEDs
+ *   INPUTS: seg -- segments of LED0 to LED3
+ *   OUTPUTS: cmd -- the command
+ *   RETURN VALUE: length of the command
+ */
+int
+mtcp_led_cmd(const unsigned char *seg, unsigned char *cmd)
+{
+	int i;
+
+	cmd[0] = MTCP_LED_SET;
+	cmd[1] = 0x0F;								// all four LEDs follow
+	for(i = 0; i < 4; i++)
+		cmd[2 + i] = seg[i];
+	return MTCP_CMD_MAX;
+}
+
+/*
+ * mtcp_init_cmd
+ *   DESCRIPTION: builds the commands that turn on button interrupt on
+ * 				  change and put the LEDs in user mode
+ *   INPUTS:
+ *   OUTPUTS: cmd -- the commands
+ *   RETURN VALUE: their length
+ */
+int
+mtcp_init_cmd(unsigned char *cmd)
+{
+	cmd[0] = MTCP_BIOC_ON;						// button interrupt on change is on
+	cmd[1] = MTCP_LED_USR;						// led display into user mode
+	return 2;
+}
+
+/*
+ * mtcp_led_init
+ *   DESCRIPTION: start with the LEDs unknown and no command in flight
+ *   INPUTS: led -- the LED state
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+void
+mtcp_led_init(mtcp_led_t *led)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		led->seg[i] = 0;
+	led->value = 0;
+	led->valid = 0;
+	led->poll_half = 0;
+	led->in_flight = 0;
+	led->sent = 0;
+	led->pending = 0;
+	led->unacked = 0;
+	led->ahead = 0;
+}
+
+/*
+ * mtcp_led_set
+ *   DESCRIPTION: saves a new value for the LEDs, pending until it is sent,
+ * 				  which is now unless a command is in flight and has not
+ * 				  timed out (replacing any value already waiting). A
+ * 				  command that timed out lost its MTCP_ACK, or one of those
+ * 				  before it, so the ACKs expected up to its own are
+ * 				  forgotten with it.
+ *   INPUTS: led -- the LED state
+ *           arg -- the TUX_SET_LED argument
+ *           now -- the time
+ *           timeout -- how long an MTCP_ACK is waited for
+ *   OUTPUTS:
+ *   RETURN VALUE: 1 if mtcp_led_cmd(led->seg) should be sent now, 0 if
+ * 				   it waits
+ */
+int
+mtcp_led_set(mtcp_led_t *led, unsigned long arg, unsigned long now,
+	     unsigned long timeout)
+{
+	mtcp_led_segments(arg, led->seg);
+	led->value = arg & 0x0F0FFFFF;
+	led->valid = 1;
+	led->pending = 1;
+	if(!led->in_flight)
+		return 1;
+	if((long)(now - (led->sent + timeout)) < 0)
+		return 0;
+	led->in_flight = 0;
+	led->unacked -= led->ahead + 1;
+	led->ahead = 0;
+	return 1;
+}
+
+/*
+ * cmd_len
+ *   DESCRIPTION: finds the length of a command from its first two bytes
+ *   INPUTS: cmd -- the command
+ *   OUTPUTS:
+ *   RETURN VALUE: its length
+ */
+static int
+cmd_len(const unsigned char *cmd)
+{
+	unsigned mask;
+	int n;
+
+	switch(cmd[0]){
+	case MTCP_LED_SET:
+		// one byte for each LED in the mask
+		for(mask = cmd[1] & 0x0F, n = 2; mask != 0; mask >>= 1)
+			n += mask & 1;
+		return n;
+	case MTCP_CLK_SET:
+	case MTCP_CLK_MAX:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * cmd_acked
+ *   DESCRIPTION: checks whether the controller answers a command with
+ * 				  MTCP_ACK; the polls are answered with their data, and
+ * 				  MTCP_RESET_DEV and MTCP_OFF with an event
+ *   INPUTS: c -- the command's opcode
+ *   OUTPUTS:
+ *   RETURN VALUE: 1 if it is ACKed, else 0
+ */
+static int
+cmd_acked(unsigned c)
+{
+	switch(c){
+	case MTCP_POLL:
+	case MTCP_POLL_LEDS:
+	case MTCP_CLK_POLL:
+	case MTCP_RESET_DEV:
+	case MTCP_OFF:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * mtcp_led_queued
+ *   DESCRIPTION: records commands queued for the controller: counts those
+ * 				  answered by MTCP_ACK, and an MTCP_LED_SET among them
+ * 				  becomes the command in flight, carrying any pending
+ * 				  value, behind the ACKs expected before it
+ *   INPUTS: led -- the LED state
+ *           cmd, n -- the commands, one after another
+ *           now -- the time
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+void
+mtcp_led_queued(mtcp_led_t *led, const unsigned char *cmd, int n,
+		unsigned long now)
+{
+	int len;
+
+	for(; n > 0; cmd += len, n -= len){
+		len = cmd_len(cmd);
+		if(!cmd_acked(cmd[0]))
+			continue;
+		if(cmd[0] == MTCP_LED_SET){
+			led->in_flight = 1;
+			led->sent = now;
+			led->pending = 0;
+			led->ahead = led->unacked;
+		}
+		led->unacked++;
+	}
+}
+
+/*
+ * mtcp_led_ack
+ *   DESCRIPTION: an MTCP_ACK answers the oldest command that expects one;
+ * 				  it ends the LED command in flight only once the ACKs of
+ * 				  the commands queued before it have arrived
+ *   INPUTS: led -- the LED state
+ *   OUTPUTS:
+ *   RETURN VALUE: 1 if the pending value should be sent now, else 0
+ */
+int
+mtcp_led_ack(mtcp_led_t *led)
+{
+	if(led->unacked > 0)
+		led->unacked--;
+	if(led->in_flight){
+		if(led->ahead > 0){
+			led->ahead--;
+			return 0;
+		}
+		led->in_flight = 0;
+	}
+	return led->pending;
+}
+
+/*
+ * mtcp_led_replay
+ *   DESCRIPTION: after a controller reset, forget the commands it will
+ * 				  never ACK, and mark the known value (if any) to be sent
+ * 				  again on the next ACK
+ *   INPUTS: led -- the LED state
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+void
+mtcp_led_replay(mtcp_led_t *led)
+{
+	led->in_flight = 0;
+	led->unacked = 0;
+	led->ahead = 0;
+	led->pending = led->valid;
+}
+
+/*
+ * mtcp_led_busy
+ *   DESCRIPTION: check whether the newest value is still on its way
+ *   INPUTS: led -- the LED state
+ *   OUTPUTS:
+ *   RETURN VALUE: 1 if a command is in flight or a value is pending, else 0
+ */
+int
+mtcp_led_busy(const mtcp_led_t *led)
+{
+	return (led->in_flight || led->pending);
+}
+
+/*
+ * mtcp_led_poll_reply
+ *   DESCRIPTION: handles one of the two packets that answer
+ * 				  MTCP_POLL_LEDS. The first holds LED0 and LED1 and is kept
+ * 				  until the second, with LED2 and LED3, arrives; then the
+ * 				  LED state is refilled, unless a command is in flight or
+ * 				  pending, which makes the reply stale. A second packet
+ * 				  without a first (one was lost) is ignored.
+ *   INPUTS: led -- the LED state
+ *           pkt -- the packet
+ *   OUTPUTS:
+ *   RETURN VALUE: 1 if the LED state was refilled, else 0
+ */
+int
+mtcp_led_poll_reply(mtcp_led_t *led, const unsigned char *pkt)
+{
+	unsigned a = pkt[0];
+	unsigned char seg0;
+	unsigned char seg1;
+
+	// segment A of each LED is in the opcode; bit 7 of the data is always set
+	seg0 = (pkt[1] & 0x7F) | ((a & 0x1) ? 0x80 : 0);
+	seg1 = (pkt[2] & 0x7F) | ((a & 0x2) ? 0x80 : 0);
+
+	if((a & ~0x3) == MTCP_LEDS_POLL0) {
+		led->poll_seg[0] = seg0;
+		led->poll_seg[1] = seg1;
+		led->poll_half = 1;
+		return 0;
+	}
+	if(!led->poll_half)
+		return 0;
+	led->poll_half = 0;
+	if(mtcp_led_busy(led))
+		return 0;
+	led->seg[0] = led->poll_seg[0];
+	led->seg[1] = led->poll_seg[1];
+	led->seg[2] = seg0;
+	led->seg[3] = seg1;
+	led->value = mtcp_led_value(led->seg);
+	led->valid = 1;
+	return 1;
+}
+
+/*
+ * clk_cmd
+ *   DESCRIPTION: builds the commands that set the clock to a value, start
+ * 				  it counting up if it should run, and show it
+ *   INPUTS: secs -- the value, in seconds
+ *           running -- whether it counts
+ *   OUTPUTS: cmd -- the commands
+ *   RETURN VALUE: their length
+ */
+static int
+clk_cmd(unsigned long secs, int running, unsigned char *cmd)
+{
+	int n = 0;
+
+	cmd[n++] = MTCP_CLK_SET;
+	cmd[n++] = secs / 60;						// minutes
+	cmd[n++] = secs % 60;						// seconds
+	if(running) {
+		cmd[n++] = MTCP_CLK_UP;
+		cmd[n++] = MTCP_CLK_RUN;
+	}
+	cmd[n++] = MTCP_LED_CLK;					// led display into clock mode
+	return n;
+}
+
+/*
+ * mtcp_clk_init
+ *   DESCRIPTION: start with the clock stopped at zero and not shown
+ *   INPUTS: clk -- the clock state
+ *   OUTPUTS:
+ *   RETURN VALUE:
+ */
+void
+mtcp_clk_init(mtcp_clk_t *clk)
+{
+	clk->shown = 0;
+	clk->running = 0;
+	clk->secs = 0;
+	clk->start = 0;
+}
+
+/*
+ * mtcp_clk_secs
+ *   DESCRIPTION: finds the seconds on the clock at a time, stopping at
+ * 				  the most it can show
+ *   INPUTS: clk -- the clock state
+ *           now -- the time
+ *           hz -- time units in a second
+ *   OUTPUTS:
+ *   RETURN VALUE: the seconds on the clock
+ */
+unsigned long
+mtcp_clk_secs(const mtcp_clk_t *clk, unsigned long now, unsigned long hz)
+{
+	unsigned long secs = clk->secs;
+
+	if(clk->running)
+		secs += (now - clk->start) / hz;
+	return (secs > MTCP_CLK_SECS_MAX ? MTCP_CLK_SECS_MAX : secs);
+}
+
+/*
+ * mtcp_clk_start
+ *   DESCRIPTION: sets the clock and starts it counting up, on the LEDs
+ *   INPUTS: clk -- the clock state
+ *           secs -- the seconds to count from
+ *           now -- the time
+ *   OUTPUTS: cmd -- the commands
+ *   RETURN VALUE: their length
+ */
+int
+mtcp_clk_start(mtcp_clk_t *clk, unsigned long secs, unsigned long now,
+	       unsigned char *cmd)
+{
+	clk->shown = 1;
+	clk->running = 1;
+	clk->secs = (secs > MTCP_CLK_SECS_MAX ? MTCP_CLK_SECS_MAX : secs);
+	clk->start = now;
+	return clk_cmd(clk->secs, 1, cmd);
+}
+
+/*
+ * mtcp_clk_stop
+ *   DESCRIPTION: stops the clock at its value
+ *   INPUTS: clk -- the clock state
+ *           now -- the time
+ *           hz -- time units in a second
+ *   OUTPUTS: cmd -- the command
+ *   RETURN VALUE: its length
+ */
+int
+mtcp_clk_stop(mtcp_clk_t *clk, unsigned long now, unsigned long hz,
+	      unsigned char *cmd)
+{
+	clk->secs = mtcp_clk_secs(clk, now, hz);
+	clk->running = 0;
+	cmd[0] = MTCP_CLK_STOP;
+	return 1;
+}
+
+/*
+ * mtcp_clk_reset
+ *   DESCRIPTION: stops the clock at zero (which also sets it counting
+ * 				  down, until it is next started)
+ *   INPUTS: clk -- the clock state
+ *   OUTPUTS: cmd -- the command
+ *   RETURN VALUE: its length
+ */
+int
+mtcp_clk_reset(mtcp_clk_t *clk, unsigned char *cmd)
+{
+	clk->secs = 0;
+	clk->running = 0;
+	cmd[0] = MTCP_CLK_RESET;
+	return 1;
+}
+
+/*
+ * mtcp_clk_user
+ *   DESCRIPTION: leaves clock mode, so the LEDs show what MTCP_LED_SET set
+ *   INPUTS: clk -- the clock state
+ *   OUTPUTS: cmd -- the command
+ *   RETURN VALUE: its length, or 0 if the clock was not shown
+ */
+int
+mtcp_clk_user(mtcp_clk_t *clk, unsigned char *cmd)
+{
+	if(!clk->shown)
+		return 0;
+	clk->shown = 0;
+	cmd[0] = MTCP_LED_USR;
+	return 1;
+}
+
+/*
+ * mtcp_clk_restore
+ *   DESCRIPTION: builds the commands that set a reset controller's clock
+ * 				  back to where it would be, and show it again
+ *   INPUTS: clk -- the clock state
+ *           now -- the time
+ *           hz -- time units in a second
+ *   OUTPUTS: cmd -- the commands
+ *   RETURN VALUE: their length, or 0 if the clock is not shown
+ */
+int
+mtcp_clk_restore(const mtcp_clk_t *clk, unsigned long now, unsigned long hz,
+		 unsigned char *cmd)
+{
+	if(!clk->shown)
+		return 0;
+	return clk_cmd(mtcp_clk_secs(clk, now, hz), clk->running, cmd);
+}
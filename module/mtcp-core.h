@@ -0,0 +1,164 @@
+/* mtcp-core.h
+ * The MTCP protocol logic of the tuxctl driver, kept free of the kernel so
+ * that the same code builds into the module and into user-space tools (the
+ * controller emulator and its benchmark): packet framing, the encodings of
+ * the buttons and the LEDs, the flow control of LED commands, with its
+ * replay after a controller reset, and the controller's clock.
+ *
+ * Nothing here allocates, sleeps, locks, or reads a clock. Callers hold
+ * their own locks around each structure and pass the time in, in any unit
+ * (jiffies in the driver), as an unsigned long that may wrap.
+ */
+
+#ifndef MTCP_CORE_H
+#define MTCP_CORE_H
+
+#include "mtcp.h"
+
+/* Responses are three bytes; only the first has its high bit clear. */
+#define MTCP_PKT_LEN 3
+#define MTCP_PKT_FRAME 0x80
+/* The longest command: MTCP_LED_SET with all four LEDs */
+#define MTCP_CMD_MAX 6
+
+/* Packet parser state, resumed by each call of mtcp_parse() */
+typedef struct mtcp_parser {
+	unsigned char pkt[MTCP_PKT_LEN];	/* packet being assembled */
+	int pkt_len;				/* bytes of it so far */
+	int in_sync;		/* 0 while skipping bytes to find a packet */
+	unsigned long packets;	/* packets completed */
+	unsigned long resyncs;	/* times framing was lost */
+	unsigned long dropped;	/* bytes thrown away to regain it */
+} mtcp_parser_t;
+
+/* The LEDs as the driver knows them, and the LED command in flight.
+ * seg[] holds the segment bytes of LED0 to LED3 (the arguments of
+ * MTCP_LED_SET), and value the same display as a TUX_SET_LED argument.
+ */
+typedef struct mtcp_led {
+	unsigned char seg[4];		/* segments of each LED */
+	unsigned long value;		/* the display as a TUX_SET_LED argument */
+	int valid;			/* set once a value has been set or polled */
+	unsigned char poll_seg[2];	/* LED0 and LED1 from the first poll packet */
+	int poll_half;			/* poll_seg waits for the second packet */
+	int in_flight;			/* a command waits for its MTCP_ACK */
+	unsigned long sent;		/* time it was sent */
+	int pending;			/* seg waits to be sent */
+	unsigned long unacked;		/* commands queued that an MTCP_ACK answers */
+	unsigned long ahead;		/* those queued before the one in flight */
+} mtcp_led_t;
+
+/* The controller's clock, as the driver last set it. While shown, the LEDs
+ * show the clock (MTCP_LED_CLK) instead of seg[], and the controller
+ * counts the seconds itself. secs is the value when the clock was set or
+ * stopped, and start the time it was set running.
+ */
+typedef struct mtcp_clk {
+	int shown;		/* the LEDs are in clock mode */
+	int running;		/* the clock counts up from secs */
+	unsigned long secs;	/* seconds on the clock */
+	unsigned long start;	/* time it started counting from secs */
+} mtcp_clk_t;
+
+/* The most the clock shows: 99 minutes, 59 seconds */
+#define MTCP_CLK_SECS_MAX (99 * 60 + 59)
+
+/* mtcp_parser_init()
+ * Start a parser in sync, with no packet under way and no counts.
+ */
+extern void mtcp_parser_init(mtcp_parser_t *p);
+
+/* mtcp_parse()
+ * Feed n received bytes to a parser, which resumes where the previous
+ * bytes left off, and copy the packets completed to pkts (which must have
+ * room for n / MTCP_PKT_LEN + 1). Returns the number of packets.
+ */
+extern int mtcp_parse(mtcp_parser_t *p, const unsigned char *buf, int n,
+		      unsigned char pkts[][MTCP_PKT_LEN]);
+
+/* mtcp_buttons()
+ * Turn the two data bytes of MTCP_BIOC_EVENT or MTCP_POLL_OK into the
+ * value returned by TUX_BUTTONS. mtcp_button_bytes() does the reverse.
+ */
+extern unsigned long mtcp_buttons(unsigned b, unsigned c);
+extern void mtcp_button_bytes(unsigned long buttons, unsigned char *b,
+			      unsigned char *c);
+
+/* mtcp_led_segments()
+ * Turn a TUX_SET_LED argument into the segments of LED0 to LED3.
+ * mtcp_led_value() does the reverse, for the digits that are a hex digit.
+ */
+extern void mtcp_led_segments(unsigned long arg, unsigned char *seg);
+extern unsigned long mtcp_led_value(const unsigned char *seg);
+
+/* mtcp_led_cmd()
+ * Write the MTCP_LED_SET command that shows seg[] to cmd. Returns its
+ * length (MTCP_CMD_MAX).
+ */
+extern int mtcp_led_cmd(const unsigned char *seg, unsigned char *cmd);
+
+/* mtcp_init_cmd()
+ * Write the commands that put a controller in the state the driver
+ * expects (buttons interrupt on change, LEDs in user mode) to cmd.
+ * Returns their length.
+ */
+extern int mtcp_init_cmd(unsigned char *cmd);
+
+/* LED flow control. One LED command is out at a time. mtcp_led_set()
+ * records a new value, pending until it is sent, and returns 1 if the
+ * caller should send mtcp_led_cmd(led->seg) now, or 0 if it waits behind
+ * the command in flight (which is given up on timeout after it was sent).
+ * Every command actually queued for the controller, LED or not, is
+ * reported with mtcp_led_queued(), which counts those answered by
+ * MTCP_ACK, so that the ACK of the LED command can be told from those of
+ * the commands queued before it. mtcp_led_ack() handles an MTCP_ACK and
+ * returns 1 if the pending value should be sent now. mtcp_led_replay()
+ * forgets the commands the controller lost when it reset, and marks the
+ * value to be sent again.
+ */
+extern void mtcp_led_init(mtcp_led_t *led);
+extern int mtcp_led_set(mtcp_led_t *led, unsigned long arg, unsigned long now,
+			unsigned long timeout);
+extern void mtcp_led_queued(mtcp_led_t *led, const unsigned char *cmd, int n,
+			    unsigned long now);
+extern int mtcp_led_ack(mtcp_led_t *led);
+extern void mtcp_led_replay(mtcp_led_t *led);
+extern int mtcp_led_busy(const mtcp_led_t *led);
+
+/* mtcp_led_poll_reply()
+ * Handle a packet answering MTCP_POLL_LEDS (opcode MTCP_LEDS_POLL0 or
+ * MTCP_LEDS_POLL1 with data in its low two bits). Returns 1 if the packet
+ * completed a reply that changed led->seg and led->value, else 0.
+ */
+extern int mtcp_led_poll_reply(mtcp_led_t *led, const unsigned char *pkt);
+
+/* The clock. Each of these records the change in clk and writes the
+ * commands that make it to cmd (which must have room for MTCP_CMD_MAX
+ * bytes), returning their length. mtcp_clk_start() sets the clock to
+ * secs, counts up from there and shows it; mtcp_clk_stop() stops it where
+ * it is; mtcp_clk_reset() stops it at zero; mtcp_clk_user() puts the LEDs
+ * back in user mode, if the clock was shown (else it returns 0).
+ * mtcp_clk_restore() changes nothing, and writes the commands that bring
+ * the clock back after the controller has reset (none if it is not
+ * shown). mtcp_clk_secs() finds the seconds on the clock at a time, given
+ * the number of time units in a second.
+ */
+extern void mtcp_clk_init(mtcp_clk_t *clk);
+extern unsigned long mtcp_clk_secs(const mtcp_clk_t *clk, unsigned long now,
+				   unsigned long hz);
+extern int mtcp_clk_start(mtcp_clk_t *clk, unsigned long secs,
+			  unsigned long now, unsigned char *cmd);
+extern int mtcp_clk_stop(mtcp_clk_t *clk, unsigned long now, unsigned long hz,
+			 unsigned char *cmd);
+extern int mtcp_clk_reset(mtcp_clk_t *clk, unsigned char *cmd);
+extern int mtcp_clk_user(mtcp_clk_t *clk, unsigned char *cmd);
+extern int mtcp_clk_restore(const mtcp_clk_t *clk, unsigned long now,
+			    unsigned long hz, unsigned char *cmd);
+
+/* mtcp_is_leds_poll()
+ * Check whether an opcode is one of the two packets of MTCP_LEDS_POLL.
+ */
+#define mtcp_is_leds_poll(a) \
+	(((a) & ~0x3) == MTCP_LEDS_POLL0 || ((a) & ~0x3) == MTCP_LEDS_POLL1)
+
+#endif
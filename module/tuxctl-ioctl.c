@@ -21,71 +21,276 @@
 #include <linux/kdev_t.h>
 #include <linux/tty.h>
 #include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <asm/div64.h>
 
 #include "tuxctl-ld.h"
 #include "tuxctl-ioctl.h"
 #include "mtcp.h"
+#include "mtcp-core.h"
 
 #define debug(str, ...) \
 	printk(KERN_DEBUG "%s: " str, __FUNCTION__, ## __VA_ARGS__)
 
 
-/*hex values for the ASCII that can be put on the LEDs*/
-#define ZERO	0xE7
-#define ONE		0x06
-#define TWO		0xCB
-#define THREE	0x8F
-#define FOUR	0x2E
-#define FIVE	0xAD
-#define SIX		0xED
-#define SEVEN	0x86
-#define EIGHT	0xEF
-#define NINE	0xAF
-#define A		0xEE
-#define B		0x6D
-#define C		0xE1
-#define D		0x4F
-#define E		0xE9
-#define F		0xE8
-#define DECIMAL	0x10
-
-/*array of the hex values according to their ascii values*/
-static unsigned char letters[] = {ZERO, ONE, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, A, B, C, D, E, F};
-static void set_buttons(int buttons, int dirs);		/*helper function */
-int the_buttons;								/*global variable for the buttons integer*/
-int reset_state = 0;							/*checking which reset_state it's at*/
-char save_led[6];								/*saving the current LED*/
+static int send_led(struct tty_struct* tty, tuxctl_dev_t* dev, mtcp_led_t* led);	/*helper function */
+static void publish_state(struct tty_struct* tty, tuxctl_dev_t* dev);	/*helper function */
+static int send_clk(struct tty_struct* tty, tuxctl_dev_t* dev, const mtcp_clk_t* clk,
+		    const unsigned char* buffer, int n);	/*helper function */
+static int build_batch(struct tux_cmd* cmds, int n, unsigned long now, unsigned char* buffer,
+			int* len, mtcp_led_t* led, mtcp_clk_t* clk);	/*helper function */
+static unsigned long long now_ns(void);	/*helper function */
+static int packet_type(unsigned a);	/*helper function */
+static void count_ack(tuxctl_dev_t* dev);	/*helper function */
 
+/*
+ * Each controller has its own tuxctl_dev_t (see tuxctl-ld.h), kept with
+ * the line discipline's data for its tty, so controllers on different
+ * serial ports never share state.  Its lock guards the buttons and the
+ * LEDs, and is taken with interrupts off, as the packet handler runs in
+ * interrupt context.
+ *
+ * dev->led is what the LEDs show, and the LED command in flight (see
+ * mtcp-core.h).  TUX_READ_LED answers from it and never has to ask the
+ * controller:
+ * TUX_SET_LED fills it in when it sends a value, and the two packets that
+ * answer MTCP_POLL_LEDS (sent by TUX_LED_REQUEST) refill it from the
+ * controller when they arrive.
+ *
+ * LED commands are sent one at a time: once an MTCP_LED_SET is out, the
+ * next one waits for the controller's MTCP_ACK.  TUX_SET_LED saves its
+ * value once it is queued, and while a command is in flight it only marks
+ * the value as pending, so a burst of updates never queues more than one
+ * command and the display always ends on the newest value.  The other
+ * commands the driver sends are ACKed too, so each one queued is counted
+ * in dev->led, and only the ACK that answers the MTCP_LED_SET ends it.  An
+ * ACK that never arrives (a lost byte) is given up on after
+ * LED_ACK_TIMEOUT.
+ */
+#define LED_ACK_TIMEOUT	(HZ / 10)
+
+/*
+ * TUX_CLK_START puts the LEDs in clock mode and lets the controller count
+ * the seconds itself, so a timer display costs nothing on the serial line
+ * while it runs.  dev->clk remembers how the clock was set (see
+ * mtcp-core.h): TUX_CLK_STOP and TUX_CLK_RESET change it, TUX_SET_LED and
+ * TUX_INIT leave clock mode, and a controller that resets is given its
+ * clock back, at the value it would have reached.
+ */
+
+/*
+ * TUX_BATCH runs several of the ioctls above in one call: their commands
+ * are built on copies of dev->led and dev->clk, queued with one hold of
+ * the tx lock and one wakeup of the serial driver, and the copies are kept
+ * for the commands that fit.  The longest command in a batch is a
+ * TUX_SET_LED that leaves clock mode: MTCP_LED_USR, then MTCP_LED_SET.
+ */
+#define BATCH_CMD_MAX	(MTCP_CMD_MAX + 1)
+
+/*
+ * dev->stats counts the packets handled, by type, the controller's resets,
+ * and the time from each LED command to its MTCP_ACK (see tuxctl-ld.h;
+ * the line discipline counts the bytes).  The time is taken from when the
+ * command is queued, so it includes the wait in the tx ring.
+ */
+
+
+/*
+ * send_led
+ *   DESCRIPTION: helper function that sends a saved LED value to the
+ * 				  controller as one MTCP_LED_SET command and marks it as in
+ * 				  flight; if the tx buffer is full, the value stays
+ * 				  pending. Must be called with dev->lock held.
+ *   INPUTS: tty -- the controller's tty
+ *           dev -- its state
+ *           led -- the LED state to send (dev->led, or a copy of it)
+ *   OUTPUTS: 
+ *   RETURN VALUE: 0 if the command was queued, -EAGAIN if the tx buffer
+ * 				   had no room for it
+ */
+static int send_led(struct tty_struct* tty, tuxctl_dev_t* dev, mtcp_led_t* led) {
+	unsigned char buffer[MTCP_CMD_MAX];
+	int n = mtcp_led_cmd(led->seg, buffer);
+
+	if(tuxctl_ldisc_put_packet(tty, buffer, n) != 0)
+		return -EAGAIN;
+	mtcp_led_queued(led, buffer, n, jiffies);
+	dev->stats.led_sent_ns = now_ns();
+	return 0;
+}
+
+/*
+ * send_clk
+ *   DESCRIPTION: helper function that sends clock commands, and keeps the
+ * 				  new clock state only if they were queued. Must be called
+ * 				  with dev->lock held.
+ *   INPUTS: tty -- the controller's tty
+ *           dev -- its state
+ *           clk -- the clock state after the commands
+ *           buffer -- the commands
+ *           n -- their length
+ *   OUTPUTS: 
+ *   RETURN VALUE: 0 if the commands were queued, -EAGAIN if the tx buffer
+ * 				   had no room for them
+ */
+static int send_clk(struct tty_struct* tty, tuxctl_dev_t* dev, const mtcp_clk_t* clk,
+		    const unsigned char* buffer, int n) {
+	if(tuxctl_ldisc_put_packet(tty, buffer, n) != 0)
+		return -EAGAIN;
+	dev->clk = *clk;
+	mtcp_led_queued(&dev->led, buffer, n, jiffies);
+	return 0;
+}
+
+/*
+ * now_ns
+ *   DESCRIPTION: helper function that reads the monotonic clock
+ *   INPUTS: 
+ *   OUTPUTS: 
+ *   RETURN VALUE: the time in nanoseconds
+ */
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
 
 /*
- * set_buttons
- *   DESCRIPTION: helper function that creates the integer value for the arg to point
- * 				  to when TUX_BUTTONS is called
- *   INPUTS: buttons -- integer value that holds which button is pressed
- *           dirs -- intever value that holds which dir buttons is pressed
+ * packet_type
+ *   DESCRIPTION: helper function that finds which count of dev->stats a
+ * 				  packet goes in
+ *   INPUTS: a -- the first byte of the packet
+ *   OUTPUTS: 
+ *   RETURN VALUE: one of TUXCTL_PKT_*
+ */
+static int packet_type(unsigned a) {
+	if(mtcp_is_leds_poll(a))
+		return TUXCTL_PKT_LEDS_POLL;
+	switch(a) {
+	case MTCP_ACK: return TUXCTL_PKT_ACK;
+	case MTCP_BIOC_EVENT: return TUXCTL_PKT_BIOC_EVENT;
+	case MTCP_CLK_EVENT: return TUXCTL_PKT_CLK_EVENT;
+	case MTCP_OFF_EVENT: return TUXCTL_PKT_OFF_EVENT;
+	case MTCP_POLL_OK: return TUXCTL_PKT_POLL_OK;
+	case MCTP_CLK_POLL: return TUXCTL_PKT_CLK_POLL;
+	case MTCP_RESET: return TUXCTL_PKT_RESET;
+	case MTCP_ERROR: return TUXCTL_PKT_ERROR;
+	default: return TUXCTL_PKT_OTHER;
+	}
+}
+
+/*
+ * count_ack
+ *   DESCRIPTION: helper function that counts the round trip of the LED
+ * 				  command that an MTCP_ACK ends, if it answers the one in
+ * 				  flight, in the histogram of dev->stats. Must be called with
+ * 				  dev->lock held, before the ACK is handed to dev->led.
+ *   INPUTS: dev -- the controller's state
+ *   OUTPUTS: 
+ *   RETURN VALUE: 
+ */
+static void count_ack(tuxctl_dev_t* dev) {
+	unsigned long long ns;
+	int bucket;
+
+	if(!dev->led.in_flight || dev->led.ahead != 0)
+		return;
+	ns = now_ns() - dev->stats.led_sent_ns;
+	do_div(ns, 1000000);						// whole milliseconds
+	bucket = (ns >= (1 << (TUXCTL_ACK_BUCKETS - 2)) ? TUXCTL_ACK_BUCKETS - 1 : fls((int)ns));
+	dev->stats.acks[bucket]++;
+}
+
+/*
+ * tuxctl_trace_packet
+ *   DESCRIPTION: trace hook for packets from the controller; see
+ * 				  tuxctl-ld.h. The barrier keeps the compiler from
+ * 				  dropping the empty call.
+ *   INPUTS: tty -- the controller's tty
+ *           packet -- the packet
  *   OUTPUTS: 
  *   RETURN VALUE: 
  */
-static void set_buttons(int buttons, int dirs) {
-	int number = 0;
-	// active low so not 
-	buttons = ~buttons;
-	dirs = ~dirs;
-
-	number = 0x0F & buttons;
-	
-	// check if left and down are different
-	if(((dirs >> 1) & 1) ^ ((dirs >> 2) & 1)) {
-		// then swap
-		dirs = (dirs ^ 0x02);
-		dirs = (dirs ^ 0x04); 
+noinline void tuxctl_trace_packet(struct tty_struct* tty, const unsigned char* packet) {
+	barrier();
+}
+
+/*
+ * build_batch
+ *   DESCRIPTION: helper function that builds the commands of a batch, in
+ * 				  order, changing the LED and clock state given as each
+ * 				  ioctl would. Must be called with dev->lock held, on
+ * 				  copies of dev->led and dev->clk.
+ *   INPUTS: cmds -- the batch
+ *           n -- its length
+ *           now -- the time
+ *           led, clk -- the LED and clock state before the batch
+ *   OUTPUTS: cmds -- status of each command: 0, or -EINVAL if it is not
+ * 					  one that a batch takes
+ *            buffer -- the bytes of the commands, one after another
+ *            len -- bytes of each command (0 if it sends nothing now)
+ *            led, clk -- the state after the batch
+ *   RETURN VALUE: 1 if an MTCP_LED_SET was built, else 0
+ */
+static int build_batch(struct tux_cmd* cmds, int n, unsigned long now, unsigned char* buffer,
+			int* len, mtcp_led_t* led, mtcp_clk_t* clk) {
+	int led_sent = 0;
+	int i;
+
+	for(i = 0; i < n; i++) {
+		unsigned char* p = buffer;
+		cmds[i].status = 0;
+		switch(cmds[i].cmd) {
+		case TUX_INIT:
+			p += mtcp_init_cmd(p);
+			clk->shown = 0;
+			break;
+		case TUX_SET_LED:
+			p += mtcp_clk_user(clk, p);
+			if(mtcp_led_set(led, cmds[i].arg, now, LED_ACK_TIMEOUT)) {
+				p += mtcp_led_cmd(led->seg, p);
+				led_sent = 1;
+			}
+			break;
+		case TUX_LED_REQUEST:
+			*p++ = MTCP_POLL_LEDS;
+			break;
+		case TUX_CLK_START:
+			p += mtcp_clk_start(clk, cmds[i].arg, now, p);
+			break;
+		case TUX_CLK_STOP:
+			p += mtcp_clk_stop(clk, now, HZ, p);
+			break;
+		case TUX_CLK_RESET:
+			p += mtcp_clk_reset(clk, p);
+			break;
+		default:
+			cmds[i].status = -EINVAL;
+			break;
+		}
+		mtcp_led_queued(led, buffer, p - buffer, now);
+		len[i] = p - buffer;
+		buffer = p;
 	}
-	// bit shift left four times 
-	dirs = dirs << 4;
-	// or with the number
-	number = number | dirs;	
+	return led_sent;
+}
 
-	the_buttons = number;
+/*
+ * publish_state
+ *   DESCRIPTION: helper function that copies the buttons and the LED value
+ * 				  to the controller's shared state page. Must be called
+ * 				  with dev->lock held, so the two are copied together.
+ *   INPUTS: tty -- the controller's tty
+ *           dev -- its state
+ *   OUTPUTS: 
+ *   RETURN VALUE: 
+ */
+static void publish_state(struct tty_struct* tty, tuxctl_dev_t* dev) {
+	tuxctl_ldisc_publish(tty, dev->buttons, dev->led.value);
 }
 
 
@@ -99,37 +304,68 @@ static void set_buttons(int buttons, int dirs) {
 void tuxctl_handle_packet (struct tty_struct* tty, unsigned char* packet)
 {
     unsigned a, b, c;
+    tuxctl_dev_t* dev;
+
+    if(0 == (dev = tuxctl_ldisc_dev(tty)))
+        return;
 
     a = packet[0]; /* Avoid printk() sign extending the 8-bit */
     b = packet[1]; /* values when printing them. */
     c = packet[2];
 
-	/*for reset = waiting for the ACK to set MTCP_LED_USR and return the old LED*/
-	if(MTCP_ACK){
-		if(reset_state == 1) {
-			unsigned char buffer[1];
-			buffer[0] = MTCP_LED_USR;
-			tuxctl_ldisc_put(tty, buffer, 1);
-			reset_state = 2;
-		}
-		else if(reset_state == 2) {
-			tuxctl_ldisc_put(tty, save_led, 6);
-			reset_state = 0;
-		}
+	tuxctl_trace_packet(tty, packet);
+	dev->stats.packets[packet_type(a)]++;
+
+	/* an ACK ends the command in flight; send the newest LED value if one is waiting */
+	if(a == MTCP_ACK) {
+		unsigned long flags;
+		spin_lock_irqsave(&dev->lock, flags);
+		count_ack(dev);
+		if(mtcp_led_ack(&dev->led))
+			(void)send_led(tty, dev, &dev->led);
+		spin_unlock_irqrestore(&dev->lock, flags);
 	}
 
-	/* When the reset button is pressed, set MTCP_BIOC_ON*/
+	/* When the controller resets, turn MTCP_BIOC_ON and MTCP_LED_USR back on, restore the clock if it was shown, and restore the LEDs once the first is ACKed */
 	if(a == MTCP_RESET) {
-		unsigned char buffer[1];
-		buffer[0] = MTCP_BIOC_ON;
-		tuxctl_ldisc_put(tty, buffer, 1);
-		reset_state = 1;
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		int n = mtcp_init_cmd(buffer);
+		spin_lock_irqsave(&dev->lock, flags);
+		dev->stats.resets++;
+		mtcp_led_replay(&dev->led);
+		if(tuxctl_ldisc_put_packet(tty, buffer, n) == 0)
+			mtcp_led_queued(&dev->led, buffer, n, jiffies);
+		if((n = mtcp_clk_restore(&dev->clk, jiffies, HZ, buffer)) != 0 &&
+		   tuxctl_ldisc_put_packet(tty, buffer, n) == 0)
+			mtcp_led_queued(&dev->led, buffer, n, jiffies);
+		spin_unlock_irqrestore(&dev->lock, flags);
+	}
+	/* the answer to MTCP_POLL_LEDS comes in two packets; the low two bits of the opcode are data */
+	if(mtcp_is_leds_poll(a)) {
+		unsigned long flags;
+		spin_lock_irqsave(&dev->lock, flags);
+		if(mtcp_led_poll_reply(&dev->led, packet))
+			publish_state(tty, dev);
+		spin_unlock_irqrestore(&dev->lock, flags);
 	}
 	/* when a button is pressed, get the appropriate integers*/
 	if(a == MTCP_BIOC_EVENT) {
-		int buttons = b & 0x0f;
-		int dir = c & 0x0f;
-		set_buttons(buttons, dir);
+		struct tux_event ev;
+		struct timespec ts;
+		unsigned long flags;
+
+		spin_lock_irqsave(&dev->lock, flags);
+		dev->buttons = mtcp_buttons(b, c);
+		publish_state(tty, dev);
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		/* queue the change for read() and poll() */
+		ktime_get_ts(&ts);
+		ev.sec = ts.tv_sec;
+		ev.nsec = ts.tv_nsec;
+		ev.buttons = dev->buttons;
+		tuxctl_ldisc_put_event(tty, &ev);
 	}
 
     // printk("packet : %x %x %x\n", a, b, c);
@@ -152,6 +388,11 @@ int
 tuxctl_ioctl (struct tty_struct* tty, struct file* file, 
 	      unsigned cmd, unsigned long arg)
 {
+    tuxctl_dev_t* dev;
+
+    if(0 == (dev = tuxctl_ldisc_dev(tty)))
+        return -EINVAL;
+
     switch (cmd) {
 	/*initialize the TUX by setting the MTCP_BIO_ON and MTCP_LED_USR*/
 	/* TUX_INIT
@@ -162,13 +403,17 @@ tuxctl_ioctl (struct tty_struct* tty, struct file* file,
  	*              0 if successful
 	*/  
 	case TUX_INIT: {
-		unsigned char buffer[2];
-		buffer[0] = MTCP_BIOC_ON;						// button interrupt on change is on
-		buffer[1] = MTCP_LED_USR;						// led display into user mode
-		if(tuxctl_ldisc_put(tty, buffer, 2	) != 0) {
-			return -EINVAL;
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		int n = mtcp_init_cmd(buffer);
+		int ret;
+		spin_lock_irqsave(&dev->lock, flags);
+		if((ret = tuxctl_ldisc_put_packet(tty, buffer, n)) == 0) {
+			dev->clk.shown = 0;
+			mtcp_led_queued(&dev->led, buffer, n, jiffies);
 		}
-		return 0;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return ret;
 	}
 	/* TUX_BUTTONS
  	* info: send to the user the correct buttons integer
@@ -179,7 +424,7 @@ tuxctl_ioctl (struct tty_struct* tty, struct file* file,
 	*/
 	case TUX_BUTTONS: {
 		int * ptr = (int *) arg;
-		if(copy_to_user(ptr, &the_buttons, 1) != 0) {
+		if(copy_to_user(ptr, &dev->buttons, 1) != 0) {
 			return -EINVAL;
 		}
 		return 0;
@@ -191,69 +436,216 @@ tuxctl_ioctl (struct tty_struct* tty, struct file* file,
 	*		hexadecimal value is to be displayed on the 7-segment displays. The low 4 bits of the third byte
 	*		specifies which LED’s should be turned on. The low 4 bits of the highest byte (bits 27:24) specify
  	*      output: 
- 	*               -1 if invalid
- 	*              0 if successful
+ 	*               -EAGAIN if the tx buffer is full (poll() for POLLOUT and retry)
+ 	*              0 if successful (the value is sent now, or as soon as the command in flight is ACKed)
 	*/
 	case TUX_SET_LED: {
-		int temp = arg;
-		int i;
-		int j;
-		int k;
-		unsigned char buffer[6];
-
-		// set LED to on
-		buffer[0] = MTCP_LED_SET;
-		buffer[1] = 0x0F;
-
-		// check each numbers
-		for(i = 0; i < 4; i++) {
-			unsigned char let;
-			int num = temp & 0xF;
-			temp = temp >> 4;
-			let = letters[num];
-			buffer[2 + i] = let;
-		}
-		// check which leds are turned on and which are turned off
-		for(j = 0; j < 4; j++) {
-			int turn_on = temp & 0x1;
-			temp = temp >> 1;
-			if(!turn_on) {
-				buffer[5 - j] = 0x0;
-			}
-		}
-		// skip the next four bits
-		temp = temp >> 4;
-		// check which decimals are on
-		for(k = 0; k < 4; k++) {
-			int decimal_on = temp & 0x1;
-			temp = temp >> 1;
-			if(decimal_on) {
-				buffer[5 - k] += DECIMAL;
-			}
-		}	
-		// save the current state for if the reset button is pressed
-		for(i = 0; i < 6; i++) {
-			save_led[i] = buffer[i];
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		mtcp_led_t led;
+		mtcp_clk_t clk;
+		int n;
+		int ret = 0;
+
+		// leave clock mode first, if the clock is shown
+		spin_lock_irqsave(&dev->lock, flags);
+		clk = dev->clk;
+		if((n = mtcp_clk_user(&clk, buffer)) != 0 &&
+		   (ret = send_clk(tty, dev, &clk, buffer, n)) != 0) {
+			spin_unlock_irqrestore(&dev->lock, flags);
+			return ret;
 		}
 
-		if(tuxctl_ldisc_put(tty, buffer, 6) != 0) {
-			return -EINVAL;
+		// send the newest state unless a command is still in flight, and save it once it is queued
+		led = dev->led;
+		if(mtcp_led_set(&led, arg, jiffies, LED_ACK_TIMEOUT) &&
+		   (ret = send_led(tty, dev, &led)) != 0) {
+			spin_unlock_irqrestore(&dev->lock, flags);
+			return ret;
 		}
-		return 0;
+		dev->led = led;
+		publish_state(tty, dev);
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return ret;
 	}
 
+	/* TUX_LED_ACK
+ 	* info: check whether the controller has acknowledged the newest LED value
+ 	*      input: 
+ 	*      output: 
+ 	*               1 if an LED command is in flight or waiting to be sent
+ 	*              0 if the newest value has been ACKed
+	*/
 	case TUX_LED_ACK: {
-		return 0;
+		unsigned long flags;
+		int busy;
+		spin_lock_irqsave(&dev->lock, flags);
+		busy = mtcp_led_busy(&dev->led);
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return busy;
 	}
 
+	/* TUX_LED_REQUEST
+ 	* info: ask the controller what its LEDs show; the answer refreshes the value
+	*		returned by TUX_READ_LED when it arrives
+ 	*      input: 
+ 	*      output: 
+ 	*               -EAGAIN if the tx buffer is full (poll() for POLLOUT and retry)
+ 	*              0 if successful
+	*/
 	case TUX_LED_REQUEST: {
-		return 0;
+		unsigned char buffer[1];
+		buffer[0] = MTCP_POLL_LEDS;
+		return tuxctl_ldisc_put_packet(tty, buffer, 1);
 	}
 
+	/* TUX_READ_LED
+ 	* info: send to the user what the LEDs show, in the form taken by TUX_SET_LED,
+	*		from the driver's cache (no command is sent to the controller)
+ 	*      input: pointer to an unsigned long
+ 	*      output: 
+ 	*               -EINVAL if invalid
+ 	*              0 if successful
+	*/
 	case TUX_READ_LED: {
+		unsigned long * ptr = (unsigned long *) arg;
+		unsigned long value;
+		unsigned long flags;
+		spin_lock_irqsave(&dev->lock, flags);
+		value = dev->led.value;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		if(copy_to_user(ptr, &value, sizeof(value)) != 0) {
+			return -EINVAL;
+		}
 		return 0;
 	}
 
+	/* TUX_STATE_INDEX
+ 	* info: find where this controller's state page is mapped from /dev/tuxctl
+ 	*      input: 
+ 	*      output: 
+ 	*               -EINVAL if invalid
+ 	*              the page offset to pass to mmap() (in pages) if successful
+	*/
+	case TUX_STATE_INDEX: {
+		return tuxctl_ldisc_state_index(tty);
+	}
+
+	/* TUX_CLK_START
+ 	* info: set the controller's clock, start it counting up, and show it on the LEDs
+	*		(the controller counts on its own; nothing more is sent while it runs)
+ 	*      input: arg - the seconds to count from (at most 99 minutes, 59 seconds)
+ 	*      output: 
+ 	*               -EAGAIN if the tx buffer is full (poll() for POLLOUT and retry)
+ 	*              0 if successful
+	*/
+	case TUX_CLK_START: {
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		mtcp_clk_t clk;
+		int ret;
+		spin_lock_irqsave(&dev->lock, flags);
+		clk = dev->clk;
+		ret = send_clk(tty, dev, &clk, buffer, mtcp_clk_start(&clk, arg, jiffies, buffer));
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return ret;
+	}
+
+	/* TUX_CLK_STOP
+ 	* info: stop the controller's clock where it is; the LEDs stay in clock mode
+ 	*      input: 
+ 	*      output: 
+ 	*               -EAGAIN if the tx buffer is full (poll() for POLLOUT and retry)
+ 	*              0 if successful
+	*/
+	case TUX_CLK_STOP: {
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		mtcp_clk_t clk;
+		int ret;
+		spin_lock_irqsave(&dev->lock, flags);
+		clk = dev->clk;
+		ret = send_clk(tty, dev, &clk, buffer, mtcp_clk_stop(&clk, jiffies, HZ, buffer));
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return ret;
+	}
+
+	/* TUX_CLK_RESET
+ 	* info: stop the controller's clock at zero; the LEDs stay in clock mode
+ 	*      input: 
+ 	*      output: 
+ 	*               -EAGAIN if the tx buffer is full (poll() for POLLOUT and retry)
+ 	*              0 if successful
+	*/
+	case TUX_CLK_RESET: {
+		unsigned char buffer[MTCP_CMD_MAX];
+		unsigned long flags;
+		mtcp_clk_t clk;
+		int ret;
+		spin_lock_irqsave(&dev->lock, flags);
+		clk = dev->clk;
+		ret = send_clk(tty, dev, &clk, buffer, mtcp_clk_reset(&clk, buffer));
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return ret;
+	}
+
+	/* TUX_BATCH
+ 	* info: send the commands of several ioctls at once (see struct tux_batch)
+ 	*      input: arg - pointer to a struct tux_batch
+ 	*      output: the status of each command, in its struct tux_cmd
+ 	*               -EINVAL if the batch cannot be read or written back
+ 	*              the number of commands queued if successful
+	*/
+	case TUX_BATCH: {
+		struct tux_batch batch;
+		struct tux_cmd cmds[TUX_BATCH_MAX];
+		unsigned char buffer[TUX_BATCH_MAX * BATCH_CMD_MAX];
+		int len[TUX_BATCH_MAX];
+		mtcp_led_t led;
+		mtcp_clk_t clk;
+		unsigned long flags;
+		unsigned long now;
+		int i, n, sent, queued, led_sent;
+
+		if(copy_from_user(&batch, (struct tux_batch*)arg, sizeof(batch)) != 0 ||
+		   batch.n > TUX_BATCH_MAX ||
+		   copy_from_user(cmds, batch.cmds, batch.n * sizeof(cmds[0])) != 0) {
+			return -EINVAL;
+		}
+		n = batch.n;
+
+		// build every command, then queue them together
+		spin_lock_irqsave(&dev->lock, flags);
+		now = jiffies;
+		led = dev->led;
+		clk = dev->clk;
+		led_sent = build_batch(cmds, n, now, buffer, len, &led, &clk);
+		sent = tuxctl_ldisc_put_packets(tty, buffer, len, n);
+		if(sent < n) {
+			// keep only what the commands that fit did
+			led = dev->led;
+			clk = dev->clk;
+			led_sent = build_batch(cmds, sent, now, buffer, len, &led, &clk);
+		}
+		dev->led = led;
+		dev->clk = clk;
+		if(led_sent)
+			dev->stats.led_sent_ns = now_ns();
+		publish_state(tty, dev);
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		for(i = queued = 0; i < n; i++) {
+			if(i >= sent && cmds[i].status == 0)
+				cmds[i].status = -EAGAIN;
+			if(cmds[i].status == 0)
+				queued++;
+		}
+		if(copy_to_user(batch.cmds, cmds, n * sizeof(cmds[0])) != 0) {
+			return -EINVAL;
+		}
+		return queued;
+	}
+
 	default:
 	    return -EINVAL;
     }
@@ -9,6 +9,86 @@
 #define TUX_INIT _IO('E', 0x13)
 #define TUX_LED_REQUEST _IO('E', 0x14)
 #define TUX_LED_ACK _IO('E', 0x15)
+#define TUX_STATE_INDEX _IO('E', 0x16)
+#define TUX_CLK_START _IOR('E', 0x17, unsigned long)
+#define TUX_CLK_STOP _IO('E', 0x18)
+#define TUX_CLK_RESET _IO('E', 0x19)
+#define TUX_BATCH _IOWR('E', 0x1A, struct tux_batch*)
+
+/* Commands that TUX_BATCH takes at once */
+#define TUX_BATCH_MAX 16
+
+/* One command of TUX_BATCH: an ioctl that sends to the controller
+ * (TUX_INIT, TUX_SET_LED, TUX_LED_REQUEST, TUX_CLK_START, TUX_CLK_STOP or
+ * TUX_CLK_RESET) with its argument. The driver fills in status with what
+ * that ioctl would have returned.
+ */
+struct tux_cmd {
+	unsigned long cmd;	/* the ioctl */
+	unsigned long arg;	/* its argument */
+	long status;		/* 0, -EINVAL, or -EAGAIN if the tx buffer was full */
+};
+
+/* The argument of TUX_BATCH. The commands are checked, then queued in
+ * order with nothing else between them, and the controller is sent them
+ * all at once. A command that is not valid is skipped; once one does not
+ * fit in the tx buffer, neither does any after it. TUX_BATCH returns the
+ * number of commands queued, or -EINVAL if the batch cannot be read.
+ */
+struct tux_batch {
+	unsigned long n;	/* commands, at most TUX_BATCH_MAX */
+	struct tux_cmd *cmds;
+};
+
+/* A change of the buttons, as returned by read() on the controller's tty.
+ * read() returns whole events and blocks until one is available (unless
+ * the file is non-blocking); poll() reports POLLIN while events are queued.
+ * The time is from the monotonic clock (CLOCK_MONOTONIC in user space).
+ */
+struct tux_event {
+	unsigned long sec;	/* time the change arrived */
+	unsigned long nsec;
+	unsigned long buttons;	/* new buttons, as returned by TUX_BUTTONS */
+};
+
+/* The controller's state, in a page that user space can map read-only:
+ * open /dev/tuxctl and mmap() one page at offset (ioctl(tty, TUX_STATE_INDEX)
+ * times the page size). The driver updates it whenever the buttons or the
+ * LEDs change. seq is odd while an update is under way and goes up by two
+ * with each one, so a reader copies the fields between two reads of an
+ * even seq and retries if seq changed (see tux_state_read()).
+ */
+struct tux_state {
+	unsigned long seq;	/* update count, times two */
+	unsigned long buttons;	/* as returned by TUX_BUTTONS */
+	unsigned long led;	/* as returned by TUX_READ_LED */
+	unsigned long sec;	/* time of the last update (CLOCK_MONOTONIC) */
+	unsigned long nsec;
+};
+
+#ifndef __KERNEL__
+/* tux_state_read()
+ * Copy a mapped state page consistently, waiting out an update that is
+ * under way. Returns the sequence number of the copy.
+ */
+static inline unsigned long
+tux_state_read(const struct tux_state *page, struct tux_state *copy)
+{
+	unsigned long seq;
+
+	do {
+		while((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		copy->buttons = __atomic_load_n(&page->buttons, __ATOMIC_RELAXED);
+		copy->led = __atomic_load_n(&page->led, __ATOMIC_RELAXED);
+		copy->sec = __atomic_load_n(&page->sec, __ATOMIC_RELAXED);
+		copy->nsec = __atomic_load_n(&page->nsec, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while(__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+	copy->seq = seq;
+	return seq;
+}
+#endif
 
 #endif
 
@@ -11,29 +11,78 @@
 #include <linux/slab.h>
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/err.h>
+#include <asm/system.h>
+#include <asm/uaccess.h>
 
 #include <linux/init.h>
 #include "tuxctl-ld.h"
+#include "tuxctl-ioctl.h"
+#include "mtcp-core.h"
 
 #define uhoh(str, ...) printk(KERN_EMERG "%s " str, __FUNCTION__, ##__VA_ARGS__)
 #define debug(str, ...) printk(KERN_DEBUG "%s " str, __FUNCTION__,\
 							 ## __VA_ARGS__)
 
-/* Here's an interesting tidbit: tty_struct has no synchronization available
- * to us to protect against races involving the tty->disc_data field. So,
- * rather than do something tricky, we'll employ the 'one-big-freakin-lock'
- * strategy for synchronizing the methods in this file. This can't be a
- * semaphore because of the following chain of function calls:
+/* Each tty using this line discipline has its own tuxctl_ldisc_data_t, and
+ * the tty layer holds a reference to the line discipline across each call
+ * of its methods, so tty->disc_data cannot be freed under us while a
+ * method runs. All of a device's state, the driver's included (dev), is
+ * in its tuxctl_ldisc_data_t. The only lock shared between devices guards
+ * the table of open devices, and is taken just to open, close, or mmap one.
  *
- * rs_interrupt()  				(serial.c)
- *	tty_flip_buffer_push() 			(tty_io.c)
- * 		flush_to_ldisc() 		(tty_io.c)
- *			ldisc.receive_buf() 	(this file)
+ * The received bytes and the bytes to transmit are each kept in a ring
+ * with one producer and one consumer:
  *
- * Specifically, rs_interrupt is, well, an interrupt. Sleeping in an 
- * interrupt is a recipe for breaking things, so a spinlock it is.
+ *	rx: receive_buf() (from the serial interrupt) -> tuxctl_ldisc_get()
+ *	tx: tuxctl_ldisc_put(), tuxctl_ldisc_put_packet(),
+ *	    tuxctl_ldisc_put_packets() (ioctls, packet handler)
+ *	    -> write_wakeup()
+ *
+ * The producer owns the head index and the consumer owns the tail index.
+ * Both run freely and are masked when used. Each side publishes its index
+ * with a release store after touching the bytes, and reads the other
+ * side's index with an acquire load, so the two sides never wait for one
+ * another. The tx ring has two producers (ioctls and replies sent by the
+ * packet handler) and two callers of write_wakeup() (the ioctl path and
+ * the serial driver), so each end is serialized on its own: the
+ * producers by tx_put_lock, and the consumers by the TUXCTL_TX_BUSY bit,
+ * which makes a late caller leave its work to the one already sending.
+ * Neither is ever held across the other end of the ring, and nothing on
+ * the rx path takes either.
+ *
+ * Button events are queued for read() under a per-device lock, as a full
+ * queue drops its oldest event (so the producer must move the tail).
+ *
+ * read() and poll() wait on the tty's own read_wait and write_wait, as
+ * n_tty does, never on queues in tuxctl_ldisc_data_t: the tty core wakes
+ * those on hangup and when the line discipline is changed, and they
+ * outlive the data freed by close(), so neither a blocked reader nor an
+ * epoll entry is left on freed memory.
+ *
+ * Each device also has a page holding its struct tux_state, which user
+ * space maps read-only through the misc device /dev/tuxctl (at the page
+ * offset given by TUX_STATE_INDEX) to look at the buttons and LEDs
+ * without a system call. The page is updated as a seqlock whose count
+ * lives in the page itself; writers are serialized by state_lock. A
+ * mapping holds its own reference to the page, so the page outlives a
+ * device that is closed while it is mapped.
+ *
+ * The counts in dev.stats (see tuxctl-ld.h) are shown in debugfs, one file
+ * per slot of tuxctl_devs (tuxctl/0 to tuxctl/7), made when the module is
+ * loaded. A file looks its device up under tuxctl_devs_lock each time it
+ * is read, so it never holds on to a device that may be closed. The
+ * counts start from zero each time a device is opened.
  */
-static spinlock_t tuxctl_ldisc_lock = SPIN_LOCK_UNLOCKED;
 
 
 /* Line Discipline specific stuff */
@@ -49,20 +98,73 @@ static void tuxctl_ldisc_close(struct tty_struct*);
 static void tuxctl_ldisc_rcv_buf(struct tty_struct*, const unsigned char *, 
 					char *, int);
 static void tuxctl_ldisc_write_wakeup(struct tty_struct*);
+static ssize_t tuxctl_ldisc_read(struct tty_struct*, struct file*,
+				 unsigned char __user*, size_t);
+static unsigned int tuxctl_ldisc_poll(struct tty_struct*, struct file*,
+				      poll_table*);
 static void tuxctl_ldisc_data_callback(struct tty_struct *tty);
+static int tuxctl_state_mmap(struct file*, struct vm_area_struct*);
+static int tuxctl_stats_open(struct inode*, struct file*);
+static int tuxctl_stats_show(struct seq_file*, void*);
 
+/* Bytes in each of the rx and tx rings; must be a power of two. */
 #define TUXCTL_BUFSIZE 64
+/* Room in the tx ring for the longest command (MTCP_LED_SET), for POLLOUT */
+#define TUXCTL_TX_CMD_MAX 6
+#define ring_idx(i) ((i) & (TUXCTL_BUFSIZE - 1))
+
+/* tx_flags bits */
+#define TUXCTL_TX_BUSY	0	/* a caller is handing bytes to the driver */
+#define TUXCTL_TX_KICK	1	/* bytes may be waiting to be sent */
+
+/* Bytes taken from the rx ring, and packets handled, at a time */
+#define TUXCTL_PARSE_CHUNK 32
+#define TUXCTL_PARSE_BATCH (TUXCTL_PARSE_CHUNK / MTCP_PKT_LEN + 1)
+
+/* Devices that can be open at once (each has a state page to map) */
+#define TUXCTL_MAX_DEVS 8
+
+/* Button events waiting to be read; must be a power of two. */
+#define TUXCTL_EVQ_SIZE 32
+/* Events copied to the user by one pass of read() */
+#define TUXCTL_EVQ_BATCH 8
+
 typedef struct tuxctl_ldisc_data {
 	unsigned long magic;
 
+	/* rx_head - rx_tail bytes received and not yet taken */
 	char rx_buf[TUXCTL_BUFSIZE];
-	int rx_start, rx_end;
+	unsigned int rx_head, rx_tail;
 
+	/* tx_head - tx_tail bytes waiting to be sent */
 	char tx_buf[TUXCTL_BUFSIZE];
-	int tx_start, tx_end;
+	unsigned int tx_head, tx_tail;
+	spinlock_t tx_put_lock;
+	unsigned long tx_flags;
+
+	/* Packet parser, resumed by each tuxctl_ldisc_data_callback() */
+	mtcp_parser_t parser;
+
+	/* Button events for read()/poll(); ev_head - ev_tail are queued. */
+	struct tux_event evq[TUXCTL_EVQ_SIZE];
+	unsigned int ev_head, ev_tail;
+	spinlock_t ev_lock;
+	unsigned long ev_dropped;
+
+	/* The driver's state (buttons, LEDs); see tuxctl-ioctl.c */
+	tuxctl_dev_t dev;
+
+	/* Shared state page, mapped by user space; updated under state_lock */
+	struct tux_state *state;
+	spinlock_t state_lock;
+	int index;		/* slot in tuxctl_devs, the page's mmap offset */
 
 } tuxctl_ldisc_data_t;
 
+/* Open devices, by the index that selects their state page in mmap() */
+static tuxctl_ldisc_data_t *tuxctl_devs[TUXCTL_MAX_DEVS];
+static spinlock_t tuxctl_devs_lock = SPIN_LOCK_UNLOCKED;
+
 
 static struct tty_ldisc tuxctl_ldisc  = {
 	.magic = TUXCTL_MAGIC,
@@ -70,148 +172,509 @@ static struct tty_ldisc tuxctl_ldisc  = {
 	.open = tuxctl_ldisc_open,
 	.close = tuxctl_ldisc_close,
         .ioctl = tuxctl_ioctl,
+	.read = tuxctl_ldisc_read,
+	.poll = tuxctl_ldisc_poll,
 	.receive_buf = tuxctl_ldisc_rcv_buf,
 	.write_wakeup = tuxctl_ldisc_write_wakeup,
 };
 
+static const struct file_operations tuxctl_state_fops = {
+	.owner = THIS_MODULE,
+	.mmap = tuxctl_state_mmap,
+};
+
+static struct miscdevice tuxctl_state_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "tuxctl",
+	.fops = &tuxctl_state_fops,
+};
+
+static const struct file_operations tuxctl_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = tuxctl_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* debugfs directory and files; NULL (or an error) if debugfs is missing */
+static struct dentry *tuxctl_debugfs_dir;
+static struct dentry *tuxctl_debugfs_files[TUXCTL_MAX_DEVS];
+
+/* Names of the packet counts, in the order of TUXCTL_PKT_* */
+static const char *tuxctl_pkt_names[TUXCTL_PKT_TYPES] = {
+	"ack", "bioc_event", "clk_event", "off_event", "poll_ok",
+	"clk_poll", "reset", "error", "leds_poll", "other"
+};
+
 int __init
 tuxctl_ldisc_init(void)
 {
 	int err = 0;
 	if((err = tty_register_ldisc(N_MOUSE, &tuxctl_ldisc))){
 		debug("tuxctl line discipline register failed\n");
-	}else{
-		printk("tuxctl line discipline registered\n");
+		return err;
 	}
-	return err;
+	if((err = misc_register(&tuxctl_state_dev))){
+		debug("tuxctl state device register failed\n");
+		tty_unregister_ldisc(N_MOUSE);
+		return err;
+	}
+
+	/* the counts are only for looking at; go on without them on failure */
+	tuxctl_debugfs_dir = debugfs_create_dir("tuxctl", NULL);
+	if(tuxctl_debugfs_dir != 0 && !IS_ERR(tuxctl_debugfs_dir)){
+		char name[4];
+		long i;
+		for(i = 0; i < TUXCTL_MAX_DEVS; i++){
+			snprintf(name, sizeof(name), "%ld", i);
+			tuxctl_debugfs_files[i] = debugfs_create_file(name,
+				0444, tuxctl_debugfs_dir, (void *)i,
+				&tuxctl_stats_fops);
+		}
+	}
+	printk("tuxctl line discipline registered\n");
+	return 0;
 }
 module_init(tuxctl_ldisc_init);
 
 void __exit
 tuxctl_ldisc_exit(void)
 {
+	int i;
+
+	if(tuxctl_debugfs_dir != 0 && !IS_ERR(tuxctl_debugfs_dir)){
+		for(i = 0; i < TUXCTL_MAX_DEVS; i++)
+			debugfs_remove(tuxctl_debugfs_files[i]);
+		debugfs_remove(tuxctl_debugfs_dir);
+	}
+	misc_deregister(&tuxctl_state_dev);
 	tty_unregister_ldisc(N_MOUSE);
 	printk("tuxctl line discipline removed\n");
 }
 module_exit(tuxctl_ldisc_exit);
 
 
-#define buf_used(start,end) ((start) <= (end) ? \
-				  ((end) - (start))  \
-				: (TUXCTL_BUFSIZE + (end) - (start)))
+/* ring_load_acquire()
+ * Read the other side's ring index. Accesses to the ring that follow
+ * cannot be moved before the read.
+ */
+static inline unsigned int
+ring_load_acquire(unsigned int *idx)
+{
+	unsigned int v = *(volatile unsigned int *)idx;
+
+	smp_mb();
+	return v;
+}
+
+/* ring_store_release()
+ * Publish this side's ring index. Accesses to the ring that come before
+ * cannot be moved after the write.
+ */
+static inline void
+ring_store_release(unsigned int *idx, unsigned int v)
+{
+	smp_mb();
+	*(volatile unsigned int *)idx = v;
+}
+
+/* ring_copy_in()
+ * Copy n bytes into a ring at index head, in at most two pieces.
+ */
+static inline void
+ring_copy_in(char *ring, unsigned int head, const char *buf, int n)
+{
+	int first = TUXCTL_BUFSIZE - ring_idx(head);
+
+	if(first > n)
+		first = n;
+	memcpy(ring + ring_idx(head), buf, first);
+	memcpy(ring, buf + first, n - first);
+}
 
-#define buf_room(start,end) (TUXCTL_BUFSIZE - buf_used(start,end) - 1)
+/* ring_copy_out()
+ * Copy n bytes out of a ring from index tail, in at most two pieces.
+ */
+static inline void
+ring_copy_out(char *buf, const char *ring, unsigned int tail, int n)
+{
+	int first = TUXCTL_BUFSIZE - ring_idx(tail);
 
-#define buf_empty(start, end) ((start) == (end))
-#define buf_full(start, end) ((((end)+1)%TUXCTL_BUFSIZE) == (start))
-#define buf_incidx(idx) ((idx) = ((idx)+1) % TUXCTL_BUFSIZE)
+	if(first > n)
+		first = n;
+	memcpy(buf, ring + ring_idx(tail), first);
+	memcpy(buf + first, ring, n - first);
+}
 
 
 static int 
 tuxctl_ldisc_open(struct tty_struct *tty)
 {
 	tuxctl_ldisc_data_t *data;
-	unsigned long flags;
 
 	if(!(data = kmalloc(sizeof(*data), GFP_KERNEL))){
 		uhoh("kmalloc failed!\n");
 		return -ENOMEM;
 	}
+	if(!(data->state = (struct tux_state *)get_zeroed_page(GFP_KERNEL))){
+		uhoh("get_zeroed_page failed!\n");
+		kfree(data);
+		return -ENOMEM;
+	}
 	
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
-
 	data->magic = TUXCTL_MAGIC;
 
-	data->rx_start = 0;
-	data->rx_end = 0;
+	data->rx_head = 0;
+	data->rx_tail = 0;
+
+	data->tx_head = 0;
+	data->tx_tail = 0;
+	spin_lock_init(&data->tx_put_lock);
+	data->tx_flags = 0;
+
+	mtcp_parser_init(&data->parser);
+
+	data->ev_head = 0;
+	data->ev_tail = 0;
+	data->ev_dropped = 0;
+	spin_lock_init(&data->ev_lock);
+
+	spin_lock_init(&data->dev.lock);
+	data->dev.buttons = 0;
+	mtcp_led_init(&data->dev.led);
+	mtcp_clk_init(&data->dev.clk);
+	memset(&data->dev.stats, 0, sizeof(data->dev.stats));
+
+	spin_lock_init(&data->state_lock);
+	spin_lock(&tuxctl_devs_lock);
+	for(data->index = 0; data->index < TUXCTL_MAX_DEVS; data->index++)
+		if(tuxctl_devs[data->index] == 0)
+			break;
+	if(data->index < TUXCTL_MAX_DEVS)
+		tuxctl_devs[data->index] = data;
+	spin_unlock(&tuxctl_devs_lock);
+	if(data->index == TUXCTL_MAX_DEVS){
+		free_page((unsigned long)data->state);
+		kfree(data);
+		return -EBUSY;
+	}
 
-	data->tx_start = 0;
-	data->tx_end = 0;
+	/* Make the data visible before the tty can hand us bytes. */
+	smp_wmb();
 	tty->disc_data = data;
 
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
-
 	return 0;
 }
 
 static void 
 tuxctl_ldisc_close(struct tty_struct *tty)
 {
-	tuxctl_ldisc_data_t *data; 
-	unsigned long flags;
-
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
+	tuxctl_ldisc_data_t *data = tty->disc_data;
 
-	data = tty->disc_data;
+	clear_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
 	tty->disc_data = 0;
+	wake_up_interruptible(&tty->read_wait);
+	wake_up_interruptible(&tty->write_wait);
 
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
+	spin_lock(&tuxctl_devs_lock);
+	tuxctl_devs[data->index] = 0;
+	spin_unlock(&tuxctl_devs_lock);
 
+	/* Mappings of the page keep their own references to it. */
+	free_page((unsigned long)data->state);
 	kfree(data);
 }
 
+/* tuxctl_state_mmap()
+ * The mmap() method of /dev/tuxctl. Maps the state page of the device
+ * whose index (from TUX_STATE_INDEX) is the page offset, read-only, as
+ * exactly one page.
+ */
+static int
+tuxctl_state_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct page *page = 0;
+	unsigned long index = vma->vm_pgoff;
+	int err;
+
+	if(vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if(vma->vm_flags & VM_WRITE)
+		return -EACCES;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	spin_lock(&tuxctl_devs_lock);
+	if(index < TUXCTL_MAX_DEVS && tuxctl_devs[index] != 0){
+		page = virt_to_page(tuxctl_devs[index]->state);
+		get_page(page);
+	}
+	spin_unlock(&tuxctl_devs_lock);
+	if(page == 0)
+		return -ENODEV;
+
+	/* the mapping takes its own reference; drop the one taken above */
+	err = vm_insert_page(vma, vma->vm_start, page);
+	put_page(page);
+	return err;
+}
+
+
+/* tuxctl_stats_open()
+ * The open() method of a debugfs counts file; its private data is the
+ * slot of tuxctl_devs it shows.
+ */
+static int
+tuxctl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tuxctl_stats_show, inode->i_private);
+}
+
+/* tuxctl_stats_show()
+ * Print the counts of the device in one slot of tuxctl_devs, copied under
+ * tuxctl_devs_lock, or that the slot is not in use.
+ */
+static int
+tuxctl_stats_show(struct seq_file *m, void *v)
+{
+	long index = (long)m->private;
+	tuxctl_ldisc_data_t *data;
+	tuxctl_stats_t st;
+	mtcp_parser_t parser;
+	int i;
+
+	spin_lock(&tuxctl_devs_lock);
+	if(0 != (data = tuxctl_devs[index])){
+		st = data->dev.stats;
+		parser = data->parser;
+	}
+	spin_unlock(&tuxctl_devs_lock);
+	if(0 == data){
+		seq_printf(m, "closed\n");
+		return 0;
+	}
+
+	seq_printf(m, "rx_bytes %lu\n", st.rx_bytes);
+	seq_printf(m, "rx_dropped %lu\n", st.rx_dropped);
+	seq_printf(m, "tx_bytes %lu\n", st.tx_bytes);
+	seq_printf(m, "tx_high %lu/%d\n", st.tx_high, TUXCTL_BUFSIZE);
+	seq_printf(m, "tx_full %lu\n", st.tx_full);
+	seq_printf(m, "resyncs %lu (%lu bytes skipped)\n", parser.resyncs,
+		   parser.dropped);
+	seq_printf(m, "resets %lu\n", st.resets);
+	for(i = 0; i < TUXCTL_PKT_TYPES; i++)
+		seq_printf(m, "packets.%s %lu\n", tuxctl_pkt_names[i],
+			   st.packets[i]);
+	seq_printf(m, "ack_ms.0-1 %lu\n", st.acks[0]);
+	for(i = 1; i < TUXCTL_ACK_BUCKETS - 1; i++)
+		seq_printf(m, "ack_ms.%d-%d %lu\n", 1 << (i - 1), 1 << i,
+			   st.acks[i]);
+	seq_printf(m, "ack_ms.%d- %lu\n", 1 << (i - 1), st.acks[i]);
+	return 0;
+}
 
 /* tuxctl_ldisc_rcv_buf
  * The receive_buf() method of our line discipline. It receives count bytes
  * from cp. fp points to some flag/error bytes which I conveniently ignore. 
  * This is called when there are bytes received from the serial driver, and
- * is called from an interrupt handler.
+ * is called from an interrupt handler. It is the only producer of the rx
+ * ring, and its consumer runs here too: the bytes are copied in as much
+ * as fits at a time, and the ring is drained after each copy, so any count
+ * is taken in one call. Bytes are only dropped if a drain leaves no room.
  */
 static void 
 tuxctl_ldisc_rcv_buf(struct tty_struct *tty, const unsigned char *cp, 
 			char *fp, int count)
 {
-	int call = 0, c=0;
-	unsigned long flags;
 	tuxctl_ldisc_data_t *data;
-
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
-	if(0 != (data = tty->disc_data)){
-		call = 1;
-
-		while(count-- > 0 && !buf_full(data->rx_start, data->rx_end)) {
-			data->rx_buf[data->rx_end] = *cp++;
-			buf_incidx(data->rx_end);
-			c++;
+	unsigned int head;
+	int room, n;
+
+	if(0 == (data = tty->disc_data))
+		return;
+
+	data->dev.stats.rx_bytes += count;
+	while(count > 0){
+		head = data->rx_head;
+		room = TUXCTL_BUFSIZE - (head - ring_load_acquire(&data->rx_tail));
+		if(room == 0){
+			data->dev.stats.rx_dropped += count;
+			break;
 		}
-	}
-
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
+		n = (count < room ? count : room);
+		ring_copy_in(data->rx_buf, head, (const char *)cp, n);
+		ring_store_release(&data->rx_head, head + n);
+		cp += n;
+		count -= n;
 
-	if(call){
 		tuxctl_ldisc_data_callback(tty);
 	}
 }
 
+/* tuxctl_ldisc_tx_segments()
+ * Hand the waiting tx bytes to the tty driver straight from the ring, as
+ * one or two contiguous pieces, stopping when the driver takes less than
+ * it was given. Wakes pollers waiting for room, and asks the driver for a
+ * write_wakeup() while bytes remain.
+ * Must be called only by the owner of TUXCTL_TX_BUSY.
+ */
+static void
+tuxctl_ldisc_tx_segments(struct tty_struct *tty, tuxctl_ldisc_data_t *data)
+{
+	unsigned int tail = data->tx_tail;
+	unsigned int head = ring_load_acquire(&data->tx_head);
+	int len, sent;
+
+	while(head != tail){
+		len = head - tail;
+		if(len > TUXCTL_BUFSIZE - ring_idx(tail))
+			len = TUXCTL_BUFSIZE - ring_idx(tail);
+		sent = tty->driver->write(tty, (const unsigned char *)
+					  data->tx_buf + ring_idx(tail), len);
+		if(sent <= 0)
+			break;
+		tail += sent;
+		data->dev.stats.tx_bytes += sent;
+		if(sent < len)
+			break;
+	}
+	if(tail != data->tx_tail){
+		ring_store_release(&data->tx_tail, tail);
+		wake_up_interruptible(&tty->write_wait);
+	}
+
+	if(head != tail)
+		set_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
+	else
+		clear_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
+}
+
 /* tuxctl_ldisc_write_wakeup()
- * Called by the lower level serial driver when it can accept more 
+ * Called by the lower level serial driver when it can accept more, and by
+ * tuxctl_ldisc_put*() after adding bytes. Whoever finds TUXCTL_TX_BUSY
+ * clear sends; a caller that finds it set only leaves TUXCTL_TX_KICK for
+ * the sender, which checks it again before giving up the bit.
  */
 static void 
 tuxctl_ldisc_write_wakeup(struct tty_struct *tty)
 {
 	tuxctl_ldisc_data_t *data;
-	int sent, n = 0, room;
-	char buf[TUXCTL_BUFSIZE];
-	unsigned long flags;
 
-	/* I hope that this doesn't need synchronization. */
-	room = tty->driver->write_room(tty);
-	
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
-	data = tty->disc_data;
-
-	while(n <= room && !buf_empty(data->tx_start, data->tx_end)){
-		buf[n++] = data->tx_buf[data->tx_start];
-		buf_incidx(data->tx_start);
+	if(0 == (data = tty->disc_data))
+		return;
+
+	set_bit(TUXCTL_TX_KICK, &data->tx_flags);
+	while(!test_and_set_bit(TUXCTL_TX_BUSY, &data->tx_flags)){
+		while(test_and_clear_bit(TUXCTL_TX_KICK, &data->tx_flags))
+			tuxctl_ldisc_tx_segments(tty, data);
+		clear_bit(TUXCTL_TX_BUSY, &data->tx_flags);
+		smp_mb__after_clear_bit();
+		if(!test_bit(TUXCTL_TX_KICK, &data->tx_flags))
+			break;
 	}
+}
 
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
+/* tuxctl_ldisc_gone()
+ * Check whether the tty has gone away under a reader: it has been hung
+ * up, its other end (a pty master) has closed, or the line discipline is
+ * being taken off it.
+ */
+static inline int
+tuxctl_ldisc_gone(struct tty_struct *tty, struct file *file)
+{
+	return (tty_hung_up_p(file) || test_bit(TTY_OTHER_CLOSED, &tty->flags)
+		|| !test_bit(TTY_LDISC, &tty->flags));
+}
 
-	sent = tty->driver->write(tty, buf, n);
+/* tuxctl_ldisc_read()
+ * The read() method of our line discipline. Copies whole struct tux_event
+ * records, oldest first, and returns the number of bytes copied. Blocks
+ * until an event arrives unless the file is non-blocking, in which case
+ * it returns -EAGAIN when no event is queued. Returns 0 (end of file)
+ * instead once the tty has gone away. A buffer too small for one event
+ * gets -EINVAL.
+ */
+static ssize_t
+tuxctl_ldisc_read(struct tty_struct *tty, struct file *file,
+		  unsigned char __user *buf, size_t nr)
+{
+	tuxctl_ldisc_data_t *data = tty->disc_data;
+	struct tux_event ev[TUXCTL_EVQ_BATCH];
+	unsigned long flags;
+	size_t done = 0;
+	int n, i, ret;
+
+	if(nr < sizeof(struct tux_event))
+		return -EINVAL;
+	sanity(data);
+
+	while(nr - done >= sizeof(struct tux_event)){
+		/* Take a batch under the lock; copy it out without it. */
+		spin_lock_irqsave(&data->ev_lock, flags);
+		n = data->ev_head - data->ev_tail;
+		if(n > TUXCTL_EVQ_BATCH)
+			n = TUXCTL_EVQ_BATCH;
+		if(n > (nr - done) / sizeof(struct tux_event))
+			n = (nr - done) / sizeof(struct tux_event);
+		for(i = 0; i < n; i++){
+			ev[i] = data->evq[data->ev_tail & (TUXCTL_EVQ_SIZE-1)];
+			data->ev_tail++;
+		}
+		spin_unlock_irqrestore(&data->ev_lock, flags);
+
+		if(n == 0){
+			/* Return what we have, or wait for the first event. */
+			if(done > 0)
+				break;
+			if(tuxctl_ldisc_gone(tty, file))
+				return 0;
+			if(file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(tty->read_wait,
+				data->ev_head != data->ev_tail ||
+				tuxctl_ldisc_gone(tty, file));
+			if(ret)
+				return ret;
+			continue;
+		}
 
-	if(sent != n){
-		debug("driver lied to us? We lost some data");
+		if(copy_to_user(buf + done, ev, n * sizeof(struct tux_event)))
+			return done > 0 ? done : -EFAULT;
+		done += n * sizeof(struct tux_event);
 	}
+
+	return done;
+}
+
+/* tuxctl_ldisc_poll()
+ * The poll() method of our line discipline: readable when a button event
+ * is queued, and writable when the tx ring has room for any command, so
+ * that an ioctl refused with -EAGAIN can be retried when it would fit.
+ * Reports POLLHUP once the tty has gone away (see tuxctl_ldisc_gone()).
+ */
+static unsigned int
+tuxctl_ldisc_poll(struct tty_struct *tty, struct file *file, poll_table *wait)
+{
+	tuxctl_ldisc_data_t *data = tty->disc_data;
+	unsigned int mask = 0;
+	unsigned long flags;
+
+	sanity(data);
+	poll_wait(file, &tty->read_wait, wait);
+	poll_wait(file, &tty->write_wait, wait);
+
+	spin_lock_irqsave(&data->ev_lock, flags);
+	if(data->ev_head != data->ev_tail)
+		mask |= POLLIN | POLLRDNORM;
+	spin_unlock_irqrestore(&data->ev_lock, flags);
+	if(tuxctl_ldisc_gone(tty, file))
+		mask |= POLLHUP;
+
+	if(TUXCTL_BUFSIZE - (data->tx_head - ring_load_acquire(&data->tx_tail))
+	   >= TUXCTL_TX_CMD_MAX)
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
 }
 
 /*********** Interface to the char driver ********************/
@@ -220,64 +683,237 @@ tuxctl_ldisc_write_wakeup(struct tty_struct *tty)
 /* tuxctl_ldisc_get()
  * Read bytes that the line-discipline has received from the controller.
  * Returns the number of bytes actually read, or  -1 on error (if, for
- * example, the first argument is invalid.
+ * example, the first argument is invalid. This is the only consumer of
+ * the rx ring (it is called from tuxctl_ldisc_data_callback()).
  */
 int 
 tuxctl_ldisc_get(struct tty_struct *tty, char *buf, int n)
 {
 	tuxctl_ldisc_data_t *data;
-	unsigned long flags;
-	int r = 0;
-
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
-	data = tty->disc_data;
-	while(n-- > 0 && !buf_empty(data->rx_start, data->rx_end)){
-		*buf++ = data->rx_buf[data->rx_start];
-		buf_incidx(data->rx_start);
-		r++;
-	}
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
+	unsigned int tail;
+	int avail;
+
+	if(0 == (data = tty->disc_data))
+		return -1;
+
+	tail = data->rx_tail;
+	avail = ring_load_acquire(&data->rx_head) - tail;
+	if(n > avail)
+		n = avail;
+	if(n <= 0)
+		return 0;
+	ring_copy_out(buf, data->rx_buf, tail, n);
+	ring_store_release(&data->rx_tail, tail + n);
 
-	return r;
+	return n;
+}
+
+/* tuxctl_ldisc_count_put()
+ * Count a write to the tx ring: whether it was refused (in whole or in
+ * part) for lack of room, and the bytes then waiting. Must be called with
+ * tx_put_lock held.
+ */
+static inline void
+tuxctl_ldisc_count_put(tuxctl_ldisc_data_t *data, int full, unsigned int used)
+{
+	if(full)
+		data->dev.stats.tx_full++;
+	if(used > data->dev.stats.tx_high)
+		data->dev.stats.tx_high = used;
+}
+
+/* tuxctl_trace_put()
+ * Trace hook for writes to the tx ring; see tuxctl-ld.h. The barrier
+ * keeps the compiler from dropping the empty call.
+ */
+noinline void
+tuxctl_trace_put(struct tty_struct *tty, int asked, int written,
+		 unsigned int used)
+{
+	barrier();
 }
 
 /* tuxctl_ldisc_put()
  * Write bytes out to the device. Returns the number of bytes *not* written.
  * This means, 0 on success and >0 if the line discipline's internal buffer
- * is full.
+ * is full. Safe to call from interrupt context.
  */
 int 
 tuxctl_ldisc_put(struct tty_struct *tty, char const *buf, int n)
 {
 	tuxctl_ldisc_data_t *data;
 	unsigned long flags;
+	unsigned int head;
+	int room, c;
+
+	if(0 == (data = tty->disc_data))
+		return n;
+
+	spin_lock_irqsave(&data->tx_put_lock, flags);
+	head = data->tx_head;
+	room = TUXCTL_BUFSIZE - (head - ring_load_acquire(&data->tx_tail));
+	c = (n < room ? n : room);
+	ring_copy_in(data->tx_buf, head, buf, c);
+	ring_store_release(&data->tx_head, head + c);
+	tuxctl_ldisc_count_put(data, c < n, TUXCTL_BUFSIZE - (room - c));
+	spin_unlock_irqrestore(&data->tx_put_lock, flags);
+
+	tuxctl_trace_put(tty, n, c, TUXCTL_BUFSIZE - (room - c));
+
+	tuxctl_ldisc_write_wakeup(tty);
+
+	return n - c;
+}
+
+/* tuxctl_ldisc_put_packet()
+ * Write a whole command out to the device, or nothing at all. Returns 0
+ * on success, or -EAGAIN if the line discipline's internal buffer lacks
+ * room for all n bytes (poll() reports POLLOUT once there is room for
+ * any command). Safe to call from interrupt context.
+ */
+int
+tuxctl_ldisc_put_packet(struct tty_struct *tty, char const *buf, int n)
+{
+	return (tuxctl_ldisc_put_packets(tty, buf, &n, 1) == 1 ? 0 : -EAGAIN);
+}
+
+/* tuxctl_ldisc_put_packets()
+ * Write commands out to the device in order, each one whole or not at all,
+ * stopping at the first that does not fit. The commands are taken under
+ * one hold of tx_put_lock, so no other command lands between them, and
+ * sent with one write_wakeup(). Returns the number of commands written.
+ * Safe to call from interrupt context.
+ */
+int
+tuxctl_ldisc_put_packets(struct tty_struct *tty, char const *buf,
+			 const int *len, int n)
+{
+	tuxctl_ldisc_data_t *data;
+	unsigned long flags;
+	unsigned int head;
+	int room, i, c;
+	int asked, written = 0;
+
+	if(0 == (data = tty->disc_data))
+		return 0;
+
+	spin_lock_irqsave(&data->tx_put_lock, flags);
+	head = data->tx_head;
+	room = TUXCTL_BUFSIZE - (head - ring_load_acquire(&data->tx_tail));
+	for(i = 0; i < n && len[i] <= room; i++){
+		ring_copy_in(data->tx_buf, head, buf, len[i]);
+		head += len[i];
+		room -= len[i];
+		buf += len[i];
+		written += len[i];
+	}
+	if(i > 0)
+		ring_store_release(&data->tx_head, head);
+	tuxctl_ldisc_count_put(data, i < n, TUXCTL_BUFSIZE - room);
+	spin_unlock_irqrestore(&data->tx_put_lock, flags);
 
-	spin_lock_irqsave(&tuxctl_ldisc_lock, flags);
+	for(asked = written, c = i; c < n; c++)
+		asked += len[c];
+	tuxctl_trace_put(tty, asked, written, TUXCTL_BUFSIZE - room);
 
-	data = tty->disc_data;
+	if(i > 0)
+		tuxctl_ldisc_write_wakeup(tty);
 
-	while (n > 0 && !buf_full(data->tx_start, data->tx_end)) {
-		data->tx_buf[data->tx_end] = *buf++;
-		buf_incidx(data->tx_end);
-		--n;
+	return i;
+}
+
+/* tuxctl_ldisc_put_event()
+ * Queue a button event for read() and wake up readers. If the queue is
+ * full, the oldest event is dropped, so that readers always see the
+ * latest state of the buttons. Safe to call from interrupt context.
+ */
+void
+tuxctl_ldisc_put_event(struct tty_struct *tty, struct tux_event const *ev)
+{
+	tuxctl_ldisc_data_t *data;
+	unsigned long flags;
+
+	if(0 == (data = tty->disc_data))
+		return;
+
+	spin_lock_irqsave(&data->ev_lock, flags);
+	if(data->ev_head - data->ev_tail == TUXCTL_EVQ_SIZE){
+		data->ev_tail++;
+		data->ev_dropped++;
 	}
+	data->evq[data->ev_head & (TUXCTL_EVQ_SIZE-1)] = *ev;
+	data->ev_head++;
+	spin_unlock_irqrestore(&data->ev_lock, flags);
 
-	spin_unlock_irqrestore(&tuxctl_ldisc_lock, flags);
+	wake_up_interruptible(&tty->read_wait);
+}
 
-	/* Potential race conditions here ...  ?*/
+/* tuxctl_ldisc_publish()
+ * Write the buttons and LEDs to the device's state page, stamped with the
+ * current time, and bump its sequence number. Safe to call from interrupt
+ * context.
+ */
+void
+tuxctl_ldisc_publish(struct tty_struct *tty, unsigned long buttons,
+		     unsigned long led)
+{
+	tuxctl_ldisc_data_t *data;
+	struct tux_state *s;
+	struct timespec ts;
+	unsigned long flags;
 
-	tuxctl_ldisc_write_wakeup(tty);
+	if(0 == (data = tty->disc_data))
+		return;
+
+	ktime_get_ts(&ts);
+	s = data->state;
+	spin_lock_irqsave(&data->state_lock, flags);
+	s->seq++;		/* odd: readers retry */
+	smp_wmb();
+	s->buttons = buttons;
+	s->led = led;
+	s->sec = ts.tv_sec;
+	s->nsec = ts.tv_nsec;
+	smp_wmb();
+	s->seq++;
+	spin_unlock_irqrestore(&data->state_lock, flags);
+}
 
-	return n;
+/* tuxctl_ldisc_dev()
+ * Return the driver's state for the device, or NULL if the tty is not
+ * using this line discipline.
+ */
+tuxctl_dev_t *
+tuxctl_ldisc_dev(struct tty_struct *tty)
+{
+	tuxctl_ldisc_data_t *data;
+
+	if(0 == (data = tty->disc_data))
+		return 0;
+	return &data->dev;
+}
+
+/* tuxctl_ldisc_state_index()
+ * Return the index that selects the device's state page in mmap() of
+ * /dev/tuxctl, or -EINVAL if the tty is not using this line discipline.
+ */
+int
+tuxctl_ldisc_state_index(struct tty_struct *tty)
+{
+	tuxctl_ldisc_data_t *data;
+
+	if(0 == (data = tty->disc_data))
+		return -EINVAL;
+	return data->index;
 }
 
 /* tuxctl_ldisc_data_callback()
  * This is the function called from the line-discipline when data is
  * available from the device. This is how responses to polling the buttons
  * and ACK's for setting the LEDs will be transmitted to the tuxctl driver.
- * The tuxctl driver must implement this function. The 'tty' parameter
- * can be passed back to the tuxctl_ldisc_read function to read
- * data from the lower-level buffers.
+ * It takes every byte waiting in the rx ring, a chunk at a time, runs the
+ * chunk through the device's packet parser (mtcp_parse()), and hands the
+ * packets that it completes to tuxctl_handle_packet(), in order.
  *
  * IMPORTANT: This function is called from an interrupt context, so it 
  *            cannot acquire any semaphores or otherwise sleep, or access
@@ -285,35 +921,18 @@ tuxctl_ldisc_put(struct tty_struct *tty, char const *buf, int n)
  */
 static void tuxctl_ldisc_data_callback(struct tty_struct *tty)
 {
-	/* Should probably synchronize these */
-	static unsigned char saved[2];
-	static int n_saved = 0;
-	
-	unsigned char packet[12], *p;
-	int n, i = 0, j;
-
-	for(i=0; i< n_saved; i++)
-		packet[i] = saved[i];
-	
-	n = n_saved + tuxctl_ldisc_get(tty, packet + n_saved,  12 - n_saved);
-
-	/* Look at all bytes as potential packet beginnings except for 
-	 * the last two bytes. Save them for next time. */
-	for(i = 0; i < n-2; ){
-		p = packet + i;
-
-		/* Check the framing bits to detect lost bytes */
-		if(!(p[0]&0x80) && p[1]&0x80 && p[2]&0x80){
-			tuxctl_handle_packet(tty, p);
-			i += 3;
-		}else{
-			i++;
-		}
+	tuxctl_ldisc_data_t *data = tty->disc_data;
+	unsigned char buf[TUXCTL_PARSE_CHUNK];
+	unsigned char pkts[TUXCTL_PARSE_BATCH][MTCP_PKT_LEN];
+	int n, n_pkts, i;
+
+	if(0 == data)
+		return;
+	sanity(data);
+
+	while((n = tuxctl_ldisc_get(tty, (char *)buf, sizeof(buf))) > 0){
+		n_pkts = mtcp_parse(&data->parser, buf, n, pkts);
+		for(i = 0; i < n_pkts; i++)
+			tuxctl_handle_packet(tty, pkts[i]);
 	}
-
-	/* Save the leftovers - extra bytes for breakfast */
-	n_saved = n - i;
-	for(j = 0; j < n_saved; j++)
-		saved[j] = packet[i+j];
 }
-
@@ -5,10 +5,68 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/tty.h>
+#include <linux/spinlock.h>
+
+#include "mtcp-core.h"
 
 /* tuxctl-ld.h
  * Interface between line discipline and driver */
 
+/* Packets from the controller, as counted in tuxctl_stats_t */
+enum {
+	TUXCTL_PKT_ACK,
+	TUXCTL_PKT_BIOC_EVENT,
+	TUXCTL_PKT_CLK_EVENT,
+	TUXCTL_PKT_OFF_EVENT,
+	TUXCTL_PKT_POLL_OK,
+	TUXCTL_PKT_CLK_POLL,
+	TUXCTL_PKT_RESET,
+	TUXCTL_PKT_ERROR,
+	TUXCTL_PKT_LEDS_POLL,
+	TUXCTL_PKT_OTHER,
+	TUXCTL_PKT_TYPES
+};
+
+/* Buckets of the ACK round-trip histogram: under 1 ms, then 1 to 2 ms,
+ * 2 to 4 ms, and so on, with the last holding all from 64 ms up.
+ */
+#define TUXCTL_ACK_BUCKETS 8
+
+/* Counts kept for one controller, shown in debugfs (tuxctl/<index>).
+ * Each count is changed by one path only (the line discipline's for the
+ * byte counts, the packet handler's for the rest), so none is locked;
+ * a reader may see them a few updates apart.
+ */
+typedef struct tuxctl_stats {
+	unsigned long rx_bytes;		/* bytes received */
+	unsigned long rx_dropped;	/* bytes lost to a full rx ring */
+	unsigned long tx_bytes;		/* bytes handed to the serial driver */
+	unsigned long tx_high;		/* most bytes ever waiting in the tx ring */
+	unsigned long tx_full;		/* writes refused for a full tx ring */
+	unsigned long packets[TUXCTL_PKT_TYPES];	/* packets handled */
+	unsigned long resets;		/* MTCP_RESET packets */
+	unsigned long acks[TUXCTL_ACK_BUCKETS];	/* LED command round trips */
+	unsigned long long led_sent_ns;	/* time the LED command in flight was sent */
+} tuxctl_stats_t;
+
+/* The driver's state for one controller. The line discipline keeps one
+ * with the data of each tty it is set on, from open to close; lock guards
+ * the rest but stats, and is taken with interrupts off.
+ */
+typedef struct tuxctl_dev {
+	spinlock_t lock;
+	unsigned long buttons;	/* as returned by TUX_BUTTONS */
+	mtcp_led_t led;		/* the LEDs and the LED command in flight */
+	mtcp_clk_t clk;		/* the controller's clock, if it is shown */
+	tuxctl_stats_t stats;
+} tuxctl_dev_t;
+
+/* tuxctl_ldisc_dev()
+ * Return the driver's state for the controller on a tty, or NULL if the
+ * tty is not using this line discipline.
+ */
+extern tuxctl_dev_t *tuxctl_ldisc_dev(struct tty_struct*);
+
 /* tuxctl_ldisc_get()
  * Read bytes that the line-discipline has received from the controller.
  * Returns the number of bytes actually read, or  -1 on error (if, for
@@ -24,6 +82,57 @@ extern int tuxctl_ldisc_get(struct tty_struct*, char *, int);
  */
 extern int tuxctl_ldisc_put(struct tty_struct*, char const*, int);
 
+/* tuxctl_ldisc_put_packet()
+ * Write a whole command out to the device, or nothing at all. Returns 0
+ * on success, or -EAGAIN if the line discipline's internal buffer is too
+ * full to hold it. May be called from interrupt context.
+ */
+extern int tuxctl_ldisc_put_packet(struct tty_struct*, char const*, int);
+
+/* tuxctl_ldisc_put_packets()
+ * Write n commands out to the device in order, under one lock and with
+ * one wakeup of the serial driver. The bytes of each command follow those
+ * of the one before in the buffer, and len gives their lengths. Each is
+ * written whole or not at all, stopping at the first that does not fit.
+ * Returns the number of commands written. May be called from interrupt
+ * context.
+ */
+extern int tuxctl_ldisc_put_packets(struct tty_struct*, char const*,
+				    const int*, int);
+
+struct tux_event;
+
+/* tuxctl_ldisc_put_event()
+ * Queue a button event to be returned by read() on the device, and wake
+ * up any process waiting for one in read() or poll(). May be called from
+ * interrupt context (as from tuxctl_handle_packet()).
+ */
+extern void tuxctl_ldisc_put_event(struct tty_struct*, struct tux_event const*);
+
+/* tuxctl_ldisc_publish()
+ * Update the device's shared state page (struct tux_state) with the
+ * buttons and LEDs, as returned by TUX_BUTTONS and TUX_READ_LED. May be
+ * called from interrupt context.
+ */
+extern void tuxctl_ldisc_publish(struct tty_struct*, unsigned long, unsigned long);
+
+/* tuxctl_ldisc_state_index()
+ * Return the page offset at which /dev/tuxctl maps the device's state
+ * page, or -EINVAL on error.
+ */
+extern int tuxctl_ldisc_state_index(struct tty_struct*);
+
+/* tuxctl_trace_put(), tuxctl_trace_packet()
+ * Trace hooks, which do nothing: a kprobe on one of them (by name) sees
+ * every write to the tx ring (the tty, the bytes asked for, the bytes
+ * written, and the bytes then waiting) or every packet handled (the tty
+ * and the packet), with no rebuild of the module. They are called on
+ * every write and packet, and kept out of line so there is a call to
+ * probe.
+ */
+extern void tuxctl_trace_put(struct tty_struct*, int, int, unsigned int);
+extern void tuxctl_trace_packet(struct tty_struct*, const unsigned char*);
+
 /* tuxctl_handle_packet
  * To be written by the student.  This function will handle a 
  * packet sent to the computer from the tux controller.  This is
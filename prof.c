@@ -0,0 +1,244 @@
+/*
+ * tab:4
+ *
+ * prof.c - frame phase timing with logarithmic latency histograms
+ *
+ * Filename:      prof.c
+ */
+
+#include "prof.h"
+
+#if !defined(NPROF)
+
+#include <time.h>
+
+/* a histogram of phase times */
+typedef struct {
+    unsigned long long count;               /* frames recorded           */
+    unsigned long long max_ns;              /* longest time recorded     */
+    unsigned int bucket[PROF_NUM_BUCKETS];  /* frames in each bucket     */
+} prof_hist_t;
+
+/* histograms by level (0 for all levels) and phase */
+static prof_hist_t prof_hist[PROF_MAX_LEVEL + 1][PROF_NUM_PHASES];
+
+static const char* prof_names[PROF_NUM_PHASES] = {
+    "input", "sim", "redraw", "sprite", "show", "palette", "status", "frame",
+    "in queue"
+};
+
+/* local functions--see function headers for details */
+static int bucket_of(unsigned long long ns);
+static unsigned long long bucket_top(int b);
+static void hist_add(prof_hist_t* h, unsigned long long ns);
+static unsigned long long hist_pct(const prof_hist_t* h, int pct);
+static void print_level(FILE* out, int level);
+
+/*
+ * prof_now
+ *   DESCRIPTION: Read the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the time in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+unsigned long long prof_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * prof_lap
+ *   DESCRIPTION: Charge the time since the frame's last mark to a phase,
+ *                and mark the frame again.
+ *   INPUTS: f -- the frame timer
+ *           phase -- the phase that just ran
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void prof_lap(prof_frame_t* f, prof_phase_t phase) {
+    unsigned long long now = prof_now();
+
+    if (!(f->ran & (1 << phase))) {
+        f->ran |= (1 << phase);
+        f->ns[phase] = 0;
+    }
+    f->ns[phase] += now - f->mark;
+    f->mark = now;
+}
+
+/*
+ * bucket_of
+ *   DESCRIPTION: Find the histogram bucket of a time.  Bucket 4k + j
+ *                holds times from 2^k (1 + j/4) up to 2^k (1 + (j+1)/4).
+ *   INPUTS: ns -- the time
+ *   OUTPUTS: none
+ *   RETURN VALUE: the bucket index
+ *   SIDE EFFECTS: none
+ */
+static int bucket_of(unsigned long long ns) {
+    int k;
+
+    if (ns < PROF_SUB_BUCKETS)
+        return ns;
+    k = 63 - __builtin_clzll(ns);
+    return k * PROF_SUB_BUCKETS +
+           (int)((ns >> (k - 2)) & (PROF_SUB_BUCKETS - 1));
+}
+
+/*
+ * bucket_top
+ *   DESCRIPTION: Find the largest time held by a histogram bucket.
+ *   INPUTS: b -- the bucket index
+ *   OUTPUTS: none
+ *   RETURN VALUE: the time in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+static unsigned long long bucket_top(int b) {
+    int k = b / PROF_SUB_BUCKETS;
+    int j = b % PROF_SUB_BUCKETS;
+
+    if (k < 2)
+        return b;
+    return ((1ULL << k) + ((unsigned long long)(j + 1) << (k - 2))) - 1;
+}
+
+/*
+ * hist_add
+ *   DESCRIPTION: Record a time in a histogram.
+ *   INPUTS: h -- the histogram
+ *           ns -- the time
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void hist_add(prof_hist_t* h, unsigned long long ns) {
+    h->count++;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->bucket[bucket_of(ns)]++;
+}
+
+/*
+ * prof_end
+ *   DESCRIPTION: Add the time of each phase that ran in a frame, and of
+ *                the frame as a whole, to the histograms for all levels
+ *                and for the frame's level.
+ *   INPUTS: f -- the frame timer
+ *           level -- level being played (1 to PROF_MAX_LEVEL)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the histograms
+ */
+void prof_end(prof_frame_t* f, int level) {
+    int p;
+
+    f->ran |= (1 << PROF_FRAME_ALL);
+    f->ns[PROF_FRAME_ALL] = 0;
+    for (p = 0; p < PROF_FRAME_ALL; p++)
+        if (f->ran & (1 << p))
+            f->ns[PROF_FRAME_ALL] += f->ns[p];
+
+    if (level < 1 || level > PROF_MAX_LEVEL)
+        level = 0;
+    for (p = 0; p < PROF_NUM_PHASES; p++) {
+        if (!(f->ran & (1 << p)))
+            continue;
+        hist_add(&prof_hist[0][p], f->ns[p]);
+        if (level != 0)
+            hist_add(&prof_hist[level][p], f->ns[p]);
+    }
+}
+
+/*
+ * prof_sample
+ *   DESCRIPTION: Add one sample to the histograms of a phase, for all
+ *                levels and for a given level.
+ *   INPUTS: phase -- the phase
+ *           level -- level being played (1 to PROF_MAX_LEVEL)
+ *           ns -- the time
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the histograms
+ */
+void prof_sample(prof_phase_t phase, int level, unsigned long long ns) {
+    hist_add(&prof_hist[0][phase], ns);
+    if (level >= 1 && level <= PROF_MAX_LEVEL)
+        hist_add(&prof_hist[level][phase], ns);
+}
+
+/*
+ * hist_pct
+ *   DESCRIPTION: Find a percentile of a histogram.
+ *   INPUTS: h -- the histogram (not empty)
+ *           pct -- the percentile (1 to 100)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the top of the bucket holding the percentile, but no
+ *                 more than the largest time recorded
+ *   SIDE EFFECTS: none
+ */
+static unsigned long long hist_pct(const prof_hist_t* h, int pct) {
+    unsigned long long want = (h->count * pct + 99) / 100;
+    unsigned long long seen = 0;
+    int b;
+
+    for (b = 0; b < PROF_NUM_BUCKETS - 1; b++)
+        if ((seen += h->bucket[b]) >= want)
+            break;
+    return (bucket_top(b) < h->max_ns ? bucket_top(b) : h->max_ns);
+}
+
+/*
+ * print_level
+ *   DESCRIPTION: Print the histograms of one level, or of all levels.
+ *   INPUTS: out -- where to print
+ *           level -- the level, or 0 for all levels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints
+ */
+static void print_level(FILE* out, int level) {
+    const prof_hist_t* h;
+    int p;
+
+    if (prof_hist[level][PROF_FRAME_ALL].count == 0)
+        return;
+    if (level == 0)
+        fprintf(out, "all levels:\n");
+    else
+        fprintf(out, "level %d:\n", level);
+    for (p = 0; p < PROF_NUM_PHASES; p++) {
+        h = &prof_hist[level][p];
+        if (h->count == 0)
+            continue;
+        fprintf(out, "  %-8s %9llu %9.1f %9.1f %9.1f %9.1f\n", prof_names[p],
+                h->count, hist_pct(h, 50) / 1e3, hist_pct(h, 90) / 1e3,
+                hist_pct(h, 99) / 1e3, h->max_ns / 1e3);
+    }
+}
+
+/*
+ * prof_report
+ *   DESCRIPTION: Print the count, 50th, 90th, and 99th percentiles, and
+ *                maximum time of every phase, for all levels together and
+ *                then for each level played.
+ *   INPUTS: out -- where to print
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints
+ */
+void prof_report(FILE* out) {
+    int level;
+
+    if (prof_hist[0][PROF_FRAME_ALL].count == 0)
+        return;
+    fprintf(out, "Frame phase times (us):\n  %-8s %9s %9s %9s %9s %9s\n",
+            "phase", "count", "p50", "p90", "p99", "max");
+    for (level = 0; level <= PROF_MAX_LEVEL; level++)
+        print_level(out, level);
+}
+
+#endif /* !defined(NPROF) */
@@ -0,0 +1,111 @@
+/*
+ * tab:4
+ *
+ * prof.h - header file for frame phase timing
+ *
+ * Filename:      prof.h
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+
+/*
+ * NOTES
+ *
+ * The game loop times each phase of a frame on the monotonic clock and
+ * adds the time spent in each phase during the frame to a histogram for
+ * that phase, both for all levels and for the current level.  A phase
+ * that does not run in a frame (the palette is not changed every frame,
+ * for example) records nothing for that frame.  Some histograms, such as
+ * PROF_INPUT_WAIT, are fed one sample per event rather than one per
+ * frame.  prof_report prints the count, percentiles, and maximum of
+ * every histogram at exit.
+ *
+ * Histogram buckets are logarithmic: each power of two from 1 ns up is
+ * split into PROF_SUB_BUCKETS equal parts, so a reported percentile is
+ * within 1/PROF_SUB_BUCKETS of the true value.
+ *
+ * Frame timing uses a prof_frame_t on the stack:
+ *
+ *     PROF_FRAME(f);                   declare the frame timer
+ *     PROF_BEGIN(f);                   start a frame (clears the totals)
+ *     ...work...  PROF_LAP(f, phase);  charge time since the last mark
+ *     PROF_MARK(f);                    skip time not charged to any phase
+ *     PROF_END(f, level);              add the frame's totals
+ *     PROF_SAMPLE(phase, level, ns);   add one sample outside a frame
+ *
+ * The statistics are kept in one place per process and are updated only
+ * by the game loop's thread.
+ *
+ * Compiling with NPROF defined removes all of it: the macros expand to
+ * nothing and prof.c compiles to an empty file.
+ */
+
+/* phases of a frame */
+typedef enum {
+    PROF_INPUT,     /* draining the input rings              */
+    PROF_SIM,       /* simulation ticks and timed events     */
+    PROF_REDRAW,    /* unveiled blocks and scrolled lines    */
+    PROF_SPRITE,    /* player and floating text composite    */
+    PROF_SHOW,      /* show_screen                           */
+    PROF_PALETTE,   /* player color change                   */
+    PROF_STATUS,    /* clock, LEDs, and status bar           */
+    PROF_FRAME_ALL, /* all of the above (not waiting)        */
+    PROF_INPUT_WAIT,/* time input events spent queued        */
+    PROF_NUM_PHASES
+} prof_phase_t;
+
+#define PROF_MAX_LEVEL      10  /* levels tracked separately (1 to 10)   */
+#define PROF_SUB_BUCKETS    4   /* buckets per power of two (must be 4)  */
+#define PROF_NUM_BUCKETS    (64 * PROF_SUB_BUCKETS)
+
+#if !defined(NPROF)
+
+/* phase times within one frame */
+typedef struct {
+    unsigned long long mark;                /* time of the last mark    */
+    unsigned long long ns[PROF_NUM_PHASES]; /* time charged to a phase  */
+    unsigned int ran;                       /* phases charged, by bit   */
+} prof_frame_t;
+
+/* read the monotonic clock in nanoseconds */
+extern unsigned long long prof_now();
+
+/* charge the time since the last mark to a phase */
+extern void prof_lap(prof_frame_t* f, prof_phase_t phase);
+
+/* add a frame's phase times to the histograms for a level */
+extern void prof_end(prof_frame_t* f, int level);
+
+/* add one sample to the histograms of a phase for a level */
+extern void prof_sample(prof_phase_t phase, int level, unsigned long long ns);
+
+/* print the summary of all histograms */
+extern void prof_report(FILE* out);
+
+#define PROF_FRAME(f)       prof_frame_t f
+#define PROF_BEGIN(f)       do {                                    \
+    (f).mark = prof_now();                                          \
+    (f).ran = 0;                                                    \
+} while (0)
+#define PROF_MARK(f)        ((f).mark = prof_now())
+#define PROF_LAP(f, phase)  prof_lap(&(f), (phase))
+#define PROF_END(f, level)  prof_end(&(f), (level))
+#define PROF_SAMPLE(phase, level, ns) prof_sample((phase), (level), (ns))
+#define PROF_REPORT(out)    prof_report(out)
+
+#else /* defined(NPROF) */
+
+#define PROF_FRAME(f)
+#define PROF_BEGIN(f)       do {} while (0)
+#define PROF_MARK(f)        do {} while (0)
+#define PROF_LAP(f, phase)  do {} while (0)
+#define PROF_END(f, level)  do {} while (0)
+#define PROF_SAMPLE(phase, level, ns) do {} while (0)
+#define PROF_REPORT(out)    do {} while (0)
+
+#endif /* !defined(NPROF) */
+
+#endif /* PROF_H */
@@ -0,0 +1,244 @@
+/*
+ * tab:4
+ *
+ * runner.c - plays many headless maze games at once on a pool of threads
+ *
+ * Filename:      runner.c
+ */
+
+/*
+ * NOTES
+ *
+ * Each game is a maze, a player, and a screen that belong to the game
+ * alone, so any number of games can run in one process.  A game is one
+ * maze built from the base seed plus the game number, with the size of
+ * the level (game number mod MAX_LEVEL) + 1, played by the bot in
+ * sim_bot_direction until it leaves by the exit.  Unless rendering is
+ * turned off, the view is scrolled and the changed maze blocks drawn into
+ * the game's build buffer once every RUN_FRAME_TICKS ticks, as the game
+ * does once per frame; nothing is shown on the display.
+ *
+ * Worker threads take the next unplayed game until all have been played.
+ * The tick counts depend only on the seed, so the check value printed at
+ * the end is the same for any number of threads.  Build with "make runner".
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "maze.h"
+#include "modex.h"
+#include "sim.h"
+
+#define RUN_MAX_TICKS   1000000 /* give up on a game after this many    */
+#define RUN_FRAME_TICKS 4       /* ticks between drawing the view       */
+
+/* a headless game, owned by one worker at a time */
+typedef struct {
+    maze_t maze;
+    sim_state_t sim;
+    screen_t screen;
+} run_game_t;
+
+/* work shared by the worker threads */
+typedef struct {
+    pthread_mutex_t lock;       /* protects everything below            */
+    int next_game;              /* next game to be played               */
+    int n_games;                /* games to be played                   */
+    unsigned long seed;         /* seed of game 0                       */
+    int render;                 /* 1 to draw into each game's screen    */
+    unsigned long long ticks;   /* ticks played by finished games       */
+    unsigned long long check;   /* sum of per-game checks               */
+    int failed;                 /* games that could not be finished     */
+} run_pool_t;
+
+/* local functions--see function headers for details */
+static long play_game(run_game_t* rg, unsigned long seed, int level, int render);
+static void* run_worker(void* arg);
+
+/*
+ * play_game
+ *   DESCRIPTION: Build one maze and let the bot play it to the exit.
+ *   INPUTS: rg -- the game's storage
+ *           seed -- seed for the maze
+ *           level -- level number (1 to MAX_LEVEL) giving the maze size
+ *           render -- 1 to draw the game into its screen
+ *   OUTPUTS: *rg -- the finished game
+ *   RETURN VALUE: the number of ticks played, or -1 if the maze cannot
+ *                 be built or finished
+ *   SIDE EFFECTS: none
+ */
+static long play_game(run_game_t* rg, unsigned long seed, int level, int render) {
+    int dim = level - 1;
+    int next_dir = DIR_STOP;
+    int events;
+    long ticks;
+
+    if (generate_maze(&rg->maze, MAZE_MIN_X_DIM + 2 * dim, MAZE_MIN_Y_DIM + 2 * dim,
+                      1 + dim / 2, seed) != 0)
+        return -1;
+    sim_init(&rg->sim, &rg->maze);
+    if (render) {
+        set_screen_fill_arg(&rg->screen, &rg->maze);
+        set_view_window(&rg->screen, rg->sim.map_x, rg->sim.map_y);
+        render_full_view(&rg->maze, &rg->screen);
+    }
+    (void)sim_unveil(&rg->sim);
+
+    for (ticks = 0; ticks < RUN_MAX_TICKS; ticks++) {
+        if (rg->sim.move_cnt == 0)
+            next_dir = sim_bot_direction(&rg->sim);
+        events = sim_step(&rg->sim, next_dir);
+        if (events & SIM_EV_WON)
+            return ticks;
+        if (!render)
+            continue;
+        if (events & SIM_EV_SCROLL) {
+            set_view_window(&rg->screen, rg->sim.map_x, rg->sim.map_y);
+            if (events & SIM_EV_SCROLL_UP)
+                (void)draw_horiz_line(&rg->screen, 0);
+            if (events & SIM_EV_SCROLL_RIGHT)
+                (void)draw_vert_line(&rg->screen, SCROLL_X_DIM - 1);
+            if (events & SIM_EV_SCROLL_DOWN)
+                (void)draw_horiz_line(&rg->screen, SCROLL_Y_DIM - 1);
+            if (events & SIM_EV_SCROLL_LEFT)
+                (void)draw_vert_line(&rg->screen, 0);
+        }
+        if (ticks % RUN_FRAME_TICKS == 0)
+            draw_dirty_blocks(&rg->maze, &rg->screen);
+    }
+    return -1;
+}
+
+/*
+ * run_worker
+ *   DESCRIPTION: Worker thread: play games from the pool until none are
+ *                left, then add this thread's totals to the pool.
+ *   INPUTS: arg -- the run_pool_t
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: changes the pool's counters
+ */
+static void* run_worker(void* arg) {
+    run_pool_t* pool = arg;
+    run_game_t* rg;
+    unsigned long long ticks = 0, check = 0;
+    int failed = 0;
+    int game;
+    long n;
+
+    /* Each worker keeps one game's storage and reuses it for every game. */
+    if ((rg = malloc(sizeof (*rg))) == NULL ||
+        init_screen(&rg->screen, fill_horiz_buffer, fill_vert_buffer, &rg->maze) != 0) {
+        free(rg);
+        pthread_mutex_lock(&pool->lock);
+        pool->failed = -1;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        game = pool->next_game;
+        if (game < pool->n_games)
+            pool->next_game++;
+        pthread_mutex_unlock(&pool->lock);
+        if (game >= pool->n_games)
+            break;
+
+        n = play_game(rg, pool->seed + game, 1 + game % MAX_LEVEL, pool->render);
+        if (n < 0) {
+            fprintf(stderr, "game %d (seed %lu) not finished\n", game, pool->seed + game);
+            failed++;
+            continue;
+        }
+        ticks += n;
+        check += (unsigned long long)(game + 1) * n;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->ticks += ticks;
+    pool->check += check;
+    if (pool->failed >= 0)
+        pool->failed += failed;
+    pthread_mutex_unlock(&pool->lock);
+    free(rg);
+    return NULL;
+}
+
+/*
+ * main
+ *   DESCRIPTION: Play a number of headless games on a pool of threads and
+ *                report the aggregate rate.
+ *   INPUTS: argc, argv -- "-g <games>" number of games (default 1000)
+ *                         "-t <threads>" worker threads (default: one per
+ *                                        online processor)
+ *                         "-s <seed>" seed of the first game (default 1)
+ *                         "-n" simulate only; do not draw the games
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 if any game cannot be played
+ *   SIDE EFFECTS: prints results
+ */
+int main(int argc, char* argv[]) {
+    static run_pool_t pool;
+    struct timespec t0, t1;
+    pthread_t* tids;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long n_threads = n_cpus;
+    double secs;
+    int i, opt;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.n_games = 1000;
+    pool.seed = 1;
+    pool.render = 1;
+    while ((opt = getopt(argc, argv, "g:t:s:n")) != -1) {
+        switch (opt) {
+            case 'g': pool.n_games = atoi(optarg); break;
+            case 't': n_threads = atol(optarg); break;
+            case 's': pool.seed = strtoul(optarg, NULL, 0); break;
+            case 'n': pool.render = 0; break;
+            default:
+                fprintf(stderr, "usage: %s [-g games] [-t threads] [-s seed] [-n]\n",
+                        argv[0]);
+                return 3;
+        }
+    }
+    if (n_cpus < 1)
+        n_cpus = 1;
+    if (n_threads < 1)
+        n_threads = 1;
+    if ((tids = malloc(n_threads * sizeof (*tids))) == NULL)
+        return 3;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n_threads; i++) {
+        if (pthread_create(&tids[i], NULL, run_worker, &pool) != 0) {
+            n_threads = i;
+            break;
+        }
+    }
+    for (i = 0; i < n_threads; i++)
+        pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(tids);
+
+    if (n_threads == 0 || pool.failed != 0) {
+        fprintf(stderr, "%s: some games were not played\n", argv[0]);
+        return 3;
+    }
+    /* Threads beyond the number of processors add no cores. */
+    if (n_cpus > n_threads)
+        n_cpus = n_threads;
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%d games on %ld threads%s, %llu ticks in %.3f s\n",
+           pool.n_games, n_threads, (pool.render ? "" : " (no drawing)"),
+           pool.ticks, secs);
+    printf("%.0f ticks/s, %.0f ticks/s per core on %ld cores (check %016llx)\n",
+           pool.ticks / secs, pool.ticks / secs / n_cpus, n_cpus, pool.check);
+    return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * tab:4
+ *
+ * sim.c - movement of the player through a maze, one tick at a time
+ *
+ * Filename:      sim.c
+ */
+
+#include "sim.h"
+
+/* local functions--see function headers for details */
+static int sim_move_up(sim_state_t* s);
+static int sim_move_right(sim_state_t* s);
+static int sim_move_down(sim_state_t* s);
+static int sim_move_left(sim_state_t* s);
+
+/*
+ * sim_init
+ *   DESCRIPTION: Place the player at the upper left square of a maze,
+ *                stopped and facing up, with the view window in the
+ *                upper left corner of the maze.  Nothing is unveiled.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: *s -- the initial state
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sim_init(sim_state_t* s, maze_t* m) {
+    s->maze = m;
+
+    /* Start the player at (1,1). */
+    s->play_x = BLOCK_X_DIM;
+    s->play_y = BLOCK_Y_DIM;
+
+    /*
+     * move_cnt tracks moves remaining between maze squares.
+     * When not moving, it should be 0.
+     */
+    s->move_cnt = 0;
+    s->last_dir = DIR_UP;
+    s->dir = DIR_STOP;
+
+    s->map_x = s->map_y = SHOW_MIN;
+    s->fruit = 0;
+}
+
+/*
+ * sim_unveil
+ *   DESCRIPTION: Show the maze squares in an area around the player.
+ *                Consume any fruit under the player.  Check whether
+ *                player has won the maze level.
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: s->fruit -- the fruit eaten, if any
+ *   RETURN VALUE: SIM_EV_FRUIT if a fruit was eaten, plus SIM_EV_WON if
+ *                 the player wins the level by entering the square
+ *   SIDE EFFECTS: unveils maze squares and consumes fruit in the current
+ *                 maze, queueing them to be redrawn
+ */
+int sim_unveil(sim_state_t* s) {
+    int x = s->play_x / BLOCK_X_DIM; /* player's maze lattice position */
+    int y = s->play_y / BLOCK_Y_DIM;
+    int i, j;            /* loop indices for unveiling maze squares */
+    int events = 0;
+    int fnum;
+
+    /* Check for fruit at the player's position. */
+    if ((fnum = check_for_fruit (s->maze, x, y)) != 0) {
+        s->fruit = fnum;
+        events |= SIM_EV_FRUIT;
+    }
+
+    /* Unveil spaces around the player. */
+    for (i = -1; i < 2; i++)
+        for (j = -1; j < 2; j++)
+            unveil_space(s->maze, x + i, y + j);
+    unveil_space(s->maze, x, y - 2);
+    unveil_space(s->maze, x + 2, y);
+    unveil_space(s->maze, x, y + 2);
+    unveil_space(s->maze, x - 2, y);
+
+    /* Check whether the player has won the maze level. */
+    if (check_for_win (s->maze, x, y))
+        events |= SIM_EV_WON;
+    return events;
+}
+
+/*
+ * sim_step
+ *   DESCRIPTION: Advance the player by one tick.  A request to reverse
+ *                direction takes effect immediately; other turns take
+ *                effect when the player reaches a maze square.  On
+ *                reaching a square, the area around it is unveiled, and
+ *                the player stops if the way ahead is blocked.  The player
+ *                then moves one pixel, and the view window pans if the
+ *                player passes the pan border.
+ *   INPUTS: s -- the player state
+ *           next_dir -- direction requested by the player, or DIR_STOP
+ *   OUTPUTS: *s -- the player state after the tick
+ *   RETURN VALUE: the events (SIM_EV_*) that occurred in the tick; no
+ *                 movement occurs in a tick that reports SIM_EV_WON
+ *   SIDE EFFECTS: may change the current maze (see sim_unveil)
+ */
+int sim_step(sim_state_t* s, int next_dir) {
+    int open[NUM_DIRS];  /* directions open to motion from the square */
+    int events = 0;
+
+    /* Check if new direction is backwards...if so, do immediately. */
+    if (next_dir != s->dir &&
+        ((s->dir == DIR_UP && next_dir == DIR_DOWN) ||
+         (s->dir == DIR_DOWN && next_dir == DIR_UP) ||
+         (s->dir == DIR_LEFT && next_dir == DIR_RIGHT) ||
+         (s->dir == DIR_RIGHT && next_dir == DIR_LEFT))) {
+        if (s->move_cnt > 0) {
+            if (s->dir == DIR_UP || s->dir == DIR_DOWN)
+                s->move_cnt = BLOCK_Y_DIM - s->move_cnt;
+            else
+                s->move_cnt = BLOCK_X_DIM - s->move_cnt;
+        }
+        s->dir = next_dir;
+    }
+
+    /* New Maze Square! */
+    if (s->move_cnt == 0) {
+        /*
+         * The player has reached a new maze square; unveil nearby maze
+         * squares and check whether the player has won the level.
+         */
+        events = sim_unveil(s);
+        if (events & SIM_EV_WON)
+            return events;
+
+        /* Record directions open to motion. */
+        find_open_directions (s->maze, s->play_x / BLOCK_X_DIM, s->play_y / BLOCK_Y_DIM, open);
+
+        /* Change dir to next_dir if next_dir is open. */
+        if (next_dir != DIR_STOP && open[next_dir])
+            s->dir = next_dir;
+
+        /*
+         * The direction may not be open to motion...
+         *   1) ran into a wall
+         *   2) initial direction and its opposite both face walls
+         */
+        if (s->dir != DIR_STOP) {
+            if (!open[s->dir])
+                s->dir = DIR_STOP;
+            else if (s->dir == DIR_UP || s->dir == DIR_DOWN)
+                s->move_cnt = BLOCK_Y_DIM;
+            else
+                s->move_cnt = BLOCK_X_DIM;
+        }
+    }
+
+    if (s->dir != DIR_STOP) {
+        /* move in chosen direction */
+        s->last_dir = s->dir;
+        s->move_cnt--;
+        switch (s->dir) {
+            case DIR_UP:    events |= sim_move_up(s);    break;
+            case DIR_RIGHT: events |= sim_move_right(s); break;
+            case DIR_DOWN:  events |= sim_move_down(s);  break;
+            case DIR_LEFT:  events |= sim_move_left(s);  break;
+        }
+    }
+    return events;
+}
+
+/*
+ * sim_move_up
+ *   DESCRIPTION: Move the player up one pixel (assumed to be a legal move)
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: s->play_y -- reduced by one from initial value
+ *            s->map_y -- reduced by one if the view pans
+ *   RETURN VALUE: SIM_EV_SCROLL_UP if the view pans, or 0
+ *   SIDE EFFECTS: none
+ */
+static int sim_move_up(sim_state_t* s) {
+    /*
+     * Move player by one pixel and check whether display should be panned.
+     * Panning is necessary when the player moves past the upper pan border
+     * while the top pixels of the maze are not on-screen.
+     */
+    if (--s->play_y < s->map_y + BLOCK_Y_DIM * PAN_BORDER && s->map_y > SHOW_MIN) {
+        s->map_y--;
+        return SIM_EV_SCROLL_UP;
+    }
+    return 0;
+}
+
+/*
+ * sim_move_right
+ *   DESCRIPTION: Move the player right one pixel (assumed to be a legal move)
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: s->play_x -- increased by one from initial value
+ *            s->map_x -- increased by one if the view pans
+ *   RETURN VALUE: SIM_EV_SCROLL_RIGHT if the view pans, or 0
+ *   SIDE EFFECTS: none
+ */
+static int sim_move_right(sim_state_t* s) {
+    /*
+     * Move player by one pixel and check whether display should be panned.
+     * Panning is necessary when the player moves past the right pan border
+     * while the rightmost pixels of the maze are not on-screen.
+     */
+    if (++s->play_x > s->map_x + SCROLL_X_DIM - BLOCK_X_DIM * (PAN_BORDER + 1) &&
+        s->map_x + SCROLL_X_DIM < (2 * s->maze->x_dim + 1) * BLOCK_X_DIM - SHOW_MIN) {
+        s->map_x++;
+        return SIM_EV_SCROLL_RIGHT;
+    }
+    return 0;
+}
+
+/*
+ * sim_move_down
+ *   DESCRIPTION: Move the player down one pixel (assumed to be a legal move)
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: s->play_y -- increased by one from initial value
+ *            s->map_y -- increased by one if the view pans
+ *   RETURN VALUE: SIM_EV_SCROLL_DOWN if the view pans, or 0
+ *   SIDE EFFECTS: none
+ */
+static int sim_move_down(sim_state_t* s) {
+    /*
+     * Move player by one pixel and check whether display should be panned.
+     * Panning is necessary when the player moves past the lower pan border
+     * while the bottom pixels of the maze are not on-screen.
+     */
+    if (++s->play_y > s->map_y + SCROLL_Y_DIM - BLOCK_Y_DIM * (PAN_BORDER + 1) &&
+        s->map_y + SCROLL_Y_DIM < (2 * s->maze->y_dim + 1) * BLOCK_Y_DIM - SHOW_MIN) {
+        s->map_y++;
+        return SIM_EV_SCROLL_DOWN;
+    }
+    return 0;
+}
+
+/*
+ * sim_move_left
+ *   DESCRIPTION: Move the player left one pixel (assumed to be a legal move)
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: s->play_x -- decreased by one from initial value
+ *            s->map_x -- reduced by one if the view pans
+ *   RETURN VALUE: SIM_EV_SCROLL_LEFT if the view pans, or 0
+ *   SIDE EFFECTS: none
+ */
+static int sim_move_left(sim_state_t* s) {
+    /*
+     * Move player by one pixel and check whether display should be panned.
+     * Panning is necessary when the player moves past the left pan border
+     * while the leftmost pixels of the maze are not on-screen.
+     */
+    if (--s->play_x < s->map_x + BLOCK_X_DIM * PAN_BORDER && s->map_x > SHOW_MIN) {
+        s->map_x--;
+        return SIM_EV_SCROLL_LEFT;
+    }
+    return 0;
+}
+
+/*
+ * sim_bot_direction
+ *   DESCRIPTION: Choose the direction toward the nearest fruit, or toward
+ *                the exit once all fruit is gone, using the maze's
+ *                distance fields.  Bots and headless runs pass the result
+ *                to sim_step whenever the player is on a maze square.
+ *   INPUTS: s -- the player state
+ *   OUTPUTS: none
+ *   RETURN VALUE: the direction to request
+ *   SIDE EFFECTS: none
+ */
+int sim_bot_direction(const sim_state_t* s) {
+    static const int dx[NUM_DIRS] = {0, 2, 0, -2};
+    static const int dy[NUM_DIRS] = {-2, 0, 2, 0};
+    int open[NUM_DIRS];
+    int x = s->play_x / BLOCK_X_DIM;
+    int y = s->play_y / BLOCK_Y_DIM;
+    int best = DIR_STOP, best_d = -1;
+    int d, dist;
+
+    find_open_directions (s->maze, x, y, open);
+    for (d = 0; d < NUM_DIRS; d++) {
+        if (!open[d])
+            continue;
+        if (return_n_fruits (s->maze) > 0)
+            dist = fruit_distance (s->maze, x + dx[d], y + dy[d]);
+        else
+            dist = exit_distance (s->maze, x + dx[d], y + dy[d]);
+        if (dist >= 0 && (best_d < 0 || dist < best_d)) {
+            best = d;
+            best_d = dist;
+        }
+    }
+    return best;
+}
+
+#if defined(SIM_BENCH)
+/*
+ * The code here drives the simulation without a display: a bot walks
+ * each maze along the distance fields, eating every fruit and then
+ * leaving by the exit.  The tick counts depend only on the seed, so the
+ * output can be compared between runs.  Build with "make simbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_LEVELS    200     /* mazes to play            */
+#define BENCH_MAX_TICKS 1000000 /* give up on a maze after this many ticks */
+
+/*
+ * main
+ *   DESCRIPTION: Play BENCH_LEVELS mazes headless and report the rate.
+ *   INPUTS: argc, argv -- optional seed for the first maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 if a maze cannot be built or finished
+ *   SIDE EFFECTS: prints results
+ */
+int main(int argc, char* argv[]) {
+    static maze_t maze;
+    unsigned long seed = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+    unsigned long long total = 0, check = 0;
+    struct timespec t0, t1;
+    sim_state_t s;
+    int level, ticks, events, next_dir;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (level = 0; level < BENCH_LEVELS; level++) {
+        int dim = level % 10;
+        if (generate_maze(&maze, MAZE_MIN_X_DIM + 2 * dim, MAZE_MIN_Y_DIM + 2 * dim,
+                          1 + dim / 2, seed + level) != 0)
+            return 3;
+        sim_init(&s, &maze);
+        (void)sim_unveil(&s);
+
+        next_dir = DIR_STOP;
+        for (ticks = 0; ticks < BENCH_MAX_TICKS; ticks++) {
+            if (s.move_cnt == 0)
+                next_dir = sim_bot_direction(&s);
+            events = sim_step(&s, next_dir);
+            if (events & SIM_EV_WON)
+                break;
+        }
+        if (ticks == BENCH_MAX_TICKS) {
+            fprintf(stderr, "maze %d (seed %lu) not finished\n", level, seed + level);
+            return 3;
+        }
+        total += ticks;
+        check = check * 31 + ticks;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%d mazes, %llu ticks in %.3f s: %.0f ticks/s (check %016llx)\n",
+           BENCH_LEVELS, total, secs, total / secs, check);
+    return 0;
+}
+#endif /* SIM_BENCH */
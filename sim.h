@@ -0,0 +1,68 @@
+/*
+ * tab:4
+ *
+ * sim.h - header file for the maze game simulation step
+ *
+ * Filename:      sim.h
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "blocks.h"
+#include "maze.h"
+
+/*
+ * NOTES
+ *
+ * The simulation moves the player through a maze one pixel per tick,
+ * following the game's movement rules, and reports what happened as a
+ * set of events.  It changes the maze (unveiling squares and eating
+ * fruit) but never draws, sleeps, locks, or touches a device; the caller
+ * renders the events.  Maze squares changed by a step are queued for
+ * draw_dirty_blocks.  All state is in the sim_state_t and its maze, so
+ * any number of games can be simulated at once on different threads.
+ */
+
+#define PAN_BORDER      5  /* pan when border in maze squares reaches 5    */
+
+/* limits of the parameters the game sets for each level */
+#define MAX_LEVEL          10      /* highest level number               */
+#define MIN_TICK_USEC      5000    /* shortest simulation step           */
+#define MIN_FIRST_FRUIT    120     /* least time to the first fruit      */
+#define MIN_BETWEEN_FRUITS 60      /* least time between fruits          */
+
+/* events reported by sim_step and sim_unveil */
+#define SIM_EV_FRUIT        0x01    /* a fruit was eaten (see fruit)       */
+#define SIM_EV_WON          0x02    /* the player reached the open exit    */
+#define SIM_EV_SCROLL_UP    0x04    /* view window moved up one pixel      */
+#define SIM_EV_SCROLL_RIGHT 0x08    /* view window moved right one pixel   */
+#define SIM_EV_SCROLL_DOWN  0x10    /* view window moved down one pixel    */
+#define SIM_EV_SCROLL_LEFT  0x20    /* view window moved left one pixel    */
+#define SIM_EV_SCROLL       (SIM_EV_SCROLL_UP | SIM_EV_SCROLL_RIGHT | \
+                             SIM_EV_SCROLL_DOWN | SIM_EV_SCROLL_LEFT)
+
+/* state of the player within one maze level */
+typedef struct {
+    maze_t* maze;               /* the maze being played                */
+    int play_x, play_y;         /* player position in pixels            */
+    int last_dir;               /* last direction moved (for drawing)   */
+    int dir;                    /* direction of motion, or DIR_STOP     */
+    int move_cnt;               /* pixels left to the next maze square  */
+    unsigned int map_x, map_y;  /* upper left pixel of view window      */
+    int fruit;                  /* last fruit eaten (1 to NUM_FRUITS)   */
+} sim_state_t;
+
+/* place the player at the start of a maze, with the view at its corner */
+extern void sim_init(sim_state_t* s, maze_t* m);
+
+/* unveil the maze around the player, eat fruit, and check for a win */
+extern int sim_unveil(sim_state_t* s);
+
+/* advance by one tick given the requested direction; returns events */
+extern int sim_step(sim_state_t* s, int next_dir);
+
+/* choose a direction toward the nearest fruit, or the exit (for bots) */
+extern int sim_bot_direction(const sim_state_t* s);
+
+#endif /* SIM_H */
@@ -0,0 +1,271 @@
+/*
+ * tab:4
+ *
+ * snapshot.c - saving and loading maze game snapshots
+ *
+ * Filename:      snapshot.c
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "snapshot.h"
+
+/* number of lattice bytes used by a maze of a given size (see maze.c) */
+#define SNAP_MAZE_LEN(x_dim, y_dim) (2 * (x_dim) * (2 * (y_dim) + 3) + 1)
+
+/* local functions--see function headers for details */
+static void snap_put32(uint32_t* p, uint32_t v);
+static int snap_game_ok(const maze_t* m, const snap_game_t* g);
+
+/*
+ * snap_put32
+ *   DESCRIPTION: Store a word of a snapshot file in little-endian order.
+ *   INPUTS: v -- the value
+ *   OUTPUTS: *p -- the stored word
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void snap_put32(uint32_t* p, uint32_t v) {
+    unsigned char* b = (unsigned char*)p;
+
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+/*
+ * snap_game_ok
+ *   DESCRIPTION: Check that loaded game state is something the game could
+ *                have saved in a maze: level parameters within the
+ *                game's limits (sim.h), directions that exist, the player inside the
+ *                maze and on the lattice line of its motion, and the view
+ *                window within the limits kept by the simulation (sim.c).
+ *   INPUTS: m -- the loaded maze
+ *           g -- the loaded game state
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the state can be played, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int snap_game_ok(const maze_t* m, const snap_game_t* g) {
+    int x_pixels = (2 * m->x_dim + 1) * BLOCK_X_DIM;
+    int y_pixels = (2 * m->y_dim + 1) * BLOCK_Y_DIM;
+    int to_line;
+
+    if (g->level < 1 || g->level > MAX_LEVEL ||
+        g->tick_usec < MIN_TICK_USEC ||
+        g->time_to_first_fruit < MIN_FIRST_FRUIT ||
+        g->time_between_fruits < MIN_BETWEEN_FRUITS ||
+        g->elapsed < 0 || g->color_frames < 0)
+        return 0;
+
+    /* DIR_STOP follows the directions of motion (it equals NUM_DIRS) */
+    if (g->dir < 0 || g->dir > DIR_STOP ||
+        g->next_dir < 0 || g->next_dir > DIR_STOP ||
+        g->last_dir < 0 || g->last_dir >= NUM_DIRS)
+        return 0;
+
+    /* inside the outer wall, at most a square's width from a square */
+    if (g->play_x < BLOCK_X_DIM || g->play_x > x_pixels - 2 * BLOCK_X_DIM ||
+        g->play_y < BLOCK_Y_DIM || g->play_y > y_pixels - 2 * BLOCK_Y_DIM)
+        return 0;
+
+    /* on the lattice line of the motion, move_cnt pixels from a square */
+    switch (g->dir) {
+        case DIR_UP:
+        case DIR_DOWN:
+            to_line = g->play_y + (g->dir == DIR_DOWN ? g->move_cnt : -g->move_cnt);
+            if (g->move_cnt < 0 || g->move_cnt > BLOCK_Y_DIM ||
+                g->play_x % BLOCK_X_DIM != 0 || to_line % BLOCK_Y_DIM != 0)
+                return 0;
+            break;
+        case DIR_LEFT:
+        case DIR_RIGHT:
+            to_line = g->play_x + (g->dir == DIR_RIGHT ? g->move_cnt : -g->move_cnt);
+            if (g->move_cnt < 0 || g->move_cnt > BLOCK_X_DIM ||
+                g->play_y % BLOCK_Y_DIM != 0 || to_line % BLOCK_X_DIM != 0)
+                return 0;
+            break;
+        default:
+            if (g->move_cnt != 0 || g->play_x % BLOCK_X_DIM != 0 ||
+                g->play_y % BLOCK_Y_DIM != 0)
+                return 0;
+            break;
+    }
+
+    /* the view window never shows the outermost SHOW_MIN pixels */
+    if (g->map_x < SHOW_MIN ||
+        g->map_x > (unsigned int)(x_pixels - SHOW_MIN - SCROLL_X_DIM) ||
+        g->map_y < SHOW_MIN ||
+        g->map_y > (unsigned int)(y_pixels - SHOW_MIN - SCROLL_Y_DIM))
+        return 0;
+    return 1;
+}
+
+/*
+ * save_snapshot
+ *   DESCRIPTION: Write a maze and the state of the game played in it to
+ *                a snapshot file (see snapshot.h for the format).
+ *   INPUTS: path -- name of the file
+ *           m -- the maze
+ *           g -- the game state
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates or replaces the file
+ */
+int save_snapshot(const char* path, const maze_t* m, const snap_game_t* g) {
+    snap_file_t hdr;
+    unsigned char lattice[sizeof (m->maze)];
+    uint32_t len = SNAP_MAZE_LEN(m->x_dim, m->y_dim);
+    FILE* f;
+    int i, ok;
+
+    snap_put32(&hdr.magic, SNAP_MAGIC);
+    snap_put32(&hdr.version, SNAP_VERSION);
+    snap_put32(&hdr.size, sizeof (hdr) + len);
+    snap_put32(&hdr.maze_len, len);
+
+    snap_put32(&hdr.x_dim, m->x_dim);
+    snap_put32(&hdr.y_dim, m->y_dim);
+    snap_put32(&hdr.n_fruits, m->n_fruits);
+    snap_put32(&hdr.exit_x, m->exit_x);
+    snap_put32(&hdr.exit_y, m->exit_y);
+    for (i = 0; i < 4; i++)
+        snap_put32(&hdr.rng[i], m->rng[i]);
+    snap_put32(&hdr.seed_lo, (uint32_t)m->seed);
+    snap_put32(&hdr.seed_hi, (uint32_t)((unsigned long long)m->seed >> 32));
+
+    snap_put32(&hdr.base_seed_lo, (uint32_t)g->base_seed);
+    snap_put32(&hdr.base_seed_hi,
+               (uint32_t)((unsigned long long)g->base_seed >> 32));
+    snap_put32(&hdr.level, g->level);
+    snap_put32(&hdr.maze_x_dim, g->maze_x_dim);
+    snap_put32(&hdr.maze_y_dim, g->maze_y_dim);
+    snap_put32(&hdr.initial_fruit_count, g->initial_fruit_count);
+    snap_put32(&hdr.time_to_first_fruit, g->time_to_first_fruit);
+    snap_put32(&hdr.time_between_fruits, g->time_between_fruits);
+    snap_put32(&hdr.tick_usec, g->tick_usec);
+    snap_put32(&hdr.map_x, g->map_x);
+    snap_put32(&hdr.map_y, g->map_y);
+    snap_put32(&hdr.play_x, g->play_x);
+    snap_put32(&hdr.play_y, g->play_y);
+    snap_put32(&hdr.last_dir, g->last_dir);
+    snap_put32(&hdr.dir, g->dir);
+    snap_put32(&hdr.next_dir, g->next_dir);
+    snap_put32(&hdr.move_cnt, g->move_cnt);
+    snap_put32(&hdr.elapsed, g->elapsed);
+    snap_put32(&hdr.text_timer, g->text_timer);
+    snap_put32(&hdr.fruit_found, g->fruit_found);
+    snap_put32(&hdr.fruit_num, g->fruit_num);
+    snap_put32(&hdr.color_frames, g->color_frames);
+
+    /* Queued redraws belong to the screen, not to the maze. */
+    for (i = 0; i < len; i++)
+        lattice[i] = m->maze[i] & ~MAZE_DIRTY;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return -1;
+    ok = (fwrite(&hdr, sizeof (hdr), 1, f) == 1 &&
+          fwrite(lattice, len, 1, f) == 1);
+    if (fclose(f) != 0)
+        ok = 0;
+    return (ok ? 0 : -1);
+}
+
+/*
+ * load_snapshot
+ *   DESCRIPTION: Read a maze and the state of the game played in it from
+ *                a snapshot file.  The file is mapped rather than read,
+ *                and the maze is not regenerated.
+ *   INPUTS: path -- name of the file
+ *   OUTPUTS: *m -- the maze, ready to be played
+ *            *g -- the game state
+ *   RETURN VALUE: 0 on success, -1 if the file cannot be read or is not
+ *                 a valid snapshot of this version
+ *   SIDE EFFECTS: none
+ */
+int load_snapshot(const char* path, maze_t* m, snap_game_t* g) {
+    const snap_file_t* f;
+    struct stat st;
+    uint32_t len;
+    void* map;
+    int fd, i, ret = -1;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof (snap_file_t)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    f = map;
+
+    /* Check the header before trusting any sizes in it. */
+    m->x_dim = snap_get32(&f->x_dim);
+    m->y_dim = snap_get32(&f->y_dim);
+    len = snap_get32(&f->maze_len);
+    if (snap_get32(&f->magic) != SNAP_MAGIC ||
+        snap_get32(&f->version) != SNAP_VERSION ||
+        snap_get32(&f->size) != st.st_size ||
+        m->x_dim < 1 || m->x_dim > MAZE_MAX_X_DIM ||
+        m->y_dim < 1 || m->y_dim > MAZE_MAX_Y_DIM ||
+        len != SNAP_MAZE_LEN(m->x_dim, m->y_dim) ||
+        sizeof (snap_file_t) + len != st.st_size)
+        goto done;
+
+    m->n_fruits = snap_get32(&f->n_fruits);
+    m->exit_x = snap_get32(&f->exit_x);
+    m->exit_y = snap_get32(&f->exit_y);
+    for (i = 0; i < 4; i++)
+        m->rng[i] = snap_get32(&f->rng[i]);
+    m->seed = snap_get32(&f->seed_lo);
+    if (sizeof (m->seed) > 4)
+        m->seed |= (unsigned long)((unsigned long long)
+                                   snap_get32(&f->seed_hi) << 32);
+    memcpy(m->maze, f->maze, len);
+    memset(m->maze + len, MAZE_WALL, sizeof (m->maze) - len);
+    if (restore_maze(m) != 0)
+        goto done;
+
+    g->base_seed = snap_get32(&f->base_seed_lo);
+    if (sizeof (g->base_seed) > 4)
+        g->base_seed |= (unsigned long)((unsigned long long)
+                                        snap_get32(&f->base_seed_hi) << 32);
+    g->level = snap_get32(&f->level);
+    g->maze_x_dim = snap_get32(&f->maze_x_dim);
+    g->maze_y_dim = snap_get32(&f->maze_y_dim);
+    g->initial_fruit_count = snap_get32(&f->initial_fruit_count);
+    g->time_to_first_fruit = snap_get32(&f->time_to_first_fruit);
+    g->time_between_fruits = snap_get32(&f->time_between_fruits);
+    g->tick_usec = snap_get32(&f->tick_usec);
+    g->map_x = snap_get32(&f->map_x);
+    g->map_y = snap_get32(&f->map_y);
+    g->play_x = snap_get32(&f->play_x);
+    g->play_y = snap_get32(&f->play_y);
+    g->last_dir = snap_get32(&f->last_dir);
+    g->dir = snap_get32(&f->dir);
+    g->next_dir = snap_get32(&f->next_dir);
+    g->move_cnt = snap_get32(&f->move_cnt);
+    g->elapsed = snap_get32(&f->elapsed);
+    g->text_timer = snap_get32(&f->text_timer);
+    g->fruit_found = snap_get32(&f->fruit_found);
+    g->fruit_num = snap_get32(&f->fruit_num);
+    g->color_frames = snap_get32(&f->color_frames);
+    if (g->maze_x_dim != m->x_dim || g->maze_y_dim != m->y_dim ||
+        !snap_game_ok(m, g))
+        goto done;
+    ret = 0;
+
+done:
+    munmap(map, st.st_size);
+    return ret;
+}
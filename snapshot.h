@@ -0,0 +1,118 @@
+/*
+ * tab:4
+ *
+ * snapshot.h - header file for saved maze game snapshots
+ *
+ * Filename:      snapshot.h
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "maze.h"
+
+/*
+ * NOTES
+ *
+ * A snapshot file holds one maze and the state of the game being played
+ * in it, so that a session can be resumed without building the maze
+ * again.  The file is a snap_file_t header followed by the maze lattice
+ * bytes.  Every header field is a 32-bit little-endian word at a fixed
+ * offset, so a mapped file can be read in place; readers should go
+ * through snap_get32 so that the format does not depend on the host.
+ *
+ * The version number is changed whenever the layout, or the meaning of a
+ * field, changes.  Files with a different version, size, or lattice
+ * length are rejected.  Version 2 counts text_timer and color_frames in
+ * simulation steps; version 1 counted them in drawn frames.
+ *
+ * A snapshot whose game state is outside the game's limits for a level
+ * (sim.h), or whose player or view window is not somewhere the game could
+ * have put them, is rejected as well.
+ *
+ * The distance fields of the maze are not saved; restore_maze rebuilds
+ * them from the lattice.  Queued redraws (MAZE_DIRTY) are not saved.
+ */
+#define SNAP_MAGIC      0x4E535A4D  /* "MZSN" in file byte order */
+#define SNAP_VERSION    2
+
+/* game state saved along with the maze */
+typedef struct {
+    unsigned long base_seed;    /* seed from which level mazes derive   */
+
+    /* game_info_t */
+    int level;                  /* level number (starts at 1)           */
+    int maze_x_dim, maze_y_dim;
+    int initial_fruit_count;
+    int time_to_first_fruit;
+    int time_between_fruits;
+    int tick_usec;
+    unsigned int map_x, map_y;  /* upper left pixel of view window      */
+
+    /* player */
+    int play_x, play_y;         /* pixel position in maze               */
+    int last_dir, dir, next_dir;
+    int move_cnt;               /* pixels left to next maze square      */
+
+    /* timers */
+    int elapsed;                /* seconds played in the level          */
+    int text_timer;             /* steps of fruit text shown, or -1     */
+    int fruit_found;            /* 1 if fruit text is being shown       */
+    int fruit_num;              /* fruit named by the text              */
+    int color_frames;           /* steps counted for player color       */
+} snap_game_t;
+
+/* file layout; all fields are little-endian */
+typedef struct {
+    uint32_t magic;             /* SNAP_MAGIC                           */
+    uint32_t version;           /* SNAP_VERSION                         */
+    uint32_t size;              /* total bytes in file                  */
+    uint32_t maze_len;          /* bytes of lattice after the header    */
+
+    /* maze_t */
+    uint32_t x_dim, y_dim;
+    uint32_t n_fruits;
+    uint32_t exit_x, exit_y;
+    uint32_t rng[4];            /* maze generator state                 */
+    uint32_t seed_lo, seed_hi;  /* maze seed                            */
+
+    /* snap_game_t, in field order */
+    uint32_t base_seed_lo, base_seed_hi;
+    uint32_t level;
+    uint32_t maze_x_dim, maze_y_dim;
+    uint32_t initial_fruit_count;
+    uint32_t time_to_first_fruit;
+    uint32_t time_between_fruits;
+    uint32_t tick_usec;
+    uint32_t map_x, map_y;
+    uint32_t play_x, play_y;
+    uint32_t last_dir, dir, next_dir;
+    uint32_t move_cnt;
+    uint32_t elapsed;
+    uint32_t text_timer;
+    uint32_t fruit_found;
+    uint32_t fruit_num;
+    uint32_t color_frames;
+
+    unsigned char maze[];       /* maze lattice (maze_len bytes)        */
+} snap_file_t;
+
+/* read a little-endian word of a snapshot file */
+static inline uint32_t snap_get32(const uint32_t* p) {
+    const unsigned char* b = (const unsigned char*)p;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+/* write a maze and game state to a file; returns 0 on success, -1 on failure */
+extern int save_snapshot(const char* path, const maze_t* m, const snap_game_t* g);
+
+/*
+ * read a maze and game state from a file; on success, the maze is ready
+ * to be played and the game state is within the limits above; returns 0
+ * on success, -1 on failure
+ */
+extern int load_snapshot(const char* path, maze_t* m, snap_game_t* g);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,372 @@
+/*
+ * tab:4
+ *
+ * tick.c - tick sources for the game loop (timerfd, nanosleep, RTC)
+ *
+ * Filename:      tick.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/rtc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "tick.h"
+
+#define NSEC_PER_SEC    1000000000L
+
+/* local functions--see function headers for details */
+static void ts_add_ns(struct timespec* ts, long long ns);
+static long long ts_diff_ns(const struct timespec* a, const struct timespec* b);
+static int open_rtc(tick_src_t* t);
+static void count_ticks(tick_src_t* t, long long due, long long missed);
+
+/*
+ * ts_add_ns
+ *   DESCRIPTION: Add a number of nanoseconds to a time.
+ *   INPUTS: ns -- nanoseconds to add (non-negative)
+ *   OUTPUTS: *ts -- the later time
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void ts_add_ns(struct timespec* ts, long long ns) {
+    ts->tv_sec += ns / NSEC_PER_SEC;
+    if ((ts->tv_nsec += ns % NSEC_PER_SEC) >= NSEC_PER_SEC) {
+        ts->tv_nsec -= NSEC_PER_SEC;
+        ts->tv_sec++;
+    }
+}
+
+/*
+ * ts_diff_ns
+ *   DESCRIPTION: Find the difference between two times.
+ *   INPUTS: a, b -- the times
+ *   OUTPUTS: none
+ *   RETURN VALUE: a - b, in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+static long long ts_diff_ns(const struct timespec* a, const struct timespec* b) {
+    return (long long)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC +
+           (a->tv_nsec - b->tv_nsec);
+}
+
+/*
+ * open_rtc
+ *   DESCRIPTION: Open /dev/rtc and start periodic interrupts at the
+ *                fastest power-of-two rate that the driver accepts.
+ *   INPUTS: none
+ *   OUTPUTS: t->fd, t->rtc_ns -- the open device and its interrupt period
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: programs the RTC
+ */
+static int open_rtc(tick_src_t* t) {
+    unsigned long hz;
+
+    if ((t->fd = open("/dev/rtc", O_RDONLY, 0)) < 0)
+        return -1;
+    for (hz = TICK_RTC_MAX_HZ; hz >= TICK_RTC_MIN_HZ; hz /= 2)
+        if (ioctl(t->fd, RTC_IRQP_SET, hz) == 0)
+            break;
+    if (hz < TICK_RTC_MIN_HZ || ioctl(t->fd, RTC_PIE_ON, 0) != 0) {
+        close(t->fd);
+        t->fd = -1;
+        return -1;
+    }
+    t->rtc_ns = NSEC_PER_SEC / hz;
+    return 0;
+}
+
+/*
+ * tick_open
+ *   DESCRIPTION: Open a tick source.  If the RTC is requested but cannot
+ *                be used, a timerfd source is opened instead.
+ *   INPUTS: kind -- kind of source wanted
+ *           period_usec -- tick period in microseconds
+ *   OUTPUTS: *t -- the tick source, with its kind set to the kind in use
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may program the RTC
+ */
+int tick_open(tick_src_t* t, tick_kind_t kind, int period_usec) {
+    t->fd = -1;
+    t->rtc_ns = 0;
+    t->waits = t->ticks = t->overruns = 0;
+    t->late_waits = 0;
+    t->max_late_ns = 0;
+
+    if (kind == TICK_RTC && open_rtc(t) != 0)
+        kind = TICK_TIMERFD;
+    if (kind == TICK_TIMERFD &&
+        (t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+        kind = TICK_NANOSLEEP;
+    t->kind = kind;
+
+    if (tick_set_period(t, period_usec) != 0) {
+        tick_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * tick_set_period
+ *   DESCRIPTION: Change the tick period.  Ticks already due are dropped,
+ *                and the next tick is due one new period from now.
+ *   INPUTS: t -- the tick source
+ *           period_usec -- new tick period in microseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: rearms the timer
+ */
+int tick_set_period(tick_src_t* t, int period_usec) {
+    struct itimerspec its;
+
+    if (period_usec <= 0)
+        return -1;
+    t->period_ns = period_usec * 1000L;
+    t->rtc_acc_ns = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t->next);
+    ts_add_ns(&t->next, t->period_ns);
+
+    if (t->kind == TICK_TIMERFD) {
+        its.it_value = t->next;
+        its.it_interval.tv_sec = t->period_ns / NSEC_PER_SEC;
+        its.it_interval.tv_nsec = t->period_ns % NSEC_PER_SEC;
+        if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * count_ticks
+ *   DESCRIPTION: Record a wakeup with some number of ticks due, and move
+ *                the deadline past them.  Lateness is measured from the
+ *                deadline of the earliest tick due.
+ *   INPUTS: t -- the tick source
+ *           due -- number of ticks due (at least 1)
+ *           missed -- number of those ticks that were due before the
+ *                     source could have woken the caller for them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the source's deadline and statistics
+ */
+static void count_ticks(tick_src_t* t, long long due, long long missed) {
+    struct timespec now;
+    long long late;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((late = ts_diff_ns(&now, &t->next)) > t->max_late_ns)
+        t->max_late_ns = late;
+    ts_add_ns(&t->next, due * t->period_ns);
+
+    t->waits++;
+    t->ticks += due;
+    if (missed > 0) {
+        t->overruns += missed;
+        t->late_waits++;
+    }
+}
+
+/*
+ * tick_wait
+ *   DESCRIPTION: Sleep until the next tick is due.
+ *   INPUTS: t -- the tick source
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of ticks due (more than one if the caller
+ *                 was late), or -1 on failure
+ *   SIDE EFFECTS: updates the source's statistics
+ */
+int tick_wait(tick_src_t* t) {
+    struct timespec now;
+    unsigned long data;
+    uint64_t expired;
+    long long due, missed = 0;
+    int ret;
+
+    switch (t->kind) {
+        case TICK_TIMERFD:
+            /* The kernel counts every period that has expired. */
+            do {
+                ret = read(t->fd, &expired, sizeof (expired));
+            } while (ret < 0 && errno == EINTR);
+            if (ret != sizeof (expired) || expired == 0)
+                return -1;
+            due = expired;
+            missed = due - 1;
+            break;
+
+        case TICK_NANOSLEEP:
+            while ((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                          &t->next, NULL)) == EINTR);
+            if (ret != 0)
+                return -1;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            due = ts_diff_ns(&now, &t->next) / t->period_ns + 1;
+            missed = due - 1;
+            break;
+
+        case TICK_RTC:
+            /*
+             * The count of interrupts since the last read is in the high
+             * bits of the data.  Interrupt time is given out as whole
+             * ticks; the remainder is kept for the next wait.  Several
+             * ticks per interrupt are expected when the RTC is slower
+             * than the tick rate, so only interrupts that passed without
+             * a read count as overruns.
+             */
+            do {
+                do {
+                    ret = read(t->fd, &data, sizeof (data));
+                } while (ret < 0 && errno == EINTR);
+                if (ret != sizeof (data) || (data >> 8) == 0)
+                    return -1;
+                t->rtc_acc_ns += (data >> 8) * t->rtc_ns;
+                missed += (data >> 8) - 1;
+            } while (t->rtc_acc_ns < t->period_ns);
+            due = t->rtc_acc_ns / t->period_ns;
+            t->rtc_acc_ns -= due * t->period_ns;
+            missed = (missed * t->rtc_ns + t->period_ns / 2) / t->period_ns;
+            break;
+
+        default:
+            return -1;
+    }
+
+    count_ticks(t, due, missed);
+    return (due > 0x7FFFFFFF ? 0x7FFFFFFF : due);
+}
+
+/*
+ * tick_close
+ *   DESCRIPTION: Release a tick source.
+ *   INPUTS: t -- the tick source
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: stops RTC interrupts if the RTC was in use
+ */
+void tick_close(tick_src_t* t) {
+    if (t->fd < 0)
+        return;
+    if (t->kind == TICK_RTC)
+        (void)ioctl(t->fd, RTC_PIE_OFF, 0);
+    close(t->fd);
+    t->fd = -1;
+}
+
+/*
+ * tick_kind_name
+ *   DESCRIPTION: Name a kind of tick source, as for command-line options.
+ *   INPUTS: kind -- the kind of source
+ *   OUTPUTS: none
+ *   RETURN VALUE: the name ("timerfd", "sleep", or "rtc")
+ *   SIDE EFFECTS: none
+ */
+const char* tick_kind_name(tick_kind_t kind) {
+    static const char* names[NUM_TICK_KINDS] = {"timerfd", "sleep", "rtc"};
+
+    return (kind < NUM_TICK_KINDS ? names[kind] : "?");
+}
+
+/*
+ * tick_print_stats
+ *   DESCRIPTION: Print the statistics of a tick source.
+ *   INPUTS: t -- the tick source
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints to stdout
+ */
+void tick_print_stats(const tick_src_t* t) {
+    printf("Ticks (%s): %llu in %llu wakeups, %llu overrun in %lu late "
+           "wakeups, max lateness %ld us\n",
+           tick_kind_name(t->kind), t->ticks, t->waits, t->overruns,
+           t->late_waits, t->max_late_ns / 1000);
+}
+
+/*
+ * tick_accum_init
+ *   DESCRIPTION: Start a simulation step accumulator with no step period
+ *                and clear its statistics.  tick_accum_set_step must be
+ *                called before the first frame.
+ *   INPUTS: max_steps -- most steps to give out per frame (at least 1)
+ *   OUTPUTS: *a -- the accumulator
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void tick_accum_init(tick_accum_t* a, int max_steps) {
+    a->step_ns = 0;
+    a->max_steps = (max_steps < 1 ? 1 : max_steps);
+    a->acc_ns = 0;
+    clock_gettime(CLOCK_MONOTONIC, &a->last);
+    a->frames = a->steps = a->dropped_ns = 0;
+    a->capped_frames = 0;
+}
+
+/*
+ * tick_accum_set_step
+ *   DESCRIPTION: Change the simulation step period, as at the start of
+ *                each level.  Time elapsed before the change is dropped
+ *                without being counted, so the first step is owed one
+ *                step period from now.
+ *   INPUTS: a -- the accumulator
+ *           step_usec -- new step period in microseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int tick_accum_set_step(tick_accum_t* a, int step_usec) {
+    if (step_usec <= 0)
+        return -1;
+    a->step_ns = step_usec * 1000L;
+    a->acc_ns = 0;
+    clock_gettime(CLOCK_MONOTONIC, &a->last);
+    return 0;
+}
+
+/*
+ * tick_accum_steps
+ *   DESCRIPTION: Add the real time elapsed since the last frame and give
+ *                out the whole steps owed, up to the accumulator's cap.
+ *                Time owed beyond the cap is dropped and counted; the
+ *                part of a step left over is kept for the next frame.
+ *   INPUTS: a -- the accumulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of steps to run (0 to max_steps)
+ *   SIDE EFFECTS: updates the accumulator's statistics
+ */
+int tick_accum_steps(tick_accum_t* a) {
+    struct timespec now;
+    long long due;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    a->acc_ns += ts_diff_ns(&now, &a->last);
+    a->last = now;
+    a->frames++;
+
+    due = a->acc_ns / a->step_ns;
+    a->acc_ns -= due * a->step_ns;
+    if (due > a->max_steps) {
+        a->dropped_ns += (due - a->max_steps) * a->step_ns;
+        a->capped_frames++;
+        due = a->max_steps;
+    }
+    a->steps += due;
+    return due;
+}
+
+/*
+ * tick_accum_print_stats
+ *   DESCRIPTION: Print the statistics of a step accumulator.
+ *   INPUTS: a -- the accumulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints to stdout
+ */
+void tick_accum_print_stats(const tick_accum_t* a) {
+    printf("Steps: %llu in %llu frames, %llu ms dropped in %lu frames "
+           "over the cap of %d\n", a->steps, a->frames,
+           a->dropped_ns / 1000000, a->capped_frames, a->max_steps);
+}
@@ -0,0 +1,115 @@
+/*
+ * tab:4
+ *
+ * tick.h - header file for the game's tick sources
+ *
+ * Filename:      tick.h
+ */
+
+#ifndef TICK_H
+#define TICK_H
+
+#include <time.h>
+
+/*
+ * NOTES
+ *
+ * A tick source wakes the game loop once per tick period and says how
+ * many ticks are due.  Deadlines are absolute (start + k * period on the
+ * monotonic clock), so a late wakeup never pushes later ticks back and
+ * the tick rate does not drift.  Three sources are provided:
+ *
+ *   TICK_TIMERFD   -- a periodic timerfd armed with an absolute start
+ *   TICK_NANOSLEEP -- clock_nanosleep to each absolute deadline
+ *   TICK_RTC       -- periodic interrupts from /dev/rtc, converted to the
+ *                     tick period by accumulating interrupt time
+ *
+ * The RTC runs at a fixed power-of-two rate chosen at open; tick_open
+ * tries TICK_RTC_MAX_HZ and halves the rate until the driver accepts it
+ * (the rate is limited by /proc/sys/dev/rtc/max-user-freq).  If /dev/rtc
+ * cannot be used at all, tick_open falls back to TICK_TIMERFD.
+ *
+ * The period can be changed at any time (as at the start of each level);
+ * the new schedule starts one period after the change.
+ *
+ * Each source counts the deadlines that passed before the loop woke for
+ * an earlier one (overruns), and the largest lateness of a wakeup.
+ *
+ * The game loop wakes once per frame, and a frame may be longer than a
+ * simulation step.  A step accumulator (tick_accum_t) decouples the two:
+ * at each wakeup it adds the real time elapsed since the last wakeup,
+ * and says how many whole steps are owed.  The remainder is kept for the
+ * next frame, so the simulation runs at its own rate however frames are
+ * timed.  At most max_steps steps are given out per frame; time owed
+ * beyond that is dropped (the game slows down rather than spiralling
+ * behind) and counted.
+ */
+
+#define TICK_RTC_MAX_HZ     1024    /* fastest RTC rate requested    */
+#define TICK_RTC_MIN_HZ     2       /* slowest RTC rate accepted     */
+
+/* kinds of tick sources */
+typedef enum {
+    TICK_TIMERFD, TICK_NANOSLEEP, TICK_RTC, NUM_TICK_KINDS
+} tick_kind_t;
+
+/* a tick source and its statistics */
+typedef struct {
+    tick_kind_t kind;           /* kind of source in use                */
+    int fd;                     /* timerfd or /dev/rtc, or -1           */
+    long period_ns;             /* tick period                          */
+    struct timespec next;       /* deadline of the next tick            */
+    long rtc_ns;                /* RTC interrupt period                 */
+    long rtc_acc_ns;            /* RTC time not yet given out as ticks  */
+
+    unsigned long long waits;   /* calls to tick_wait                   */
+    unsigned long long ticks;   /* ticks given out                      */
+    unsigned long long overruns;/* ticks that were due before a wakeup  */
+    unsigned long late_waits;   /* wakeups with more than one tick due  */
+    long max_late_ns;           /* largest lateness of a wakeup         */
+} tick_src_t;
+
+/* a simulation step accumulator and its statistics */
+typedef struct {
+    long step_ns;               /* simulation step period               */
+    int max_steps;              /* most steps given out per frame       */
+    long long acc_ns;           /* time elapsed but not yet stepped     */
+    struct timespec last;       /* time of the last frame               */
+
+    unsigned long long frames;  /* calls to tick_accum_steps            */
+    unsigned long long steps;   /* steps given out                      */
+    unsigned long long dropped_ns;  /* time dropped by the cap          */
+    unsigned long capped_frames;/* frames that hit the cap              */
+} tick_accum_t;
+
+/* open a tick source of a given kind; returns 0 on success, -1 on failure */
+extern int tick_open(tick_src_t* t, tick_kind_t kind, int period_usec);
+
+/* change the tick period; the next tick is one period from now */
+extern int tick_set_period(tick_src_t* t, int period_usec);
+
+/* wait for the next tick; returns the number of ticks due, or -1 */
+extern int tick_wait(tick_src_t* t);
+
+/* release a tick source */
+extern void tick_close(tick_src_t* t);
+
+/* name of a kind of tick source */
+extern const char* tick_kind_name(tick_kind_t kind);
+
+/* print a tick source's statistics */
+extern void tick_print_stats(const tick_src_t* t);
+
+/* start a step accumulator that gives out at most max_steps per frame */
+extern void tick_accum_init(tick_accum_t* a, int max_steps);
+
+/* change the step period; time already elapsed is dropped uncounted */
+extern int tick_accum_set_step(tick_accum_t* a, int step_usec);
+
+/* add the time since the last frame; returns the number of steps owed */
+extern int tick_accum_steps(tick_accum_t* a);
+
+/* print a step accumulator's statistics */
+extern void tick_accum_print_stats(const tick_accum_t* a);
+
+#endif /* TICK_H */
@@ -0,0 +1,269 @@
+/*
+ * tab:4
+ *
+ * timer.c - hierarchical timer wheel for timed game events
+ *
+ * Filename:      timer.c
+ */
+
+#include "timer.h"
+
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+/* local functions--see function headers for details */
+static void link_init(timer_link_t* l);
+static void link_remove(timer_link_t* l);
+static void link_add_tail(timer_link_t* head, timer_link_t* l);
+static void link_move(timer_link_t* from, timer_link_t* to);
+static void place_timer(timer_wheel_t* w, game_timer_t* t);
+static void cascade(timer_wheel_t* w, int level);
+
+/*
+ * link_init
+ *   DESCRIPTION: Make a link, or a list head, point to itself (an empty
+ *                list, or a timer that is not pending).
+ *   INPUTS: l -- the link
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void link_init(timer_link_t* l) {
+    l->next = l->prev = l;
+}
+
+/*
+ * link_remove
+ *   DESCRIPTION: Take a link out of its list, if it is in one.
+ *   INPUTS: l -- the link
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the list
+ */
+static void link_remove(timer_link_t* l) {
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    link_init(l);
+}
+
+/*
+ * link_add_tail
+ *   DESCRIPTION: Add a link at the end of a list.
+ *   INPUTS: head -- head of the list
+ *           l -- the link, not in any list
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the list
+ */
+static void link_add_tail(timer_link_t* head, timer_link_t* l) {
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+/*
+ * link_move
+ *   DESCRIPTION: Move every link of one list to another, empty list.
+ *   INPUTS: from -- head of the list to be emptied
+ *           to -- head of an empty list
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes both lists
+ */
+static void link_move(timer_link_t* from, timer_link_t* to) {
+    if (from->next == from) {
+        link_init(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    link_init(from);
+}
+
+/*
+ * place_timer
+ *   DESCRIPTION: Put a timer in the slot for its expiry tick: in level 0
+ *                if it is due within TIMER_SLOTS ticks, otherwise in the
+ *                lowest level whose slots span its delay.
+ *   INPUTS: w -- the wheel
+ *           t -- the timer, not pending, expiring no earlier than now and
+ *                no more than TIMER_MAX_DELAY ticks from now
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the wheel
+ */
+static void place_timer(timer_wheel_t* w, game_timer_t* t) {
+    unsigned long delay = t->expires - w->now;
+    int level;
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+        if (delay < (1UL << (TIMER_SLOT_BITS * (level + 1))))
+            break;
+    link_add_tail(&w->slot[level][(t->expires >> (TIMER_SLOT_BITS * level)) &
+                                  TIMER_SLOT_MASK], &t->link);
+}
+
+/*
+ * cascade
+ *   DESCRIPTION: Move the timers of the current slot of a level down to
+ *                the lower levels, first doing the same for the level
+ *                above if its current slot also starts now.  Called when
+ *                the level below has wrapped around.
+ *   INPUTS: w -- the wheel
+ *           level -- the level (1 or more)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the wheel
+ */
+static void cascade(timer_wheel_t* w, int level) {
+    int idx = (w->now >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+    timer_link_t list;  /* timers being moved down */
+    game_timer_t* t;
+
+    if (idx == 0 && level < TIMER_LEVELS - 1)
+        cascade(w, level + 1);
+
+    link_move(&w->slot[level][idx], &list);
+    while (list.next != &list) {
+        t = (game_timer_t*)list.next;
+        link_remove(&t->link);
+        place_timer(w, t);
+    }
+}
+
+/*
+ * timer_wheel_init
+ *   DESCRIPTION: Start an empty timer wheel at tick 0.  Timers that were
+ *                on the wheel are forgotten, and must be set up again
+ *                with timer_init before they are added.
+ *   INPUTS: none
+ *   OUTPUTS: *w -- the wheel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_wheel_init(timer_wheel_t* w) {
+    int level, idx;
+
+    w->now = 0;
+    w->fired = 0;
+    for (level = 0; level < TIMER_LEVELS; level++)
+        for (idx = 0; idx < TIMER_SLOTS; idx++)
+            link_init(&w->slot[level][idx]);
+}
+
+/*
+ * timer_init
+ *   DESCRIPTION: Set up a timer that is not pending.
+ *   INPUTS: fn -- callback to run when the timer expires
+ *           arg -- argument for the callback
+ *   OUTPUTS: *t -- the timer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_init(game_timer_t* t, timer_fn_t fn, void* arg) {
+    link_init(&t->link);
+    t->expires = t->period = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+/*
+ * timer_add
+ *   DESCRIPTION: Start a timer, or restart it if it is pending.  Delays
+ *                and periods are limited to 1 to TIMER_MAX_DELAY ticks.
+ *   INPUTS: w -- the wheel
+ *           t -- the timer
+ *           delay -- ticks from now until the callback runs
+ *           period -- ticks between later runs, or 0 to run once
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the wheel
+ */
+void timer_add(timer_wheel_t* w, game_timer_t* t, unsigned long delay,
+               unsigned long period) {
+    link_remove(&t->link);
+    if (delay < 1)
+        delay = 1;
+    if (delay > TIMER_MAX_DELAY)
+        delay = TIMER_MAX_DELAY;
+    if (period > TIMER_MAX_DELAY)
+        period = TIMER_MAX_DELAY;
+    t->expires = w->now + delay;
+    t->period = period;
+    place_timer(w, t);
+}
+
+/*
+ * timer_cancel
+ *   DESCRIPTION: Stop a timer.  Does nothing if the timer is not pending.
+ *   INPUTS: t -- the timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the timer's wheel
+ */
+void timer_cancel(game_timer_t* t) {
+    link_remove(&t->link);
+}
+
+/*
+ * timer_pending
+ *   DESCRIPTION: Check whether a timer is on a wheel.
+ *   INPUTS: t -- the timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the timer is pending, 0 if not
+ *   SIDE EFFECTS: none
+ */
+int timer_pending(const game_timer_t* t) {
+    return (t->link.next != &t->link);
+}
+
+/*
+ * timer_remaining
+ *   DESCRIPTION: Find how long until a timer runs.
+ *   INPUTS: w -- the wheel
+ *           t -- the timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: ticks until the callback runs, or 0 if the timer is
+ *                 not pending
+ *   SIDE EFFECTS: none
+ */
+unsigned long timer_remaining(const timer_wheel_t* w, const game_timer_t* t) {
+    return (timer_pending(t) ? t->expires - w->now : 0);
+}
+
+/*
+ * timer_advance
+ *   DESCRIPTION: Move a wheel forward one tick at a time, running the
+ *                callback of each timer as it expires.  Periodic timers
+ *                are put back on the wheel before their callbacks run.
+ *   INPUTS: w -- the wheel
+ *           ticks -- number of ticks to move
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs callbacks; changes the wheel
+ */
+void timer_advance(timer_wheel_t* w, unsigned long ticks) {
+    timer_link_t run;   /* timers expiring on this tick */
+    game_timer_t* t;
+    int idx;
+
+    while (ticks-- > 0) {
+        idx = (++w->now) & TIMER_SLOT_MASK;
+        if (idx == 0)
+            cascade(w, 1);
+
+        link_move(&w->slot[0][idx], &run);
+        while (run.next != &run) {
+            t = (game_timer_t*)run.next;
+            link_remove(&t->link);
+            if (t->period != 0) {
+                t->expires += t->period;
+                place_timer(w, t);
+            }
+            w->fired++;
+            t->fn(w, t, t->arg);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * tab:4
+ *
+ * timer.h - header file for the timer wheel that runs timed game events
+ *
+ * Filename:      timer.h
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * NOTES
+ *
+ * Timed events within a level (fruit appearing, the fruit text going
+ * away, the player's color cycling, the clock changing) are kept on a
+ * hierarchical timer wheel that runs on simulation ticks, so they keep
+ * game time however frames are drawn.  Each call to timer_advance moves
+ * the wheel forward by some ticks and calls the callback of every timer
+ * that expires, in order of expiry.
+ *
+ * The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots.  A timer due
+ * within TIMER_SLOTS ticks sits in a slot of level 0, indexed by its
+ * expiry tick; one due later sits in the slot of the first level whose
+ * slots span the delay.  Each time level 0 wraps around, the next slot
+ * of level 1 is emptied into level 0 (and likewise up the levels), so a
+ * tick costs the timers that expire plus, now and then, a slot moved
+ * down a level.  Delays longer than the wheel spans are cut to its span.
+ *
+ * Timers are embedded in their owners (no allocation).  A timer must be
+ * set up with timer_init before it is first added, and again whenever
+ * its wheel is reinitialized.  A callback may add or cancel any timer,
+ * including its own.  A periodic timer is put back on the wheel before
+ * its callback runs.
+ */
+
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)      /* slots per level  */
+#define TIMER_LEVELS    4                           /* levels of slots  */
+#define TIMER_MAX_DELAY ((1UL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+struct game_timer_s;
+struct timer_wheel_s;
+
+/* a timer callback; gets the wheel, the timer, and the timer's argument */
+typedef void (*timer_fn_t)(struct timer_wheel_s* w, struct game_timer_s* t,
+                           void* arg);
+
+/* link between timers in a slot (list heads are links too) */
+typedef struct timer_link_s {
+    struct timer_link_s* next;
+    struct timer_link_s* prev;
+} timer_link_t;
+
+/* a timer */
+typedef struct game_timer_s {
+    timer_link_t link;          /* place in a slot (first field)        */
+    unsigned long expires;      /* tick at which the callback runs      */
+    unsigned long period;       /* ticks between runs, or 0 for once    */
+    timer_fn_t fn;              /* callback                             */
+    void* arg;                  /* argument for the callback            */
+} game_timer_t;
+
+/* a timer wheel */
+typedef struct timer_wheel_s {
+    unsigned long now;          /* ticks since the wheel was started    */
+    unsigned long fired;        /* callbacks run                        */
+    timer_link_t slot[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel_t;
+
+/* start an empty wheel at tick 0 */
+extern void timer_wheel_init(timer_wheel_t* w);
+
+/* set up a timer with its callback; the timer is not pending */
+extern void timer_init(game_timer_t* t, timer_fn_t fn, void* arg);
+
+/*
+ * (re)start a timer to run delay ticks from now (at least 1), and then
+ * every period ticks if period is not 0
+ */
+extern void timer_add(timer_wheel_t* w, game_timer_t* t, unsigned long delay,
+                      unsigned long period);
+
+/* stop a timer if it is pending */
+extern void timer_cancel(game_timer_t* t);
+
+/* check whether a timer is pending */
+extern int timer_pending(const game_timer_t* t);
+
+/* ticks until a pending timer runs */
+extern unsigned long timer_remaining(const timer_wheel_t* w,
+                                     const game_timer_t* t);
+
+/* move the wheel forward, running the timers that expire */
+extern void timer_advance(timer_wheel_t* w, unsigned long ticks);
+
+#endif /* TIMER_H */
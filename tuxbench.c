@@ -0,0 +1,351 @@
+/*
+ * tab:4
+ *
+ * tuxbench.c - latency and LED throughput of the MTCP protocol on an
+ *              emulated Tux controller
+ *
+ * Filename:      tuxbench.c
+ */
+
+/*
+ * NOTES
+ *
+ * The benchmark needs no hardware and no driver: it starts a controller
+ * emulator (tuxemu) on a pty and drives it from user space with the same
+ * protocol code that the tuxctl driver uses (module/mtcp-core.c).  A host
+ * thread reads the pty, frames packets with mtcp_parse, and handles them
+ * as tuxctl_handle_packet does, under the lock the driver would hold.
+ *
+ * Two things are measured.  Button latency is the time from a button
+ * change at the controller to the host having the MTCP_BIOC_EVENT; the
+ * three bytes of the packet take at least three byte times on the line,
+ * so the excess over that is what the host path costs.  LED throughput is
+ * how many MTCP_LED_SET commands reach the controller, and how many
+ * TUX_SET_LED calls they carry, when values are set as fast as possible:
+ * with one command in flight, each one costs its six bytes out and its
+ * ACK back.  After the run, the LEDs are read back with MTCP_POLL_LEDS to
+ * check that they show the last value set.  Build with "make tuxbench".
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "tuxemu.h"
+
+#define BENCH_PRESSES   200     /* button changes timed                 */
+#define BENCH_SECS      2       /* seconds of LED updates               */
+#define BENCH_ACK_NS    100000000ULL    /* LED_ACK_TIMEOUT, 100 ms      */
+
+/* the user-space host: what the driver keeps for one controller */
+typedef struct {
+    int fd;                     /* the controller's tty (pty slave)     */
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects everything below            */
+    pthread_cond_t cond;        /* signaled when a packet is handled    */
+    int stop;                   /* set to end the host thread           */
+    mtcp_parser_t parser;
+    mtcp_led_t led;
+    unsigned long buttons;      /* as TUX_BUTTONS                       */
+    unsigned long long event_ns;    /* when the last button event came  */
+    unsigned long events;       /* button events handled                */
+    unsigned long acks;         /* MTCP_ACK packets handled             */
+    unsigned long led_cmds;     /* MTCP_LED_SET commands sent           */
+    unsigned long polls;        /* MTCP_POLL_LEDS replies completed     */
+} bench_host_t;
+
+/* local functions--see function headers for details */
+static void send_led(bench_host_t* h);
+static void handle_packet(bench_host_t* h, const unsigned char* pkt);
+static void* host_thread(void* arg);
+static int cmp_ull(const void* a, const void* b);
+static int wait_for(bench_host_t* h, unsigned long long deadline, int what);
+
+/*
+ * send_led
+ *   DESCRIPTION: Send the host's LED value to the controller and mark it
+ *                in flight, as the driver's send_led does.  Called with
+ *                the host lock held.
+ *   INPUTS: h -- the host
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to the controller
+ */
+static void send_led(bench_host_t* h) {
+    unsigned char cmd[MTCP_CMD_MAX];
+    int n = mtcp_led_cmd(h->led.seg, cmd);
+
+    if (write(h->fd, cmd, n) == n) {
+        mtcp_led_queued(&h->led, cmd, n, tuxemu_now());
+        h->led_cmds++;
+    }
+}
+
+/*
+ * handle_packet
+ *   DESCRIPTION: Handle a packet from the controller as the driver's
+ *                tuxctl_handle_packet does.  Called with the host lock
+ *                held.
+ *   INPUTS: h -- the host
+ *           pkt -- the packet
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may write to the controller
+ */
+static void handle_packet(bench_host_t* h, const unsigned char* pkt) {
+    unsigned char cmd[MTCP_CMD_MAX];
+    int n;
+
+    if (pkt[0] == MTCP_ACK) {
+        h->acks++;
+        if (mtcp_led_ack(&h->led))
+            send_led(h);
+    } else if (pkt[0] == MTCP_RESET) {
+        mtcp_led_replay(&h->led);
+        n = mtcp_init_cmd(cmd);
+        if (write(h->fd, cmd, n) == n)
+            mtcp_led_queued(&h->led, cmd, n, tuxemu_now());
+    } else if (mtcp_is_leds_poll(pkt[0])) {
+        if ((pkt[0] & ~0x3) == MTCP_LEDS_POLL1 && h->led.poll_half)
+            h->polls++;
+        (void)mtcp_led_poll_reply(&h->led, pkt);
+    } else if (pkt[0] == MTCP_BIOC_EVENT) {
+        h->event_ns = tuxemu_now();
+        h->buttons = mtcp_buttons(pkt[1], pkt[2]);
+        h->events++;
+    }
+}
+
+/*
+ * host_thread
+ *   DESCRIPTION: Read bytes from the controller, frame them into packets,
+ *                and handle each packet, until told to stop.
+ *   INPUTS: arg -- the host
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: wakes threads waiting on the host
+ */
+static void* host_thread(void* arg) {
+    bench_host_t* h = arg;
+    unsigned char buf[64];
+    unsigned char pkts[sizeof (buf) / MTCP_PKT_LEN + 1][MTCP_PKT_LEN];
+    int n, n_pkts, i;
+
+    while ((n = read(h->fd, buf, sizeof (buf))) > 0) {
+        pthread_mutex_lock(&h->lock);
+        n_pkts = mtcp_parse(&h->parser, buf, n, pkts);
+        for (i = 0; i < n_pkts; i++)
+            handle_packet(h, pkts[i]);
+        pthread_cond_broadcast(&h->cond);
+        n = h->stop;
+        pthread_mutex_unlock(&h->lock);
+        if (n)
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * cmp_ull
+ *   DESCRIPTION: Compare two unsigned long longs, for qsort.
+ *   INPUTS: a, b -- pointers to the values
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as *a is less than, equal
+ *                 to, or greater than *b
+ *   SIDE EFFECTS: none
+ */
+static int cmp_ull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * wait_for
+ *   DESCRIPTION: Wait, with the host lock held, until the host has handled
+ *                more button events than what (what >= 0), or has no LED
+ *                command in flight or pending and no command left to be
+ *                ACKed (what < 0).
+ *   INPUTS: h -- the host
+ *           deadline -- time at which to give up
+ *           what -- button event count to pass, or -1 for the LEDs
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the condition was met, 0 on timeout
+ *   SIDE EFFECTS: may sleep
+ */
+static int wait_for(bench_host_t* h, unsigned long long deadline, int what) {
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (what >= 0 ? h->events <= (unsigned long)what :
+           (mtcp_led_busy(&h->led) || h->led.unacked != 0)) {
+        if (tuxemu_now() >= deadline)
+            return 0;
+        (void)pthread_cond_timedwait(&h->cond, &h->lock, &ts);
+    }
+    return 1;
+}
+
+/*
+ * main
+ *   DESCRIPTION: Time button events and LED updates on an emulated
+ *                controller and print the results.
+ *   INPUTS: argc, argv -- "-b <baud>" speed of the line (default 9600)
+ *                         "-n <presses>" button changes to time
+ *                                        (default BENCH_PRESSES)
+ *                         "-t <secs>" seconds of LED updates
+ *                                     (default BENCH_SECS)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 on failure
+ *   SIDE EFFECTS: prints results
+ */
+int main(int argc, char* argv[]) {
+    static tuxemu_t emu;
+    static bench_host_t host;
+    bench_host_t* h = &host;
+    struct termios tio;
+    struct timespec ts;
+    pthread_condattr_t ca;
+    unsigned long long* lat;
+    unsigned long long t0, t1, end, sum, floor_ns;
+    unsigned long sets, cmds, value, leds;
+    unsigned char cmd[MTCP_CMD_MAX];
+    long baud = TUXEMU_BAUD;
+    int presses = BENCH_PRESSES, secs = BENCH_SECS;
+    int i, n, opt, ok = 1;
+
+    while ((opt = getopt(argc, argv, "b:n:t:")) != -1) {
+        switch (opt) {
+            case 'b': baud = atol(optarg); break;
+            case 'n': presses = atoi(optarg); break;
+            case 't': secs = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud] [-n presses] [-t secs]\n",
+                        argv[0]);
+                return 3;
+        }
+    }
+    if (presses < 1 || secs < 1 ||
+        (lat = malloc(presses * sizeof (*lat))) == NULL)
+        return 3;
+    if (tuxemu_start(&emu, baud) != 0)
+        return 3;
+
+    /* Open the controller's tty as the driver would. */
+    if ((h->fd = open(emu.slave_path, O_RDWR | O_NOCTTY)) < 0) {
+        perror(emu.slave_path);
+        tuxemu_stop(&emu);
+        return 3;
+    }
+    if (tcgetattr(h->fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        (void)tcsetattr(h->fd, TCSANOW, &tio);
+    }
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&h->cond, &ca);
+    mtcp_parser_init(&h->parser);
+    mtcp_led_init(&h->led);
+    if (pthread_create(&h->thread, NULL, host_thread, h) != 0) {
+        tuxemu_stop(&emu);
+        return 3;
+    }
+
+    /* TUX_INIT, then wait for the ACKs (and the power-on MTCP_RESET). */
+    pthread_mutex_lock(&h->lock);
+    n = mtcp_init_cmd(cmd);
+    if (write(h->fd, cmd, n) == n)
+        mtcp_led_queued(&h->led, cmd, n, tuxemu_now());
+    ok = wait_for(h, tuxemu_now() + 1000000000ULL, -1);
+    pthread_mutex_unlock(&h->lock);
+    usleep(100 * emu.byte_ns / 1000);   /* let the last ACKs go by */
+
+    /* button latency: press and release an arrow, one change at a time */
+    floor_ns = MTCP_PKT_LEN * emu.byte_ns;
+    for (i = 0; ok && i < presses; i++) {
+        pthread_mutex_lock(&h->lock);
+        n = h->events;
+        t0 = tuxemu_now();
+        tuxemu_set_buttons(&emu, (i & 1) ? 0x00 : 0x10);
+        ok = wait_for(h, t0 + 1000000000ULL, n);
+        lat[i] = h->event_ns - t0;
+        if (h->buttons != ((i & 1) ? 0x00 : 0x10))
+            ok = 0;
+        pthread_mutex_unlock(&h->lock);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: button event lost or wrong\n", argv[0]);
+        return 3;
+    }
+    qsort(lat, presses, sizeof (*lat), cmp_ull);
+    for (i = 0, sum = 0; i < presses; i++)
+        sum += lat[i];
+    printf("%ld baud, %d button events: latency min %.3f  avg %.3f  p50 %.3f"
+           "  p99 %.3f  max %.3f ms (line %.3f ms)\n", emu.baud, presses,
+           lat[0] / 1e6, sum / 1e6 / presses, lat[presses / 2] / 1e6,
+           lat[presses * 99 / 100] / 1e6, lat[presses - 1] / 1e6,
+           floor_ns / 1e6);
+
+    /* LED throughput: set a new value as fast as the lock allows */
+    sets = 0;
+    value = 0;
+    t0 = tuxemu_now();
+    end = t0 + secs * 1000000000ULL;
+    pthread_mutex_lock(&h->lock);
+    cmds = h->led_cmds;
+    pthread_mutex_unlock(&h->lock);
+    while ((t1 = tuxemu_now()) < end) {
+        value = 0x000F0000 | (sets & 0xFFFF);
+        pthread_mutex_lock(&h->lock);
+        if (mtcp_led_set(&h->led, value, t1, BENCH_ACK_NS))
+            send_led(h);
+        pthread_mutex_unlock(&h->lock);
+        sets++;
+    }
+    pthread_mutex_lock(&h->lock);
+    ok = wait_for(h, tuxemu_now() + 1000000000ULL, -1);
+    cmds = h->led_cmds - cmds;
+    pthread_mutex_unlock(&h->lock);
+    printf("%lu LED sets in %d s: %.1f commands/s (line allows %.1f)\n",
+           sets, secs, cmds / (double)secs,
+           1e9 / ((MTCP_CMD_MAX + MTCP_PKT_LEN) * emu.byte_ns));
+
+    /* read the LEDs back from the controller */
+    pthread_mutex_lock(&h->lock);
+    n = h->polls;
+    cmd[0] = MTCP_POLL_LEDS;
+    if (write(h->fd, cmd, 1) != 1)
+        ok = 0;
+    t1 = tuxemu_now() + 1000000000ULL;
+    ts.tv_sec = t1 / 1000000000ULL;
+    ts.tv_nsec = t1 % 1000000000ULL;
+    while (ok && h->polls == (unsigned long)n && tuxemu_now() < t1)
+        (void)pthread_cond_timedwait(&h->cond, &h->lock, &ts);
+    leds = h->led.value;
+    pthread_mutex_unlock(&h->lock);
+    printf("LEDs show %08lx, last set %08lx, polled %08lx: %s\n",
+           tuxemu_leds(&emu), value, leds,
+           (ok && tuxemu_leds(&emu) == value && leds == value) ? "ok" : "MISMATCH");
+    if (tuxemu_leds(&emu) != value || leds != value)
+        ok = 0;
+
+    printf("parser: %lu packets, %lu resyncs, %lu bytes dropped; "
+           "emulator: %lu commands, %lu errors\n", h->parser.packets,
+           h->parser.resyncs, h->parser.dropped, emu.cmds, emu.errors);
+
+    pthread_mutex_lock(&h->lock);
+    h->stop = 1;
+    pthread_mutex_unlock(&h->lock);
+    tuxemu_stop(&emu);      /* closes the pty, ending the host's read */
+    pthread_join(h->thread, NULL);
+    (void)close(h->fd);
+    free(lat);
+    return (ok ? 0 : 3);
+}
@@ -0,0 +1,628 @@
+/*
+ * tab:4
+ *
+ * tuxemu.c - pty-based Tux controller emulator
+ *
+ * Filename:      tuxemu.c
+ */
+
+#define _GNU_SOURCE     /* for ppoll */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tuxemu.h"
+
+#define TUXEMU_MASK     (TUXEMU_QUEUE - 1)
+
+/* local functions--see function headers for details */
+static void send_bytes(tuxemu_t* emu, const unsigned char* buf, int n);
+static void send_packet(tuxemu_t* emu, unsigned char a, unsigned char b,
+                        unsigned char c);
+static void power_on(tuxemu_t* emu);
+static unsigned long clk_value(const tuxemu_t* emu, unsigned long long now);
+static void clk_settle(tuxemu_t* emu, unsigned long long now);
+static int cmd_length(const unsigned char* cmd, int len);
+static void run_command(tuxemu_t* emu);
+static void take_byte(tuxemu_t* emu, unsigned char c);
+static void wake_thread(tuxemu_t* emu);
+static void* emu_thread(void* arg);
+
+/*
+ * tuxemu_now
+ *   DESCRIPTION: Read the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the time in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+unsigned long long tuxemu_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * send_bytes
+ *   DESCRIPTION: Put bytes on the line to the host.  Each one crosses the
+ *                line a byte time after the one before it (or after now,
+ *                if the line is idle).  Bytes that do not fit are lost.
+ *                Called with the lock held.
+ *   INPUTS: emu -- the emulator
+ *           buf, n -- the bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the tx queue
+ */
+static void send_bytes(tuxemu_t* emu, const unsigned char* buf, int n) {
+    unsigned long long now = tuxemu_now();
+    tuxemu_byte_t* b;
+
+    if (emu->tx_free_ns < now)
+        emu->tx_free_ns = now;
+    while (n-- > 0) {
+        if (emu->tx_head - emu->tx_tail == TUXEMU_QUEUE) {
+            emu->dropped++;
+            continue;
+        }
+        emu->tx_free_ns += emu->byte_ns;
+        b = &emu->tx[emu->tx_head++ & TUXEMU_MASK];
+        b->byte = *buf++;
+        b->due_ns = emu->tx_free_ns;
+    }
+}
+
+/*
+ * send_packet
+ *   DESCRIPTION: Send a 3-byte response packet to the host, setting the
+ *                high bit of the two data bytes.  Called with the lock
+ *                held.
+ *   INPUTS: emu -- the emulator
+ *           a, b, c -- the opcode and data bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the tx queue
+ */
+static void send_packet(tuxemu_t* emu, unsigned char a, unsigned char b,
+                        unsigned char c) {
+    unsigned char pkt[MTCP_PKT_LEN];
+
+    pkt[0] = a;
+    pkt[1] = b | MTCP_PKT_FRAME;
+    pkt[2] = c | MTCP_PKT_FRAME;
+    send_bytes(emu, pkt, MTCP_PKT_LEN);
+}
+
+/*
+ * power_on
+ *   DESCRIPTION: Put the controller in the state it has after a reset:
+ *                no button events, LEDs blank and in clock mode, the
+ *                clock stopped at zero, and no command partly received.
+ *                Called with the lock held.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the controller
+ */
+static void power_on(tuxemu_t* emu) {
+    emu->bioc = 0;
+    emu->led_clk = 1;
+    memset(emu->seg, 0, sizeof (emu->seg));
+    emu->clk_secs = 0;
+    emu->clk_max = 99 * 60 + 59;
+    emu->clk_up = 0;
+    emu->clk_run = 0;
+    emu->clk_ns = tuxemu_now();
+    emu->cmd_len = 0;
+}
+
+/*
+ * clk_value
+ *   DESCRIPTION: Find the seconds on the clock at a time.  Called with the
+ *                lock held.
+ *   INPUTS: emu -- the emulator
+ *           now -- the time, from tuxemu_now
+ *   OUTPUTS: none
+ *   RETURN VALUE: the clock's value
+ *   SIDE EFFECTS: none
+ */
+static unsigned long clk_value(const tuxemu_t* emu, unsigned long long now) {
+    unsigned long secs;
+
+    if (!emu->clk_run)
+        return emu->clk_secs;
+    secs = (now - emu->clk_ns) / 1000000000ULL;
+    if (!emu->clk_up)
+        return (emu->clk_secs > secs ? emu->clk_secs - secs : 0);
+    if (emu->clk_secs >= emu->clk_max)
+        return emu->clk_secs;
+    return (emu->clk_max - emu->clk_secs > secs ? emu->clk_secs + secs :
+            emu->clk_max);
+}
+
+/*
+ * clk_settle
+ *   DESCRIPTION: Bring the clock's value up to a time, keeping the phase
+ *                of its seconds, before a command changes it.  Called
+ *                with the lock held.
+ *   INPUTS: emu -- the emulator
+ *           now -- the time, from tuxemu_now
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the clock
+ */
+static void clk_settle(tuxemu_t* emu, unsigned long long now) {
+    unsigned long long secs = (now - emu->clk_ns) / 1000000000ULL;
+
+    emu->clk_secs = clk_value(emu, now);
+    if (emu->clk_run)
+        emu->clk_ns += secs * 1000000000ULL;
+    else
+        emu->clk_ns = now;
+}
+
+/*
+ * cmd_length
+ *   DESCRIPTION: Find the length of a command from its first bytes.
+ *   INPUTS: cmd -- the bytes received so far
+ *           len -- how many (at least 1)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the length of the whole command, or len + 1 if more
+ *                 bytes are needed to tell
+ *   SIDE EFFECTS: none
+ */
+static int cmd_length(const unsigned char* cmd, int len) {
+    int i, n;
+
+    switch (cmd[0]) {
+        case MTCP_LED_SET:
+            /* a bitmask of LEDs, then one byte for each LED in it */
+            if (len < 2)
+                return 2;
+            for (i = n = 0; i < 4; i++)
+                n += (cmd[1] >> i) & 1;
+            return 2 + n;
+        case MTCP_CLK_SET:
+        case MTCP_CLK_MAX:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+/*
+ * run_command
+ *   DESCRIPTION: Act on the command that has just been received, and send
+ *                its answer.  Called with the lock held.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the controller; sends packets
+ */
+static void run_command(tuxemu_t* emu) {
+    unsigned long long now = tuxemu_now();
+    unsigned long secs;
+    unsigned char b, c;
+    int i, j;
+
+    emu->cmds++;
+    clk_settle(emu, now);
+    switch (emu->cmd[0]) {
+        case MTCP_BIOC_ON:  emu->bioc = 1; break;
+        case MTCP_BIOC_OFF: emu->bioc = 0; break;
+        case MTCP_LED_USR:  emu->led_clk = 0; break;
+        case MTCP_LED_CLK:  emu->led_clk = 1; break;
+        case MTCP_LED_SET:
+            for (i = 0, j = 2; i < 4; i++)
+                if ((emu->cmd[1] >> i) & 1)
+                    emu->seg[i] = emu->cmd[j++];
+            emu->led_sets++;
+            break;
+        case MTCP_POLL:
+            mtcp_button_bytes(emu->buttons, &b, &c);
+            send_packet(emu, MTCP_POLL_OK, b, c);
+            return;
+        case MTCP_POLL_LEDS:
+            /* segment A of each LED goes in the low bits of the opcode */
+            send_packet(emu, MTCP_LEDS_POLL0 | (emu->seg[0] >> 7) |
+                        ((emu->seg[1] >> 7) << 1), emu->seg[0], emu->seg[1]);
+            send_packet(emu, MTCP_LEDS_POLL1 | (emu->seg[2] >> 7) |
+                        ((emu->seg[3] >> 7) << 1), emu->seg[2], emu->seg[3]);
+            return;
+        case MTCP_RESET_DEV:
+            power_on(emu);
+            send_packet(emu, MTCP_RESET, 0, 0);
+            return;
+        case MTCP_OFF:
+            send_packet(emu, MTCP_OFF_EVENT, 0, 0);
+            return;
+        case MTCP_CLK_RESET:
+            emu->clk_secs = 0;
+            emu->clk_up = 0;
+            emu->clk_run = 0;
+            break;
+        case MTCP_CLK_SET:
+            emu->clk_secs = emu->cmd[1] * 60 + emu->cmd[2];
+            emu->clk_ns = now;
+            break;
+        case MTCP_CLK_MAX:
+            emu->clk_max = emu->cmd[1] * 60 + emu->cmd[2];
+            break;
+        case MTCP_CLK_RUN:  emu->clk_run = 1; break;
+        case MTCP_CLK_STOP: emu->clk_run = 0; break;
+        case MTCP_CLK_UP:   emu->clk_up = 1; break;
+        case MTCP_CLK_DOWN: emu->clk_up = 0; break;
+        case MTCP_CLK_POLL:
+            secs = emu->clk_secs;
+            send_packet(emu, MTCP_POLL_OK, 0x80 | (secs / 60),
+                        0x80 | (emu->clk_run << 6) | (secs % 60));
+            return;
+        case MTCP_DBG_OFF:
+        case MTCP_MOUSE_OFF:
+        case MTCP_MOUSE_ON:
+            break;
+        default:
+            emu->errors++;
+            send_packet(emu, MTCP_ERROR, 0, 0);
+            return;
+    }
+    send_packet(emu, MTCP_ACK, 0, 0);
+}
+
+/*
+ * take_byte
+ *   DESCRIPTION: Add a byte that has crossed the line from the host to
+ *                the command being received, and run the command once it
+ *                is whole.  A byte that cannot start a command is
+ *                answered with MTCP_ERROR.  Called with the lock held.
+ *   INPUTS: emu -- the emulator
+ *           c -- the byte
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may run a command
+ */
+static void take_byte(tuxemu_t* emu, unsigned char c) {
+    if (emu->cmd_len == 0 && (c & MTCP_CMD_CHECK) != MTCP_CMD_CHECK) {
+        emu->errors++;
+        send_packet(emu, MTCP_ERROR, 0, 0);
+        return;
+    }
+    emu->cmd[emu->cmd_len++] = c;
+    emu->cmd_need = cmd_length(emu->cmd, emu->cmd_len);
+    if (emu->cmd_len == emu->cmd_need) {
+        run_command(emu);
+        emu->cmd_len = 0;
+    }
+}
+
+/*
+ * wake_thread
+ *   DESCRIPTION: Make the emulator thread look at its queues again.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to the wake pipe
+ */
+static void wake_thread(tuxemu_t* emu) {
+    char c = 0;
+
+    (void)write(emu->wake[1], &c, 1);
+}
+
+/*
+ * emu_thread
+ *   DESCRIPTION: Move bytes across the emulated line: take commands from
+ *                the pty as the host writes them, act on each byte once
+ *                it has crossed the line, and write answers to the pty
+ *                once they have crossed it.  Sleeps until the next byte
+ *                is due, the host writes, or it is woken.
+ *   INPUTS: arg -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: reads and writes the pty
+ */
+static void* emu_thread(void* arg) {
+    tuxemu_t* emu = arg;
+    unsigned char buf[TUXEMU_QUEUE];
+    struct pollfd fds[2];
+    struct timespec ts;
+    unsigned long long now, next;
+    int i, n;
+
+    fds[0].fd = emu->master;
+    fds[0].events = POLLIN;
+    fds[1].fd = emu->wake[0];
+    fds[1].events = POLLIN;
+
+    pthread_mutex_lock(&emu->lock);
+    while (!emu->stop) {
+        now = tuxemu_now();
+
+        /* bytes from the host that have crossed the line */
+        while (emu->rx_tail != emu->rx_head &&
+               emu->rx[emu->rx_tail & TUXEMU_MASK].due_ns <= now)
+            take_byte(emu, emu->rx[emu->rx_tail++ & TUXEMU_MASK].byte);
+
+        /* bytes to the host that have crossed the line */
+        for (n = 0; emu->tx_tail + n != emu->tx_head &&
+             emu->tx[(emu->tx_tail + n) & TUXEMU_MASK].due_ns <= now; n++)
+            buf[n] = emu->tx[(emu->tx_tail + n) & TUXEMU_MASK].byte;
+        if (n > 0 && (n = write(emu->master, buf, n)) > 0)
+            emu->tx_tail += n;
+
+        /* sleep until the next byte is due */
+        next = 0;
+        if (emu->rx_tail != emu->rx_head)
+            next = emu->rx[emu->rx_tail & TUXEMU_MASK].due_ns;
+        if (emu->tx_tail != emu->tx_head &&
+            (next == 0 || emu->tx[emu->tx_tail & TUXEMU_MASK].due_ns < next))
+            next = emu->tx[emu->tx_tail & TUXEMU_MASK].due_ns;
+        pthread_mutex_unlock(&emu->lock);
+
+        if (next > now) {
+            ts.tv_sec = (next - now) / 1000000000ULL;
+            ts.tv_nsec = (next - now) % 1000000000ULL;
+        } else {
+            /* the pty is full; wait it out by time, not by POLLOUT */
+            ts.tv_sec = 0;
+            ts.tv_nsec = 100000;
+        }
+        n = ppoll(fds, 2, (next == 0 ? NULL : &ts), NULL);
+
+        pthread_mutex_lock(&emu->lock);
+        if (n > 0 && (fds[1].revents & POLLIN))
+            (void)read(emu->wake[0], buf, sizeof (buf));
+        if (n > 0 && (fds[0].revents & POLLIN) &&
+            (n = read(emu->master, buf, sizeof (buf))) > 0) {
+            now = tuxemu_now();
+            if (emu->rx_free_ns < now)
+                emu->rx_free_ns = now;
+            for (i = 0; i < n; i++) {
+                if (emu->rx_head - emu->rx_tail == TUXEMU_QUEUE) {
+                    emu->dropped++;
+                    continue;
+                }
+                emu->rx_free_ns += emu->byte_ns;
+                emu->rx[emu->rx_head & TUXEMU_MASK].byte = buf[i];
+                emu->rx[emu->rx_head++ & TUXEMU_MASK].due_ns = emu->rx_free_ns;
+            }
+        }
+    }
+    pthread_mutex_unlock(&emu->lock);
+    return NULL;
+}
+
+/*
+ * tuxemu_start
+ *   DESCRIPTION: Open a pseudo-terminal, put its slave end in raw mode at
+ *                the given baud rate, and start emulating a controller,
+ *                just reset, on its master end.
+ *   INPUTS: baud -- speed of the emulated line in bits per second
+ *   OUTPUTS: *emu -- the emulator; emu->slave_path names the pty slave
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: prints an error message on failure; sends MTCP_RESET
+ */
+int tuxemu_start(tuxemu_t* emu, long baud) {
+    struct termios tio;
+    const char* name;
+
+    memset(emu, 0, sizeof (*emu));
+    emu->baud = (baud > 0 ? baud : TUXEMU_BAUD);
+    emu->byte_ns = 10 * 1000000000ULL / emu->baud;
+
+    if ((emu->master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+        grantpt(emu->master) != 0 || unlockpt(emu->master) != 0 ||
+        (name = ptsname(emu->master)) == NULL) {
+        perror("tuxemu: open pty");
+        if (emu->master >= 0)
+            (void)close(emu->master);
+        return -1;
+    }
+    snprintf(emu->slave_path, sizeof (emu->slave_path), "%s", name);
+
+    /* Holding the slave open keeps the master from seeing a hang-up. */
+    if ((emu->slave = open(emu->slave_path, O_RDWR | O_NOCTTY)) < 0) {
+        perror("tuxemu: open pty slave");
+        (void)close(emu->master);
+        return -1;
+    }
+    if (tcgetattr(emu->slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        (void)cfsetspeed(&tio, B9600);
+        (void)tcsetattr(emu->slave, TCSANOW, &tio);
+    }
+    (void)fcntl(emu->master, F_SETFL, O_NONBLOCK);
+
+    if (pipe(emu->wake) != 0) {
+        perror("tuxemu: pipe");
+        (void)close(emu->slave);
+        (void)close(emu->master);
+        return -1;
+    }
+    (void)fcntl(emu->wake[0], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&emu->lock, NULL);
+    power_on(emu);
+    send_packet(emu, MTCP_RESET, 0, 0);
+    if (pthread_create(&emu->thread, NULL, emu_thread, emu) != 0) {
+        fprintf(stderr, "tuxemu: cannot start thread\n");
+        (void)close(emu->wake[0]);
+        (void)close(emu->wake[1]);
+        (void)close(emu->slave);
+        (void)close(emu->master);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * tuxemu_stop
+ *   DESCRIPTION: Stop an emulator started by tuxemu_start and close its
+ *                pty.  Bytes still on the line are lost.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: ends the emulator thread
+ */
+void tuxemu_stop(tuxemu_t* emu) {
+    pthread_mutex_lock(&emu->lock);
+    emu->stop = 1;
+    pthread_mutex_unlock(&emu->lock);
+    wake_thread(emu);
+    pthread_join(emu->thread, NULL);
+    (void)close(emu->wake[0]);
+    (void)close(emu->wake[1]);
+    (void)close(emu->slave);
+    (void)close(emu->master);
+}
+
+/*
+ * tuxemu_set_buttons
+ *   DESCRIPTION: Change the buttons that are down.  If they changed and
+ *                interrupt on change is on, send an MTCP_BIOC_EVENT.
+ *   INPUTS: emu -- the emulator
+ *           buttons -- the buttons, in the form returned by TUX_BUTTONS
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may send a packet
+ */
+void tuxemu_set_buttons(tuxemu_t* emu, unsigned long buttons) {
+    unsigned char b, c;
+
+    buttons &= 0xFF;
+    pthread_mutex_lock(&emu->lock);
+    if (buttons != emu->buttons) {
+        emu->buttons = buttons;
+        if (emu->bioc) {
+            mtcp_button_bytes(buttons, &b, &c);
+            send_packet(emu, MTCP_BIOC_EVENT, b, c);
+            emu->events++;
+        }
+    }
+    pthread_mutex_unlock(&emu->lock);
+    wake_thread(emu);
+}
+
+/*
+ * tuxemu_reset
+ *   DESCRIPTION: Reset the controller and send MTCP_RESET, as the board's
+ *                RESET button does.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the controller; sends a packet
+ */
+void tuxemu_reset(tuxemu_t* emu) {
+    pthread_mutex_lock(&emu->lock);
+    power_on(emu);
+    send_packet(emu, MTCP_RESET, 0, 0);
+    pthread_mutex_unlock(&emu->lock);
+    wake_thread(emu);
+}
+
+/*
+ * tuxemu_leds
+ *   DESCRIPTION: Find what the LEDs set with MTCP_LED_SET show.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: none
+ *   RETURN VALUE: the display, in the form taken by TUX_SET_LED
+ *   SIDE EFFECTS: none
+ */
+unsigned long tuxemu_leds(tuxemu_t* emu) {
+    unsigned long value;
+
+    pthread_mutex_lock(&emu->lock);
+    value = mtcp_led_value(emu->seg);
+    pthread_mutex_unlock(&emu->lock);
+    return value;
+}
+
+/*
+ * tuxemu_clock
+ *   DESCRIPTION: Read the controller's clock.
+ *   INPUTS: emu -- the emulator
+ *   OUTPUTS: *secs -- the seconds on the clock
+ *   RETURN VALUE: 1 if the LEDs are in clock mode, 0 if in user mode
+ *   SIDE EFFECTS: none
+ */
+int tuxemu_clock(tuxemu_t* emu, unsigned long* secs) {
+    int shown;
+
+    pthread_mutex_lock(&emu->lock);
+    *secs = clk_value(emu, tuxemu_now());
+    shown = emu->led_clk;
+    pthread_mutex_unlock(&emu->lock);
+    return shown;
+}
+
+#if (TUXEMU_PROGRAM == 1)
+/*
+ * main
+ *   DESCRIPTION: Emulate a controller until end of input, printing the
+ *                path of its pty and each change of its LEDs (or of its
+ *                clock, while they show it).  Each line
+ *                of input is "b <hex>" to set the buttons (as in
+ *                TUX_BUTTONS), "r" to reset the controller, or "q" to quit.
+ *   INPUTS: argc, argv -- "-b <baud>" speed of the line (default 9600)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 on failure
+ *   SIDE EFFECTS: prints the pty path and the LEDs
+ */
+int main(int argc, char* argv[]) {
+    static tuxemu_t emu;
+    struct pollfd fd;
+    char line[80];
+    unsigned long leds, secs, shown = ~0UL;
+    long baud = TUXEMU_BAUD;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+            case 'b': baud = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud]\n", argv[0]);
+                return 3;
+        }
+    }
+    if (tuxemu_start(&emu, baud) != 0)
+        return 3;
+    printf("tux controller on %s at %ld baud\n", emu.slave_path, emu.baud);
+    fflush(stdout);
+
+    fd.fd = fileno(stdin);
+    fd.events = POLLIN;
+    while (1) {
+        /* clock values are kept apart from LED values by bit 31 */
+        if (tuxemu_clock(&emu, &secs))
+            leds = 0x80000000UL | secs;
+        else
+            leds = tuxemu_leds(&emu);
+        if (leds != shown) {
+            shown = leds;
+            if (leds & 0x80000000UL)
+                printf("clock %02lu:%02lu\n", secs / 60, secs % 60);
+            else
+                printf("LEDs %08lx\n", leds);
+            fflush(stdout);
+        }
+        if (poll(&fd, 1, 100) <= 0)
+            continue;
+        if (fgets(line, sizeof (line), stdin) == NULL || line[0] == 'q')
+            break;
+        if (line[0] == 'b')
+            tuxemu_set_buttons(&emu, strtoul(line + 1, NULL, 16));
+        else if (line[0] == 'r')
+            tuxemu_reset(&emu);
+    }
+    tuxemu_stop(&emu);
+    return 0;
+}
+#endif
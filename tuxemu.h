@@ -0,0 +1,114 @@
+/*
+ * tab:4
+ *
+ * tuxemu.h - header file for the pty-based Tux controller emulator
+ *
+ * Filename:      tuxemu.h
+ */
+
+#ifndef TUXEMU_H
+#define TUXEMU_H
+
+#include <pthread.h>
+
+#include "module/mtcp-core.h"
+
+/*
+ * NOTES
+ *
+ * The emulator plays a Tux controller at the master end of a pseudo-
+ * terminal, so that anything that drives a controller through a tty (the
+ * tuxctl line discipline set on the pty slave, or a user-space MTCP host
+ * such as tuxbench) can run with no hardware attached.  It answers the
+ * MTCP commands that the driver sends: MTCP_BIOC_ON/OFF, MTCP_LED_SET,
+ * MTCP_LED_USR/CLK, MTCP_POLL, MTCP_POLL_LEDS, MTCP_RESET_DEV and the
+ * MTCP_CLK_* commands, with an MTCP_ACK for each command that has no other
+ * answer, and sends an MTCP_BIOC_EVENT whenever tuxemu_set_buttons changes
+ * the buttons while interrupt on change is on.  The clock counts in whole
+ * seconds of the monotonic clock and stops at its limit (its maximum when
+ * counting up, zero when counting down); no MTCP_CLK_EVENT is sent.
+ *
+ * A pty moves bytes at memory speed, so the emulator models the serial
+ * line itself: each byte takes ten bit times at the chosen baud rate to
+ * cross the line in either direction, and the bytes of each direction
+ * cross one after another.  A command is acted on when its last byte has
+ * arrived, and its answer reaches the pty when its last byte has been
+ * sent.  A thread of its own does all of this; the functions below may
+ * be called from any thread.
+ */
+
+#define TUXEMU_QUEUE    256     /* bytes on the line each way; power of 2 */
+#define TUXEMU_BAUD     9600    /* the controller's baud rate             */
+
+/* a byte on the line */
+typedef struct {
+    unsigned long long due_ns;  /* time it has crossed the line           */
+    unsigned char byte;
+} tuxemu_byte_t;
+
+/* an emulated controller */
+typedef struct {
+    int master;                 /* pty master (the controller's end)      */
+    int slave;                  /* pty slave, held open for the host      */
+    char slave_path[64];        /* where the host opens the controller    */
+    long baud;                  /* line speed                             */
+    unsigned long long byte_ns; /* time to send one byte (ten bits)       */
+    int wake[2];                /* pipe that wakes the emulator thread    */
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects everything below              */
+    int stop;                   /* set to end the thread                  */
+
+    /* the controller */
+    int bioc;                   /* button interrupt on change is on       */
+    int led_clk;                /* LEDs are in clock mode                 */
+    unsigned char seg[4];       /* LEDs set with MTCP_LED_SET             */
+    unsigned long buttons;      /* buttons down, as TUX_BUTTONS           */
+    unsigned long clk_secs;     /* clock value at clk_ns, in seconds      */
+    unsigned long clk_max;      /* limit set with MTCP_CLK_MAX            */
+    int clk_up;                 /* the clock counts up                    */
+    int clk_run;                /* the clock is running                   */
+    unsigned long long clk_ns;  /* time the clock had clk_secs            */
+
+    /* the command being received */
+    unsigned char cmd[MTCP_CMD_MAX];
+    int cmd_len;                /* bytes of it so far                     */
+    int cmd_need;               /* bytes in the whole command             */
+
+    /* the line: rx carries commands in, tx carries packets out */
+    tuxemu_byte_t rx[TUXEMU_QUEUE];
+    tuxemu_byte_t tx[TUXEMU_QUEUE];
+    unsigned int rx_head, rx_tail;
+    unsigned int tx_head, tx_tail;
+    unsigned long long rx_free_ns;  /* when the last rx byte has crossed  */
+    unsigned long long tx_free_ns;  /* when the last tx byte has crossed  */
+
+    /* counts */
+    unsigned long cmds;         /* commands run                           */
+    unsigned long led_sets;     /* MTCP_LED_SET commands run              */
+    unsigned long events;       /* MTCP_BIOC_EVENT packets sent           */
+    unsigned long errors;       /* MTCP_ERROR packets sent                */
+    unsigned long dropped;      /* bytes lost to a full line queue        */
+} tuxemu_t;
+
+/* read the monotonic clock in nanoseconds */
+extern unsigned long long tuxemu_now();
+
+/* open a pty and start emulating a controller on it; 0 or -1 on error */
+extern int tuxemu_start(tuxemu_t* emu, long baud);
+
+/* stop the emulator and close the pty */
+extern void tuxemu_stop(tuxemu_t* emu);
+
+/* change the buttons that are down (in the form of TUX_BUTTONS) */
+extern void tuxemu_set_buttons(tuxemu_t* emu, unsigned long buttons);
+
+/* reset the controller, as its RESET button does */
+extern void tuxemu_reset(tuxemu_t* emu);
+
+/* what the LEDs show, in the form taken by TUX_SET_LED */
+extern unsigned long tuxemu_leds(tuxemu_t* emu);
+
+/* the seconds on the clock; returns 1 if the LEDs show it, else 0 */
+extern int tuxemu_clock(tuxemu_t* emu, unsigned long* secs);
+
+#endif /* TUXEMU_H */
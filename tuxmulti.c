@@ -0,0 +1,280 @@
+/*
+ * tab:4
+ *
+ * tuxmulti.c - checks that the tuxctl driver keeps two controllers apart
+ *
+ * Filename:      tuxmulti.c
+ */
+
+/*
+ * NOTES
+ *
+ * Two controllers are emulated on ptys (see tuxemu.h), the tuxctl line
+ * discipline is set on each pty slave, and the driver is then used on
+ * both at once, as two players (or two seats) would.  The program checks
+ * that each controller's tty sees only its own button events, in order,
+ * that the LEDs set through one tty change only that controller, that
+ * TUX_READ_LED and the mapped state page of each tty agree with it, and
+ * that resetting one controller replays its LEDs without touching the
+ * other.  Last, a TUX_BATCH on one controller is checked for the status
+ * of each of its commands and for their effect on that controller alone.
+ * It needs the tuxctl module to be loaded.  Build with "make tuxmulti".
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "module/tuxctl-ioctl.h"
+#include "tuxemu.h"
+
+#define MULTI_DEVS      2       /* controllers driven at once           */
+#define MULTI_PRESSES   64      /* button changes on each controller    */
+#define MULTI_WAIT_US   200000  /* time for the line to go quiet        */
+
+/* one controller, as seen from both ends */
+typedef struct {
+    tuxemu_t emu;               /* the controller                       */
+    int fd;                     /* its tty, using the tuxctl driver     */
+    const struct tux_state* state;  /* its mapped state page            */
+    unsigned long led;          /* value given to TUX_SET_LED           */
+    int n_events;               /* button events read                   */
+    int bad_events;             /* events out of order or not its own   */
+} multi_dev_t;
+
+/* local functions--see function headers for details */
+static int open_dev(multi_dev_t* d);
+static unsigned long press_value(int dev, int i);
+static void read_events(multi_dev_t* d, int dev);
+static int check_leds(multi_dev_t* d, int dev);
+static int check_batch(multi_dev_t* devs);
+
+/*
+ * open_dev
+ *   DESCRIPTION: Start an emulated controller, set the tuxctl line
+ *                discipline on its tty, initialize it, and map its state
+ *                page.
+ *   INPUTS: d -- the controller
+ *   OUTPUTS: *d -- the controller, ready for use
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: prints an error message on failure
+ */
+static int open_dev(multi_dev_t* d) {
+    int ldisc_num = N_MOUSE;
+    long page = sysconf(_SC_PAGESIZE);
+    int index, state_fd;
+    void* map;
+
+    if (tuxemu_start(&d->emu, TUXEMU_BAUD) != 0)
+        return -1;
+    if ((d->fd = open(d->emu.slave_path, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+        perror(d->emu.slave_path);
+        return -1;
+    }
+    if (ioctl(d->fd, TIOCSETD, &ldisc_num) != 0 ||
+        ioctl(d->fd, TUX_INIT, 0) != 0) {
+        fprintf(stderr, "%s: the tuxctl driver is not loaded\n",
+                d->emu.slave_path);
+        return -1;
+    }
+    if ((index = ioctl(d->fd, TUX_STATE_INDEX, 0)) < 0 ||
+        (state_fd = open("/dev/tuxctl", O_RDONLY)) < 0) {
+        perror("tuxctl state page");
+        return -1;
+    }
+    map = mmap(NULL, page, PROT_READ, MAP_SHARED, state_fd, (off_t)index * page);
+    (void)close(state_fd);
+    if (map == MAP_FAILED) {
+        perror("mmap tuxctl state page");
+        return -1;
+    }
+    d->state = map;
+    return 0;
+}
+
+/*
+ * press_value
+ *   DESCRIPTION: Find the buttons that a controller has down after its
+ *                i-th change.  The two controllers use different buttons
+ *                (arrows on the first, C B A START on the second), so an
+ *                event that reaches the wrong tty is caught.
+ *   INPUTS: dev -- the controller's number
+ *           i -- the change's number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buttons, in the form returned by TUX_BUTTONS
+ */
+static unsigned long press_value(int dev, int i) {
+    unsigned long b = 1UL << (i % 4);
+
+    if (i % 2 == 1)
+        return 0;
+    return (dev == 0 ? b << 4 : b);
+}
+
+/*
+ * read_events
+ *   DESCRIPTION: Read the button events queued on a controller's tty, and
+ *                count those that are not the next change it made.
+ *   INPUTS: d -- the controller
+ *           dev -- its number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes d's event counts
+ */
+static void read_events(multi_dev_t* d, int dev) {
+    struct tux_event ev[16];
+    int n, i;
+
+    while ((n = read(d->fd, ev, sizeof (ev))) >= (int)sizeof (ev[0])) {
+        for (i = 0; i < n / (int)sizeof (ev[0]); i++) {
+            if (ev[i].buttons != press_value(dev, d->n_events))
+                d->bad_events++;
+            d->n_events++;
+        }
+    }
+}
+
+/*
+ * check_leds
+ *   DESCRIPTION: Check that a controller shows the value set through its
+ *                tty, and that TUX_READ_LED and the state page agree.
+ *   INPUTS: d -- the controller
+ *           dev -- its number
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if all agree, 0 if not
+ *   SIDE EFFECTS: prints what disagrees
+ */
+static int check_leds(multi_dev_t* d, int dev) {
+    struct tux_state s;
+    unsigned long read_led = 0;
+
+    (void)ioctl(d->fd, TUX_READ_LED, &read_led);
+    (void)tux_state_read(d->state, &s);
+    if (tuxemu_leds(&d->emu) == d->led && read_led == d->led && s.led == d->led)
+        return 1;
+    printf("controller %d: set %08lx, shows %08lx, TUX_READ_LED %08lx, "
+           "page %08lx\n", dev, d->led, tuxemu_leds(&d->emu), read_led, s.led);
+    return 0;
+}
+
+/*
+ * check_batch
+ *   DESCRIPTION: Send a batch of commands to the first controller (a new
+ *                LED value, a clock start, a command a batch does not take,
+ *                and a clock stop) and check the status of each, that the
+ *                first controller shows the stopped clock over the new
+ *                value, and that the second controller is unchanged.
+ *   INPUTS: devs -- the controllers
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if all is as expected, 0 if not
+ *   SIDE EFFECTS: prints what is not
+ */
+static int check_batch(multi_dev_t* devs) {
+    struct tux_cmd cmds[4] = {
+        {TUX_SET_LED, 0x000F4321, 0},
+        {TUX_CLK_START, 90, 0},
+        {TUX_BUTTONS, 0, 0},
+        {TUX_CLK_STOP, 0, 0}
+    };
+    struct tux_batch batch = {4, cmds};
+    unsigned long secs;
+    int queued, shown, ok = 1;
+
+    queued = ioctl(devs[0].fd, TUX_BATCH, &batch);
+    if (queued != 3 || cmds[0].status != 0 || cmds[1].status != 0 ||
+        cmds[2].status != -EINVAL || cmds[3].status != 0) {
+        printf("batch: %d queued, status %ld %ld %ld %ld\n", queued,
+               cmds[0].status, cmds[1].status, cmds[2].status, cmds[3].status);
+        ok = 0;
+    }
+    devs[0].led = cmds[0].arg;
+    usleep(MULTI_WAIT_US);
+    shown = tuxemu_clock(&devs[0].emu, &secs);
+    if (!shown || secs != 90) {
+        printf("batch: clock %s, at %lu seconds\n", (shown ? "shown" : "not shown"),
+               secs);
+        ok = 0;
+    }
+    if (tuxemu_clock(&devs[1].emu, &secs)) {
+        printf("batch: clock shown on controller 1\n");
+        ok = 0;
+    }
+    ok &= check_leds(&devs[0], 0);
+    ok &= check_leds(&devs[1], 1);
+    return ok;
+}
+
+/*
+ * main
+ *   DESCRIPTION: Drive two emulated controllers through the driver at
+ *                once and check that their state stays apart.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if every check passed, 3 otherwise
+ *   SIDE EFFECTS: prints results
+ */
+int main() {
+    static multi_dev_t devs[MULTI_DEVS];
+    struct tux_state s;
+    unsigned long sets;
+    int i, k, ok = 1;
+
+    for (k = 0; k < MULTI_DEVS; k++)
+        if (open_dev(&devs[k]) != 0)
+            return 3;
+    usleep(MULTI_WAIT_US);
+
+    /* button changes, interleaved between the controllers */
+    for (i = 0; i < MULTI_PRESSES; i++) {
+        for (k = 0; k < MULTI_DEVS; k++)
+            tuxemu_set_buttons(&devs[k].emu, press_value(k, i));
+        usleep(MULTI_WAIT_US / 20);
+        for (k = 0; k < MULTI_DEVS; k++)
+            read_events(&devs[k], k);
+    }
+    usleep(MULTI_WAIT_US);
+    for (k = 0; k < MULTI_DEVS; k++) {
+        read_events(&devs[k], k);
+        (void)tux_state_read(devs[k].state, &s);
+        printf("controller %d: %d button events, %d wrong; page buttons %02lx\n",
+               k, devs[k].n_events, devs[k].bad_events, s.buttons);
+        if (devs[k].n_events != MULTI_PRESSES || devs[k].bad_events != 0 ||
+            s.buttons != press_value(k, MULTI_PRESSES - 1))
+            ok = 0;
+    }
+
+    /* a different value on each controller's LEDs */
+    for (k = 0; k < MULTI_DEVS; k++) {
+        devs[k].led = 0x000F0000 | (0x1234 * (k + 1));
+        (void)ioctl(devs[k].fd, TUX_SET_LED, devs[k].led);
+    }
+    usleep(MULTI_WAIT_US);
+    for (k = 0; k < MULTI_DEVS; k++)
+        ok &= check_leds(&devs[k], k);
+
+    /* a reset of the first controller is repaired on it alone */
+    sets = devs[1].emu.led_sets;
+    tuxemu_reset(&devs[0].emu);
+    usleep(MULTI_WAIT_US);
+    for (k = 0; k < MULTI_DEVS; k++)
+        ok &= check_leds(&devs[k], k);
+    if (devs[1].emu.led_sets != sets) {
+        printf("controller 1: LEDs set again after controller 0 reset\n");
+        ok = 0;
+    }
+
+    /* several commands at once, on the first controller */
+    ok &= check_batch(devs);
+
+    printf("%s\n", (ok ? "ok" : "FAILED"));
+    for (k = 0; k < MULTI_DEVS; k++) {
+        (void)close(devs[k].fd);
+        tuxemu_stop(&devs[k].emu);
+    }
+    return (ok ? 0 : 3);
+}